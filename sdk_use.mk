@@ -7,11 +7,20 @@ camerad_SOURCES += src/omx/buffer_pool.cpp
 camerad_SOURCES += src/omx/camera_component.cpp
 camerad_SOURCES += src/omx/encoder_configure.cpp
 camerad_SOURCES += src/omx/file_component.cpp
+camerad_SOURCES += src/omx/ts_component.cpp
 camerad_SOURCES += src/omx/preview_component.cpp
+camerad_SOURCES += src/omx/nal_scan.cpp
 camerad_SOURCES += src/qcamvid_session.cpp
 camerad_SOURCES += src/js_invoke.cpp
 camerad_SOURCES += src/fpv_server.cpp
 camerad_SOURCES += src/fpv_h264.cpp
+camerad_SOURCES += src/fpv_rate.cpp
+camerad_SOURCES += src/fpv_scheduler.cpp
+camerad_SOURCES += src/fpv_rtp_sink.cpp
+camerad_SOURCES += src/fpv_fec.cpp
+camerad_SOURCES += src/fpv_multicast.cpp
+camerad_SOURCES += src/fpv_fmp4.cpp
+camerad_SOURCES += src/fpv_http.cpp
 camerad_SOURCES += src/pid_lock.cpp
 camerad_SOURCES += src/json/js.c
 camerad_SOURCES += src/json/jsgen.c
@@ -23,6 +32,20 @@ camerad_OBJS := $(camerad_OBJS:%.cpp=%.o)
 camclient_SOURCES = src/qcamclient.cpp
 camclient_OBJS = $(camclient_SOURCES:%.cpp=%.o)
 
+rtp_spacing_SOURCES = src/test/rtp_spacing.cpp
+rtp_spacing_OBJS = $(rtp_spacing_SOURCES:%.cpp=%.o)
+
+fpv_fec_test_SOURCES  = src/test/fpv_fec_test.cpp
+fpv_fec_test_SOURCES += src/fpv_fec.cpp
+fpv_fec_test_OBJS = $(fpv_fec_test_SOURCES:%.cpp=%.o)
+
+nal_scan_bench_SOURCES  = src/test/nal_scan_bench.cpp
+nal_scan_bench_SOURCES += src/omx/nal_scan.cpp
+nal_scan_bench_OBJS = $(nal_scan_bench_SOURCES:%.cpp=%.o)
+
+check_PROGRAMS  = fpv_fec_test
+check_PROGRAMS += nal_scan_bench
+
 CPPFLAGS += -std=c++11 -DHAVE_SYS_UIO_H
 CPPFLAGS += -I $(SDKTARGETSYSROOT)/usr/include/live555
 CPPFLAGS += -I $(SDKTARGETSYSROOT)/usr/include/omx
@@ -42,5 +65,21 @@ camerad: $(camerad_OBJS)
 camclient: $(camclient_SOURCES:%.cpp=%.o)
 	$(CXX) $(LDFLAGS) $(LOADLIBES) $(LDLIBS) -o $@ $^
 
+tools: rtp_spacing
+
+rtp_spacing: $(rtp_spacing_OBJS)
+	$(CXX) -o $@ $^
+
+fpv_fec_test: $(fpv_fec_test_OBJS)
+	$(CXX) -o $@ $^
+
+nal_scan_bench: $(nal_scan_bench_OBJS)
+	$(CXX) -o $@ $^
+
+check: $(check_PROGRAMS)
+	@for t in $(check_PROGRAMS); do ./$$t || exit 1; done
+
 clean:
 	rm -f camerad camclient $(camclient_OBJS) $(camerad_OBJS)
+	rm -f rtp_spacing $(rtp_spacing_OBJS)
+	rm -f $(check_PROGRAMS) $(fpv_fec_test_OBJS) $(nal_scan_bench_OBJS)
@@ -110,4 +110,30 @@ std::shared_ptr<camera::ICameraDevice> CameraFactory::get(int index)
     }
     return s;
 }
+
+std::shared_ptr<camera::ICameraDevice> CameraFactory::getScaled(int index,
+    uint32_t inWidth, uint32_t inHeight, uint32_t outWidth, uint32_t outHeight)
+{
+    std::shared_ptr<camera::ICameraDevice> s = nullptr;
+    std::shared_ptr<camera::ICameraDevice> source = get(index);
+    camera::ICameraDevice* icd;
+    int rc;
+
+    if (nullptr == source) {
+        THROW(rc, ENODEV);
+    }
+
+    TRY(rc, CameraVirtual_CreateScaled(source.get(), inWidth, inHeight,
+                                       outWidth, outHeight, &icd));
+
+    QCAM_INFO("camera[%d] scaled to %ux%u\n", index, outWidth, outHeight);
+
+    /* the scaled device listens to the source, keep it until deleted */
+    s.reset(icd, [source](camera::ICameraDevice* p) {
+        camera::ICameraDevice::deleteInstance(&p);
+    });
+
+    CATCH(rc) {}
+    return s;
+}
 }
@@ -53,6 +53,20 @@ public:
      @return std::shared_ptr<camera::ICameraDevice>
      **/
     static std::shared_ptr<camera::ICameraDevice> get(int index);
+
+    /**
+     return a shared pointer wrapped on a new device streaming the preview
+     frames of a camera scaled down, e.g. for a layer of a simulcast. The
+     scaled devices aren't shared, each keeps the camera it scales alive.
+
+     @param index : index of the camera attached to device.
+     @param inWidth, inHeight : preview size the camera is streamed at
+     @param outWidth, outHeight : preview size of the scaled device
+     @return std::shared_ptr<camera::ICameraDevice> : nullptr on failure
+     **/
+    static std::shared_ptr<camera::ICameraDevice> getScaled(int index,
+        uint32_t inWidth, uint32_t inHeight,
+        uint32_t outWidth, uint32_t outHeight);
 };
 }
 
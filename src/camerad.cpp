@@ -75,6 +75,14 @@ const char usageStr[] =
     "                    default \"/\"\n"
     "  -h              print this message\n"
     "  -p              run as foreground program\n"
+    "  -t <threads>    number of rtsp serving threads [1]\n"
+    "                    the clients are spread over the threads\n"
+    "  -s <percent>    pace the rtp packets of a frame over this percent\n"
+    "                    of the frame interval, 0 sends at line rate [0]\n"
+    "  -x              pace with SO_TXTIME departure times rather than\n"
+    "                    a token bucket, needs the fq or etf qdisc\n"
+    "  -w <port>       serve the rtsp sessions as fragmented mp4 over http\n"
+    "                    on this port, 0 doesn't serve them [0]\n"
 ;
 
 static inline void printUsageExit()
@@ -91,6 +99,18 @@ static void validateConfigExit(DaemonConfig& cfg)
         QCAM_MSG("ERROR: Invalid log level\n");
         printUsageExit();
     }
+    if (cfg.rtspThreads < 1 || cfg.rtspThreads > RTSP_THREADS_MAX) {
+        QCAM_MSG("ERROR: Invalid number of rtsp threads\n");
+        printUsageExit();
+    }
+    if (cfg.rtpPacing > 100) {
+        QCAM_MSG("ERROR: Invalid rtp pacing\n");
+        printUsageExit();
+    }
+    if (cfg.httpPort > 65535) {
+        QCAM_MSG("ERROR: Invalid http port\n");
+        printUsageExit();
+    }
 }
 
 /* parses commandline options and populates the config
@@ -100,7 +120,7 @@ static DaemonConfig parseCommandline(int argc, char* argv[])
     DaemonConfig cfg;
     int c;
 
-    while ((c = getopt(argc, argv, "phlqd:D:")) != -1) {
+    while ((c = getopt(argc, argv, "phlqxd:D:t:s:w:")) != -1) {
         switch (c) {
         case 'l':
             STDERR_LOGGING = true;
@@ -118,6 +138,18 @@ static DaemonConfig parseCommandline(int argc, char* argv[])
         case 'D':
             home_dir = (const char*)optarg;
             break;
+        case 't':
+            cfg.rtspThreads = (unsigned) atoi(optarg);
+            break;
+        case 's':
+            cfg.rtpPacing = (unsigned) atoi(optarg);
+            break;
+        case 'x':
+            cfg.rtpTxtime = true;
+            break;
+        case 'w':
+            cfg.httpPort = (unsigned) atoi(optarg);
+            break;
         case 'h':
         case '?':
             printUsageExit();
@@ -217,6 +249,45 @@ int camerad::cfgGetCamera(int indx, JSONParser& jpret)
     return rc;
 }
 
+int camerad::cfgGetSession(int indx, const char* name, JSONParser& jpret)
+{
+    JSONID jsid;
+    JSONEnumState jsenum;
+    int rc = 0;
+    JSONParser jp;
+
+    TRY(rc, cfgGetCamera(indx, jp));
+
+    rc = ENOENT;
+
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&jp, 0, "sessions", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_ArrayEnumInit(&jp, jsid, &jsenum)) {
+        JSONID jsid_session;
+        char session[64];
+        int n;
+
+        /* for each session try to match the name */
+        while (JSONPARSER_SUCCESS == JSONParser_ArrayNext(&jp, &jsenum,
+                                                          &jsid_session)) {
+            if (JSONPARSER_SUCCESS == JSONParser_Lookup(
+                &jp, jsid_session, "name", 0, &jsid) &&
+                JSONPARSER_SUCCESS == JSONParser_GetString(&jp, jsid, session,
+                                                           sizeof(session), &n)
+                && n <= (int)sizeof(session) && 0 == strcmp(session, name)) {
+                const char* p;
+
+                JSONParser_GetJSON(&jp, jsid_session, &p, &n);
+                JSONParser_Ctor(&jpret, p, n);
+
+                rc = 0;
+                break;
+            }
+        }
+    }
+
+    CATCH(rc) {}
+    return rc;
+}
 
 /* prints application config on stderr */
 static
@@ -227,6 +298,10 @@ void printConfig(const DaemonConfig &cfg)
     QCAM_MSG("log level = %d\n", cfg.logLevel);
     QCAM_MSG("quit? = %s\n", cfg.quit ? "yes" : "no");
     QCAM_MSG("daemon? = %s\n", cfg.daemon ? "yes" : "no");
+    QCAM_MSG("rtsp threads = %u\n", cfg.rtspThreads);
+    QCAM_MSG("rtp pacing = %u%%\n", cfg.rtpPacing);
+    QCAM_MSG("rtp txtime? = %s\n", cfg.rtpTxtime ? "yes" : "no");
+    QCAM_MSG("http port = %u\n", cfg.httpPort);
     QCAM_MSG("===============================\n");
 }
 
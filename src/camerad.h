@@ -52,10 +52,15 @@ struct DaemonConfig
     bool quit = false;
     DaemonLoglevel logLevel = QCAM_LOG_ERROR;
     bool daemon = true;
+    unsigned rtspThreads = 1;   /* rtsp clients are spread over this many threads */
+    unsigned rtpPacing = 0;     /* percent of the frame interval to pace a frame over */
+    bool rtpTxtime = false;     /* pace with SO_TXTIME departure times, not from the loop */
+    unsigned httpPort = 0;      /* port of the fmp4 over http, 0 for none */
 };
 
 #define PID_FILE "/var/run/camerad.pid"
 #define CONFIG_FILE "camerad.json"
+#define RTSP_THREADS_MAX 16
 
 int daemonMain(const DaemonConfig& cfg);
 
@@ -69,6 +74,17 @@ int daemonMain(const DaemonConfig& cfg);
  **/
 int cfgGetCamera(int indx, JSONParser& jp);
 
+/**
+ Get the configuration of a session of the camera identified by the indx.
+
+ @param indx : index of the camera connected to device.
+ @param name : name of the session in the "sessions" of the camera.
+ @param jp : initialize parser to the json object.
+
+ @return int : ENOENT if the camera has no such session.
+ **/
+int cfgGetSession(int indx, const char* name, JSONParser& jp);
+
 }
 #endif
 
@@ -0,0 +1,287 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_fec.h"
+#include <algorithm>
+#include <string.h>
+
+namespace camerad
+{
+
+/** dst ^= src, a word at a time */
+static void xorInto(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/** @return uint64_t : the 48 bit mask of a parity packet, bit 47 is the base */
+static uint64_t getMask(const uint8_t* fec)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < 6; i++) {
+        mask = mask << 8 | fec[FEC_RTP_HEADER_SIZE + 12 + i];
+    }
+    return mask;
+}
+
+void FecParity::reset(uint16_t seqBase)
+{
+    base_ = seqBase;
+    mask_ = 0;
+    length_ = 0;
+    memset(bits_, 0, sizeof(bits_));
+}
+
+void FecParity::add(const struct iovec* iov, size_t count)
+{
+    const uint8_t* h = (const uint8_t*)iov[0].iov_base;
+    uint16_t offset = get16(h + 2) - base_;
+    size_t len = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        len += iov[i].iov_len;
+    }
+    len = std::min<size_t>(len - FEC_RTP_HEADER_SIZE, FEC_PAYLOAD_MAX);
+
+    mask_ |= 1ULL << (FEC_MASK_PACKETS - 1 - offset);
+    bits_[0] ^= h[0];
+    bits_[1] ^= h[1];
+    xorInto(bits_ + 2, h + 4, 4);   /* timestamp */
+    bits_[6] ^= len >> 8;
+    bits_[7] ^= len & 0xFF;
+
+    /* the shorter packets are padded with zeros */
+    if (length_ < len) {
+        memset(payload_ + length_, 0, len - length_);
+        length_ = len;
+    }
+
+    size_t pos = 0;
+    size_t skip = FEC_RTP_HEADER_SIZE;
+    for (size_t i = 0; i < count && pos < len; i++) {
+        size_t n = std::min(iov[i].iov_len - skip, len - pos);
+
+        xorInto(payload_ + pos, (const uint8_t*)iov[i].iov_base + skip, n);
+        pos += n;
+        skip = 0;
+    }
+}
+
+size_t FecParity::write(uint8_t* out, uint8_t payloadType, uint16_t seq,
+                        uint32_t timestamp, uint32_t ssrc) const
+{
+    uint8_t* f = out + FEC_RTP_HEADER_SIZE;
+
+    out[0] = 0x80;   /* version 2 */
+    out[1] = payloadType & 0x7F;
+    put16(out + 2, seq);
+    put32(out + 4, timestamp);
+    put32(out + 8, ssrc);
+
+    f[0] = 0x40 | (bits_[0] & 0x3F);   /* long mask, P X CC recovery */
+    f[1] = bits_[1];                   /* M PT recovery */
+    put16(f + 2, base_);
+    memcpy(f + 4, bits_ + 2, 4);       /* TS recovery */
+    memcpy(f + 8, bits_ + 6, 2);       /* length recovery */
+    put16(f + 10, length_);            /* protection length */
+    for (int i = 0; i < 6; i++) {
+        f[12 + i] = mask_ >> (40 - 8 * i);
+    }
+    memcpy(f + FEC_HEADER_SIZE, payload_, length_);
+
+    return FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE + length_;
+}
+
+const std::vector<uint8_t>* FecReceiver::find(uint16_t seq) const
+{
+    const std::vector<uint8_t>& p = media_[seq % HISTORY];
+
+    if (FEC_RTP_HEADER_SIZE > p.size() || seq != get16(&p[2])) {
+        return NULL;
+    }
+    return &p;
+}
+
+void FecReceiver::store(const uint8_t* packet, size_t len)
+{
+    uint16_t seq = get16(packet + 2);
+
+    media_[seq % HISTORY].assign(packet, packet + len);
+    if (!started_ || 0 < (int16_t)(seq - highest_)) {
+        highest_ = seq;
+        started_ = true;
+    }
+}
+
+/**
+ recover the one packet the parity packet is missing.
+
+ @return int : packets missing, the packet is in out when just one
+ **/
+int FecReceiver::recover(const std::vector<uint8_t>& fec,
+                         std::vector<uint8_t>& out) const
+{
+    const uint8_t* f = &fec[FEC_RTP_HEADER_SIZE];
+    uint16_t base = get16(f + 2);
+    uint64_t mask = getMask(fec.data());
+    size_t length = get16(f + 10);
+    uint8_t bits[8];
+    uint16_t lost = 0;
+    int missing = 0;
+
+    for (int k = 0; k < FEC_MASK_PACKETS; k++) {
+        if (0 != (mask & (1ULL << (FEC_MASK_PACKETS - 1 - k)))
+            && NULL == find(base + k)) {
+            lost = base + k;
+            missing++;
+        }
+    }
+    if (1 != missing || fec.size() < FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE + length) {
+        return missing;
+    }
+
+    bits[0] = f[0];
+    bits[1] = f[1];
+    memcpy(bits + 2, f + 4, 4);
+    memcpy(bits + 6, f + 8, 2);
+    out.assign(FEC_RTP_HEADER_SIZE + length, 0);
+    memcpy(&out[FEC_RTP_HEADER_SIZE], f + FEC_HEADER_SIZE, length);
+
+    for (int k = 0; k < FEC_MASK_PACKETS; k++) {
+        const std::vector<uint8_t>* p;
+        size_t len;
+
+        if (0 == (mask & (1ULL << (FEC_MASK_PACKETS - 1 - k)))
+            || NULL == (p = find(base + k))) {
+            continue;
+        }
+        len = p->size() - FEC_RTP_HEADER_SIZE;
+        bits[0] ^= (*p)[0];
+        bits[1] ^= (*p)[1];
+        xorInto(bits + 2, &(*p)[4], 4);
+        bits[6] ^= len >> 8;
+        bits[7] ^= len & 0xFF;
+        xorInto(&out[FEC_RTP_HEADER_SIZE], &(*p)[FEC_RTP_HEADER_SIZE],
+                std::min(len, length));
+    }
+
+    size_t len = get16(bits + 6);
+    if (length < len) {
+        out.clear();
+        return 2;   /* inconsistent, as good as unrecoverable */
+    }
+    out.resize(FEC_RTP_HEADER_SIZE + len);
+    out[0] = 0x80 | (bits[0] & 0x3F);
+    out[1] = bits[1];
+    put16(&out[2], lost);
+    memcpy(&out[4], bits + 2, 4);
+    memcpy(&out[8], &fec[8], 4);   /* ssrc */
+    return 1;
+}
+
+int FecReceiver::receive(const uint8_t* packet, size_t len,
+                         std::vector<std::vector<uint8_t>>& out)
+{
+    int recovered = 0;
+    bool progress = true;
+
+    if (FEC_RTP_HEADER_SIZE > len || 2 != packet[0] >> 6) {
+        return -1;
+    }
+    if (mediaPt_ == (packet[1] & 0x7F)) {
+        store(packet, len);
+    }
+    else if (fecPt_ == (packet[1] & 0x7F)
+             && FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE <= len) {
+        pending_.push_back(std::vector<uint8_t>(packet, packet + len));
+    }
+    else {
+        return -1;
+    }
+
+    /* a recovered packet may complete another group */
+    while (progress) {
+        progress = false;
+
+        for (size_t i = 0; i < pending_.size(); ) {
+            std::vector<uint8_t> rec;
+            uint16_t base = get16(&pending_[i][FEC_RTP_HEADER_SIZE + 2]);
+            int missing = recover(pending_[i], rec);
+
+            if (1 == missing) {
+                store(rec.data(), rec.size());
+                out.push_back(rec);
+                recovered_++;
+                recovered++;
+                progress = true;
+            }
+            else if (0 != missing
+                     && (int16_t)(highest_ - base) < (int)(HISTORY - FEC_MASK_PACKETS)) {
+                i++;   /* the rest of the group may still come */
+                continue;
+            }
+            else if (0 != missing) {
+                unrecoverable_++;
+            }
+            pending_.erase(pending_.begin() + i);
+        }
+    }
+    return recovered;
+}
+}
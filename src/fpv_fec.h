@@ -0,0 +1,137 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_FEC_H__
+#define __FPV_FEC_H__
+
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/* octets of the rtp header, without csrc nor extension */
+#define FEC_RTP_HEADER_SIZE 12
+
+/* octets of the FEC header and of the level 0 header with the long mask */
+#define FEC_HEADER_SIZE (10 + 8)
+
+/* packets a parity packet protects at most, from its sequence number base */
+#define FEC_MASK_PACKETS 48
+
+/* octets of a media packet protected at most, its rtp header excluded */
+#define FEC_PAYLOAD_MAX 1500
+
+namespace camerad
+{
+
+/**
+ The parity packet of a group of rtp packets, ULPFEC of RFC 5109 with a
+ single protection level and the long mask. Any one packet of the group is
+ recovered from the others and the parity packet.
+
+ The parity packets go on the ssrc and in the sequence of the media, with
+ their own payload type (the RFC 5109 "ulpfec" format, without RED).
+ **/
+class FecParity
+{
+public:
+    /** start over, the group is of the packets from seqBase on */
+    void reset(uint16_t seqBase);
+
+    /**
+     add a packet of the group, within FEC_MASK_PACKETS of the base.
+
+     @param iov : the packet, the rtp header in the first iovec
+     **/
+    void add(const struct iovec* iov, size_t count);
+
+    /**
+     write the parity packet of the group.
+
+     @param out : FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_PAYLOAD_MAX octets
+     @return size_t : octets of the parity packet, rtp header included
+     **/
+    size_t write(uint8_t* out, uint8_t payloadType, uint16_t seq,
+                 uint32_t timestamp, uint32_t ssrc) const;
+
+    /** @return bool : no packet in the group */
+    bool empty() const { return 0 == mask_; }
+
+private:
+    uint16_t base_ = 0;
+    uint64_t mask_ = 0;         /**< bit 47 is the base */
+    uint8_t bits_[8];           /**< the header recovery, see write() */
+    uint16_t length_ = 0;       /**< protection length */
+    uint8_t payload_[FEC_PAYLOAD_MAX];
+};
+
+/**
+ The reference receiver of the parity packets. It holds the recent media
+ packets and recovers a lost one where a parity packet is missing just that
+ one. Meant for testing a link, it allocates as it goes.
+ **/
+class FecReceiver
+{
+public:
+    FecReceiver(uint8_t mediaPayloadType, uint8_t fecPayloadType)
+    : mediaPt_(mediaPayloadType), fecPt_(fecPayloadType) {}
+
+    /**
+     take a received rtp packet.
+
+     @param out : the packets recovered with its help are appended
+     @return int : packets recovered, -1 if it is not a packet of the stream
+     **/
+    int receive(const uint8_t* packet, size_t len,
+                std::vector<std::vector<uint8_t>>& out);
+
+    uint64_t recovered() const { return recovered_; }
+
+    /** @return uint64_t : parity packets expired with more than one missing */
+    uint64_t unrecoverable() const { return unrecoverable_; }
+
+private:
+    /* media packets held, by the low bits of their sequence number */
+    static const size_t HISTORY = 256;
+
+    const std::vector<uint8_t>* find(uint16_t seq) const;
+    void store(const uint8_t* packet, size_t len);
+    int recover(const std::vector<uint8_t>& fec, std::vector<uint8_t>& out) const;
+
+    uint8_t mediaPt_;
+    uint8_t fecPt_;
+    std::vector<uint8_t> media_[HISTORY];
+    std::vector<std::vector<uint8_t>> pending_;  /**< parity packets not yet used */
+    uint16_t highest_ = 0;      /**< highest sequence number seen */
+    bool started_ = false;
+    uint64_t recovered_ = 0;
+    uint64_t unrecoverable_ = 0;
+};
+}
+
+#endif /* !__FPV_FEC_H__ */
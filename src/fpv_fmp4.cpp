@@ -0,0 +1,486 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_fmp4.h"
+#include <errno.h>
+
+/* sample_flags of trun: sample_depends_on and sample_is_non_sync_sample */
+#define FMP4_SAMPLE_SYNC     0x02000000
+#define FMP4_SAMPLE_NON_SYNC 0x01010000
+
+/* trun flags: data-offset, sample-duration, sample-size and sample-flags */
+#define FMP4_TRUN_FLAGS 0x000701
+
+/* tfhd flag: the data offsets are from the moof */
+#define FMP4_TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+
+namespace camerad
+{
+
+static void put8(std::string& b, uint8_t v)
+{
+    b.push_back((char)v);
+}
+
+static void put16(std::string& b, uint16_t v)
+{
+    put8(b, v >> 8);
+    put8(b, v);
+}
+
+static void put32(std::string& b, uint32_t v)
+{
+    put16(b, v >> 16);
+    put16(b, v);
+}
+
+static void put64(std::string& b, uint64_t v)
+{
+    put32(b, v >> 32);
+    put32(b, v);
+}
+
+static void set32(std::string& b, size_t at, uint32_t v)
+{
+    b[at] = (char)(v >> 24);
+    b[at + 1] = (char)(v >> 16);
+    b[at + 2] = (char)(v >> 8);
+    b[at + 3] = (char)v;
+}
+
+/** @return size_t : offset of the box, for endBox() */
+static size_t beginBox(std::string& b, const char* type)
+{
+    size_t at = b.size();
+
+    put32(b, 0);
+    b.append(type, 4);
+    return at;
+}
+
+static size_t beginFullBox(std::string& b, const char* type, uint8_t version,
+                           uint32_t flags)
+{
+    size_t at = beginBox(b, type);
+
+    put32(b, (uint32_t)version << 24 | (flags & 0xFFFFFF));
+    return at;
+}
+
+static void endBox(std::string& b, size_t at)
+{
+    set32(b, at, b.size() - at);
+}
+
+/* the unity matrix of mvhd and tkhd */
+static void putMatrix(std::string& b)
+{
+    static const uint32_t unity[9] = {
+        0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+    };
+
+    for (uint32_t v : unity) {
+        put32(b, v);
+    }
+}
+
+/** reads the fields of the RBSP of a NAL unit */
+class BitReader
+{
+public:
+    /** drop the header and the emulation prevention octets of the NAL unit */
+    BitReader(const std::vector<uint8_t>& nal)
+    {
+        unsigned zeros = 0;
+
+        for (size_t i = 1; i < nal.size(); i++) {
+            if (2 <= zeros && 3 == nal[i]) {
+                zeros = 0;
+                continue;
+            }
+            zeros = (0 == nal[i]) ? zeros + 1 : 0;
+            rbsp_.push_back(nal[i]);
+        }
+    }
+
+    /** @return bool : read past the end */
+    bool overrun() const { return bit_ > rbsp_.size() * 8; }
+
+    unsigned u(unsigned bits)
+    {
+        unsigned v = 0;
+
+        while (bits--) {
+            v <<= 1;
+            if (bit_ < rbsp_.size() * 8) {
+                v |= (rbsp_[bit_ >> 3] >> (7 - (bit_ & 7))) & 1;
+            }
+            bit_++;
+        }
+        return v;
+    }
+
+    /** Exp-Golomb */
+    unsigned ue()
+    {
+        unsigned zeros = 0;
+
+        while (0 == u(1) && !overrun() && zeros < 31) {
+            zeros++;
+        }
+        return ((1u << zeros) - 1) + u(zeros);
+    }
+
+    int se()
+    {
+        unsigned k = ue();
+
+        return (k & 1) ? (int)((k + 1) / 2) : -(int)(k / 2);
+    }
+
+private:
+    std::vector<uint8_t> rbsp_;
+    size_t bit_ = 0;
+};
+
+/* the profiles with the chroma format and the bit depths in the sps */
+static bool isHighProfile(unsigned profile)
+{
+    switch (profile) {
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+    case 118: case 128: case 138: case 139: case 134: case 135:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** the picture size of the sps, 7.3.2.1.1 of ISO/IEC 14496-10 */
+int Fmp4Muxer::parseSps(const std::vector<uint8_t>& sps)
+{
+    BitReader br(sps);
+    unsigned profile;
+    unsigned widthMbs;
+    unsigned heightMaps;
+    unsigned frameMbsOnly;
+    unsigned cropX = 1;
+    unsigned cropY;
+    unsigned crop[4] = {0, 0, 0, 0};
+
+    if (4 > sps.size()) {
+        return EINVAL;
+    }
+
+    profile = br.u(8);
+    br.u(16);              /* constraint flags, level_idc */
+    br.ue();               /* seq_parameter_set_id */
+
+    chromaFormat_ = 1;
+    bitDepthLuma_ = 8;
+    bitDepthChroma_ = 8;
+    if (isHighProfile(profile)) {
+        chromaFormat_ = br.ue();
+        if (3 == chromaFormat_) {
+            br.u(1);       /* separate_colour_plane_flag */
+        }
+        bitDepthLuma_ = 8 + br.ue();
+        bitDepthChroma_ = 8 + br.ue();
+        br.u(1);           /* qpprime_y_zero_transform_bypass_flag */
+        if (br.u(1)) {     /* seq_scaling_matrix_present_flag */
+            for (unsigned i = 0; i < ((3 != chromaFormat_) ? 8u : 12u); i++) {
+                if (!br.u(1)) {
+                    continue;
+                }
+                int last = 8;
+                int next = 8;
+                for (unsigned j = 0; j < (6 > i ? 16u : 64u) && 0 != next; j++) {
+                    next = (last + br.se() + 256) % 256;
+                    last = (0 == next) ? last : next;
+                }
+            }
+        }
+    }
+
+    br.ue();               /* log2_max_frame_num_minus4 */
+    switch (br.ue()) {     /* pic_order_cnt_type */
+    case 0:
+        br.ue();           /* log2_max_pic_order_cnt_lsb_minus4 */
+        break;
+    case 1: {
+        br.u(1);           /* delta_pic_order_always_zero_flag */
+        br.se();           /* offset_for_non_ref_pic */
+        br.se();           /* offset_for_top_to_bottom_field */
+        unsigned cycle = br.ue();
+        for (unsigned i = 0; i < cycle && !br.overrun(); i++) {
+            br.se();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    br.ue();               /* max_num_ref_frames */
+    br.u(1);               /* gaps_in_frame_num_value_allowed_flag */
+    widthMbs = br.ue() + 1;
+    heightMaps = br.ue() + 1;
+    frameMbsOnly = br.u(1);
+    if (!frameMbsOnly) {
+        br.u(1);           /* mb_adaptive_frame_field_flag */
+    }
+    br.u(1);               /* direct_8x8_inference_flag */
+    if (br.u(1)) {         /* frame_cropping_flag */
+        for (unsigned& c : crop) {
+            c = br.ue();
+        }
+    }
+    if (br.overrun()) {
+        return EINVAL;
+    }
+
+    /* the crop units of table 6-1 */
+    cropY = 2 - frameMbsOnly;
+    if (1 == chromaFormat_ || 2 == chromaFormat_) {
+        cropX = 2;
+    }
+    if (1 == chromaFormat_) {
+        cropY *= 2;
+    }
+
+    width_ = widthMbs * 16 - cropX * (crop[0] + crop[1]);
+    height_ = (2 - frameMbsOnly) * heightMaps * 16 - cropY * (crop[2] + crop[3]);
+    if (0 == width_ || 0xFFFF < width_ || 0 == height_ || 0xFFFF < height_) {
+        return EINVAL;
+    }
+    return 0;
+}
+
+int Fmp4Muxer::init(const omxa::ParameterSets& ps)
+{
+    size_t moov, trak, mdia, minf, dinf, dref, stbl, stsd, avc1, avcC, mvex, box;
+    int rc;
+
+    if (ps.empty() || 0xFFFF < ps.sps.size() || 0xFFFF < ps.pps.size()) {
+        return EINVAL;
+    }
+    rc = parseSps(ps.sps);
+    if (0 != rc) {
+        return rc;
+    }
+    ps_ = ps;
+    init_.clear();
+
+    box = beginBox(init_, "ftyp");
+    init_.append("iso6", 4);     /* major brand */
+    put32(init_, 0);
+    init_.append("iso6cmfcisommp41", 16);
+    endBox(init_, box);
+
+    moov = beginBox(init_, "moov");
+
+    box = beginFullBox(init_, "mvhd", 0, 0);
+    put32(init_, 0);               /* creation_time */
+    put32(init_, 0);               /* modification_time */
+    put32(init_, 1000);            /* timescale */
+    put32(init_, 0);               /* duration, unknown */
+    put32(init_, 0x00010000);      /* rate */
+    put16(init_, 0x0100);          /* volume */
+    init_.append(10, '\0');
+    putMatrix(init_);
+    init_.append(24, '\0');        /* pre_defined */
+    put32(init_, 2);               /* next_track_ID */
+    endBox(init_, box);
+
+    trak = beginBox(init_, "trak");
+
+    box = beginFullBox(init_, "tkhd", 0, 3);   /* enabled, in movie */
+    put32(init_, 0);
+    put32(init_, 0);
+    put32(init_, 1);               /* track_ID */
+    put32(init_, 0);
+    put32(init_, 0);               /* duration */
+    init_.append(8, '\0');
+    put16(init_, 0);               /* layer */
+    put16(init_, 0);               /* alternate_group */
+    put16(init_, 0);               /* volume */
+    put16(init_, 0);
+    putMatrix(init_);
+    put32(init_, width_ << 16);
+    put32(init_, height_ << 16);
+    endBox(init_, box);
+
+    mdia = beginBox(init_, "mdia");
+
+    box = beginFullBox(init_, "mdhd", 0, 0);
+    put32(init_, 0);
+    put32(init_, 0);
+    put32(init_, FMP4_TIMESCALE);
+    put32(init_, 0);
+    put16(init_, 0x55C4);          /* "und" */
+    put16(init_, 0);
+    endBox(init_, box);
+
+    box = beginFullBox(init_, "hdlr", 0, 0);
+    put32(init_, 0);
+    init_.append("vide", 4);
+    init_.append(12, '\0');
+    init_.append("VideoHandler", 13);
+    endBox(init_, box);
+
+    minf = beginBox(init_, "minf");
+
+    box = beginFullBox(init_, "vmhd", 0, 1);
+    init_.append(8, '\0');         /* graphicsmode, opcolor */
+    endBox(init_, box);
+
+    dinf = beginBox(init_, "dinf");
+    dref = beginFullBox(init_, "dref", 0, 0);
+    put32(init_, 1);
+    box = beginFullBox(init_, "url ", 0, 1);   /* in this file */
+    endBox(init_, box);
+    endBox(init_, dref);
+    endBox(init_, dinf);
+
+    stbl = beginBox(init_, "stbl");
+
+    stsd = beginFullBox(init_, "stsd", 0, 0);
+    put32(init_, 1);
+    avc1 = beginBox(init_, "avc1");
+    init_.append(6, '\0');
+    put16(init_, 1);               /* data_reference_index */
+    init_.append(16, '\0');
+    put16(init_, width_);
+    put16(init_, height_);
+    put32(init_, 0x00480000);      /* 72 dpi */
+    put32(init_, 0x00480000);
+    put32(init_, 0);
+    put16(init_, 1);               /* frame_count */
+    init_.append(32, '\0');        /* compressorname */
+    put16(init_, 0x0018);          /* depth */
+    put16(init_, 0xFFFF);
+
+    avcC = beginBox(init_, "avcC");
+    put8(init_, 1);                /* configurationVersion */
+    put8(init_, ps.sps[1]);        /* profile, compatibility, level */
+    put8(init_, ps.sps[2]);
+    put8(init_, ps.sps[3]);
+    put8(init_, 0xFF);             /* four octet NAL unit lengths */
+    put8(init_, 0xE1);             /* one sps */
+    put16(init_, ps.sps.size());
+    init_.append((const char*)ps.sps.data(), ps.sps.size());
+    put8(init_, 1);                /* one pps */
+    put16(init_, ps.pps.size());
+    init_.append((const char*)ps.pps.data(), ps.pps.size());
+    if (isHighProfile(ps.sps[1])) {
+        put8(init_, 0xFC | chromaFormat_);
+        put8(init_, 0xF8 | (bitDepthLuma_ - 8));
+        put8(init_, 0xF8 | (bitDepthChroma_ - 8));
+        put8(init_, 0);            /* numOfSequenceParameterSetExt */
+    }
+    endBox(init_, avcC);
+    endBox(init_, avc1);
+    endBox(init_, stsd);
+
+    /* the samples are in the fragments */
+    box = beginFullBox(init_, "stts", 0, 0);
+    put32(init_, 0);
+    endBox(init_, box);
+    box = beginFullBox(init_, "stsc", 0, 0);
+    put32(init_, 0);
+    endBox(init_, box);
+    box = beginFullBox(init_, "stsz", 0, 0);
+    put32(init_, 0);
+    put32(init_, 0);
+    endBox(init_, box);
+    box = beginFullBox(init_, "stco", 0, 0);
+    put32(init_, 0);
+    endBox(init_, box);
+
+    endBox(init_, stbl);
+    endBox(init_, minf);
+    endBox(init_, mdia);
+    endBox(init_, trak);
+
+    mvex = beginBox(init_, "mvex");
+    box = beginFullBox(init_, "trex", 0, 0);
+    put32(init_, 1);               /* track_ID */
+    put32(init_, 1);               /* default_sample_description_index */
+    put32(init_, 0);
+    put32(init_, 0);
+    put32(init_, 0);
+    endBox(init_, box);
+    endBox(init_, mvex);
+
+    endBox(init_, moov);
+    sequence_ = 0;
+    return 0;
+}
+
+void Fmp4Muxer::fragment(const std::vector<Fmp4Sample>& samples,
+                         uint64_t decodeTime, const char* mdat, size_t size,
+                         std::string& out)
+{
+    size_t moof, traf, box, offset;
+
+    moof = beginBox(out, "moof");
+
+    box = beginFullBox(out, "mfhd", 0, 0);
+    put32(out, ++sequence_);
+    endBox(out, box);
+
+    traf = beginBox(out, "traf");
+
+    box = beginFullBox(out, "tfhd", 0, FMP4_TFHD_DEFAULT_BASE_IS_MOOF);
+    put32(out, 1);                 /* track_ID */
+    endBox(out, box);
+
+    box = beginFullBox(out, "tfdt", 1, 0);
+    put64(out, decodeTime);
+    endBox(out, box);
+
+    box = beginFullBox(out, "trun", 0, FMP4_TRUN_FLAGS);
+    put32(out, samples.size());
+    offset = out.size();
+    put32(out, 0);                 /* data_offset, once the moof is known */
+    for (const Fmp4Sample& s : samples) {
+        put32(out, s.duration);
+        put32(out, s.size);
+        put32(out, s.sync ? FMP4_SAMPLE_SYNC : FMP4_SAMPLE_NON_SYNC);
+    }
+    endBox(out, box);
+
+    endBox(out, traf);
+    endBox(out, moof);
+
+    /* the data follows the header of the mdat */
+    set32(out, offset, out.size() - moof + 8);
+
+    put32(out, 8 + size);
+    out.append("mdat", 4);
+    out.append(mdat, size);
+}
+}
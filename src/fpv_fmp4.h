@@ -0,0 +1,103 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_FMP4_H__
+#define __FPV_FMP4_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "omx/preview_component.h"
+
+/* ticks per second of the media timeline, that of rtp video */
+#define FMP4_TIMESCALE 90000
+
+namespace camerad
+{
+
+/** a sample of a fragment, its data follows that of the previous sample */
+struct Fmp4Sample {
+    uint32_t size = 0;       /**< octets, the NAL unit length prefixes included */
+    uint32_t duration = 0;   /**< in FMP4_TIMESCALE ticks */
+    bool sync = false;       /**< an IDR frame */
+};
+
+/**
+ Mux H264 into fragmented MP4 (ISO/IEC 14496-12, the CMAF video track of
+ ISO/IEC 23000-19): an init segment, then a moof and mdat for every group of
+ samples. The samples are AVC access units of NAL units with four octet length
+ prefixes, without the parameter sets, which go in the init segment.
+ **/
+class Fmp4Muxer
+{
+public:
+    /**
+     make the init segment of the stream.
+
+     @param ps : the parameter sets of the stream
+     @return int : EINVAL if the sps can't be parsed
+     **/
+    int init(const omxa::ParameterSets& ps);
+
+    /** @return const std::string& : ftyp and moov, empty before init() */
+    const std::string& initSegment() const { return init_; }
+
+    /** @return const omxa::ParameterSets& : those of the init segment */
+    const omxa::ParameterSets& parameterSets() const { return ps_; }
+
+    unsigned width() const { return width_; }
+    unsigned height() const { return height_; }
+
+    /**
+     append a fragment to out.
+
+     @param samples : the samples of the fragment
+     @param decodeTime : of the first sample, in FMP4_TIMESCALE ticks
+     @param mdat : the data of the samples, back to back
+     @param size : octets at mdat
+     @param out : moof and mdat are appended to it
+     **/
+    void fragment(const std::vector<Fmp4Sample>& samples, uint64_t decodeTime,
+                  const char* mdat, size_t size, std::string& out);
+
+private:
+    omxa::ParameterSets ps_;
+    std::string init_;
+    unsigned width_ = 0;
+    unsigned height_ = 0;
+    unsigned chromaFormat_ = 1;   /**< chroma_format_idc of the sps */
+    unsigned bitDepthLuma_ = 8;
+    unsigned bitDepthChroma_ = 8;
+    uint32_t sequence_ = 0;       /**< of the last fragment */
+
+    int parseSps(const std::vector<uint8_t>& sps);
+};
+}
+
+#endif /* !__FPV_FMP4_H__ */
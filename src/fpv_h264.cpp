@@ -27,134 +27,852 @@
  *
  */
 #include "fpv_h264.h"
+#include "qcamvid_log.h"
+#include <algorithm>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* period of the receiver reports poll, in microseconds */
+#define FPV_RECEPTION_POLL_US 1000000
+
+/* payload type of the parity packets, after the one of the media */
+#define FPV_FEC_PAYLOAD_TYPE 1
+
+/* period of the throughput log of a mount point, in microseconds */
+#define FPV_THROUGHPUT_LOG_US 10000000
+
+/* loss of a client moving it down a layer, and polls without loss moving it
+   back up */
+#define FPV_LAYER_DOWN_LOSS 0.05
+#define FPV_LAYER_UP_POLLS 10
 
 /** Manage a H264 RTP streaming subsession. */
 namespace camerad
 {
-fpvH264::fpvH264(
-    UsageEnvironment& env, const char* params, int param_siz)
-: OnDemandServerMediaSubsession(env, True)
+/** The reader of a client moved between the layers of a simulcast. It reads
+ *  one layer at a time, a switch takes effect at the end of a frame and the
+ *  client picks up the other layer at its next sync frame. The NAL units of
+ *  the previous layer are held until the other layer delivers. */
+class fpvLayerSource : public FramedSource, public omxa::IFrameBoundary,
+    public omxa::INalUnits, public omxa::IReaderStats
 {
-    m_pSDPLine = NULL;
-    m_pDummyRTPSink = NULL;
-    m_done = 0;
+public:
+    static fpvLayerSource* createNew(UsageEnvironment& env, const fpvMountPtr& mount,
+                                     const std::shared_ptr<FramedSource>& src)
+    {
+        return new fpvLayerSource(env, mount, src);
+    }
+
+    /** @return unsigned : layer read from */
+    unsigned layer() const { return layer_; }
+
+    /** move to another layer, at the end of the current frame */
+    void switchTo(unsigned layer) { want_ = layer; }
+
+    virtual bool endsFrame() const
+    {
+        omxa::IFrameBoundary* fb = dynamic_cast<omxa::IFrameBoundary*>(src_.get());
+        return NULL != fb && fb->endsFrame();
+    }
+
+    virtual void readInPlace()
+    {
+        omxa::INalUnits* nals = dynamic_cast<omxa::INalUnits*>(src_.get());
+
+        inPlace_ = true;
+        if (NULL != nals) {
+            nals->readInPlace();
+        }
+    }
+
+    virtual const std::vector<struct iovec>& nalUnits() const
+    {
+        omxa::INalUnits* nals = dynamic_cast<omxa::INalUnits*>(src_.get());
+        return NULL != nals ? nals->nalUnits() : none_;
+    }
+
+    virtual void getStats(omxa::ReaderStats& out) const
+    {
+        omxa::IReaderStats* rs = dynamic_cast<omxa::IReaderStats*>(src_.get());
+
+        out = stats_;
+        if (NULL != rs) {
+            omxa::ReaderStats cur;
+            rs->getStats(cur);
+            out.dropped += cur.dropped;
+            out.resyncs += cur.resyncs;
+            out.overruns += cur.overruns;
+        }
+    }
+
+protected:
+    fpvLayerSource(UsageEnvironment& env, const fpvMountPtr& mount,
+                   const std::shared_ptr<FramedSource>& src)
+    : FramedSource(env), mount_(mount), src_(src) {}
+
+    virtual void doGetNextFrame()
+    {
+        if (want_ != layer_ && (!delivered_ || endsFrame())) {
+            doSwitch();
+        }
+        src_->getNextFrame(fTo, fMaxSize, afterGetting0, this,
+                           onClosure0, this);
+    }
+
+    virtual void doStopGettingFrames()
+    {
+        src_->stopGettingFrames();
+    }
+
+private:
+    void doSwitch()
+    {
+        std::shared_ptr<FramedSource> src;
+        omxa::IReaderStats* rs = dynamic_cast<omxa::IReaderStats*>(src_.get());
+
+        if (0 != mount_->openLayerSource(envir(), want_, lastPts_, src)) {
+            QCAM_ERR("%s: failed to switch to layer %u", mount_->name().c_str(),
+                     want_);
+            want_ = layer_;
+            return;
+        }
+        QCAM_INFO("%s: reader %p switched from layer %u to %u",
+                  mount_->name().c_str(), this, layer_, want_);
+
+        if (NULL != rs) {
+            omxa::ReaderStats cur;
+            rs->getStats(cur);
+            stats_.dropped += cur.dropped;
+            stats_.resyncs += cur.resyncs;
+            stats_.overruns += cur.overruns;
+        }
+
+        /* the sink may still be sending the NAL units of the last frame */
+        src_->stopGettingFrames();
+        prev_ = src_;
+        src_ = src;
+        layer_ = want_;
+        if (inPlace_) {
+            readInPlace();
+        }
+    }
+
+    static void afterGetting0(void* clientData, unsigned frameSize,
+                              unsigned numTruncatedBytes,
+                              struct timeval presentationTime,
+                              unsigned durationInMicroseconds)
+    {
+        fpvLayerSource* me = (fpvLayerSource*)clientData;
+
+        me->fFrameSize = frameSize;
+        me->fNumTruncatedBytes = numTruncatedBytes;
+        me->fPresentationTime = presentationTime;
+        me->fDurationInMicroseconds = durationInMicroseconds;
+        me->lastPts_ = presentationTime;
+        me->delivered_ = true;
+        me->prev_.reset();
+        FramedSource::afterGetting(me);
+    }
+
+    static void onClosure0(void* clientData)
+    {
+        fpvLayerSource* me = (fpvLayerSource*)clientData;
+        me->handleClosure();
+    }
+
+    fpvMountPtr mount_;
+    std::shared_ptr<FramedSource> src_;    /**< reader of the current layer */
+    std::shared_ptr<FramedSource> prev_;   /**< reader of the previous layer */
+    unsigned layer_ = 0;
+    unsigned want_ = 0;
+    bool inPlace_ = false;
+    bool delivered_ = false;   /**< src_ may be switched right away until then */
+    struct timeval lastPts_ = {0, 0};
+    omxa::ReaderStats stats_;  /**< of the readers of the previous layers */
+    std::vector<struct iovec> none_;
+};
+
+static int64_t monotonicUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+fpvMount::fpvMount(const std::string& name, const char* params, int param_siz,
+                   unsigned pacing, bool txtime)
+: name_(name), params_(params, param_siz), pacing_(pacing), txtime_(txtime)
+{
+    JSONParser js;
+    JSONType jt;
+    JSONID jsid;
+    unsigned int val = 0;
+    char buf[16];
+
+    if (0 == param_siz) {
+        return;
+    }
+    JSONParser_Ctor(&js, params, param_siz);
+    if (JSONPARSER_SUCCESS != JSONParser_GetType(&js, 0, &jt)
+        || JSONObject != jt) {
+        return;
+    }
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "fec", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)) {
+        fec_ = std::min<unsigned>(val, FEC_MASK_PACKETS);
+    }
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "nack", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)) {
+        nack_ = val;
+    }
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "fmp4-fragment", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetString(&js, jsid, buf,
+                                                      sizeof(buf), NULL)) {
+        gopFragments_ = (0 == strcmp(buf, "gop"));
+    }
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "idle-grace", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)) {
+        grace_ = val;
+    }
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "layers", 0, &jsid)) {
+        JSONID layer;
+
+        while (layers_ <= SESSION_MAX_LAYERS
+               && JSONPARSER_SUCCESS == JSONParser_ArrayLookup(&js, jsid,
+                                                               layers_ - 1,
+                                                               &layer)) {
+            layers_++;
+        }
+    }
+}
+
+/** the mount point is withdrawn or the server shut down, a stop scheduled
+ *  by the last client won't find it anymore */
+fpvMount::~fpvMount()
+{
+    if (running_) {
+        QCAM_INFO("%s: released, stopping", name_.c_str());
+        stopSessions_locked();
+    }
+}
+
+std::string fpvMount::layerName(unsigned layer) const
+{
+    if (0 == layer) {
+        return name_;
+    }
+    return name_ + "/layer" + std::to_string(layer);
+}
+
+/** start the rtp session of every layer. The lower layers listen to the
+ *  camera of layer 0, they are started ahead of it */
+int fpvMount::startSessions_locked()
+{
+    int rc = 0;
+
+    sessions_.resize(layers_);
+    for (unsigned k = layers_; 0 < k--; ) {
+        std::shared_ptr<ISession>& session = sessions_[k];
+
+        session = SessionMgr::get(QCAM_SESSION_RTP, layerName(k));
+        if (!session) {
+            rc = ENOMEM;
+            break;
+        }
+
+        if (params_.length()) {
+            JSONParser js;
+            JSONType jt;
+
+            JSONParser_Ctor(&js, params_.c_str(), params_.length());
+            if (JSONPARSER_SUCCESS == JSONParser_GetType(&js, 0, &jt)
+                && JSONObject == jt) {
+                (void)session->setConfig(js);
+            }
+        }
+        if (1 < layers_ && 0 != (rc = session->setLayer(k))) {
+            QCAM_ERR("%s: invalid layer %u", name_.c_str(), k);
+            break;
+        }
+
+        rc = session->start();
+        if (rc != EXIT_SUCCESS) {
+            break;
+        }
+    }
+
+    if (0 != rc) {
+        stopSessions_locked();
+    }
+    running_ = (0 == rc);
+    return rc;
+}
+
+/** stop the rtp session of every layer, layer 0 first */
+void fpvMount::stopSessions_locked()
+{
+    for (std::shared_ptr<ISession>& session : sessions_) {
+        if (session) {
+            session->stop();
+        }
+    }
+    running_ = false;
+}
+
+/** a stop scheduled by the last client leaving */
+struct fpvIdleStop {
+    std::weak_ptr<fpvMount> mount;
+    unsigned epoch;
+};
+
+void fpvMount::expireIdle0(void* clientData)
+{
+    fpvIdleStop* stop = (fpvIdleStop*)clientData;
+    fpvMountPtr me = stop->mount.lock();
 
-    /* retain the params for later creation of the source */
-    params_ = std::string(params, param_siz);
+    if (me) {
+        std::unique_lock<std::mutex> lk(me->lock_);
+
+        /* not if a client came back since, and left again later */
+        if (stop->epoch == me->idleEpoch_ && 0 == me->clients_ && me->running_) {
+            QCAM_INFO("%s: idle for %u ms, stopping", me->name_.c_str(), me->grace_);
+            me->stopSessions_locked();
+        }
+    }
+    delete stop;
+}
+
+int fpvMount::openFramedSource(UsageEnvironment& env,
+                               std::shared_ptr<FramedSource>& src,
+                               unsigned layer)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+
+    if (layers_ <= layer) {
+        return EINVAL;
+    }
+
+    if (0 == clients_ && !running_) {
+        int rc = startSessions_locked();
+        if (rc != EXIT_SUCCESS) {
+            return rc;
+        }
+    }
+
+    /* todo: revisit for a better architecture */
+    omxa::IPreviewComp* comp = dynamic_cast<omxa::IPreviewComp*>(sessions_[layer].get());
+    if (NULL == comp || 0 != comp->openFramedSource(env, src)) {
+        if (0 == clients_) {
+            stopSessions_locked();
+        }
+        return ENOSR;
+    }
+
+    clients_++;
+    return 0;
+}
+
+int fpvMount::openLayerSource(UsageEnvironment& env, unsigned layer,
+                              const struct timeval& after,
+                              std::shared_ptr<FramedSource>& src)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+
+    if (layers_ <= layer || 0 == clients_) {
+        return EINVAL;
+    }
+
+    omxa::IPreviewComp* comp = dynamic_cast<omxa::IPreviewComp*>(sessions_[layer].get());
+    if (NULL == comp || 0 != comp->openSwitchSource(env, after, src)) {
+        return ENOSR;
+    }
+    return 0;
+}
+
+void fpvMount::closeFramedSource(UsageEnvironment& env)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+
+    if (0 == clients_ || 0 != --clients_) {
+        return;
+    }
+
+    idleEpoch_++;
+    if (0 == grace_) {
+        stopSessions_locked();
+        return;
+    }
+    env.taskScheduler().scheduleDelayedTask((int64_t)grace_ * 1000, expireIdle0,
+        new fpvIdleStop{shared_from_this(), idleEpoch_});
+}
+
+int fpvMount::getParameterSets(omxa::ParameterSets& out, unsigned layer)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+    omxa::IPreviewComp* comp = NULL;
+
+    if (layer < sessions_.size()) {
+        comp = dynamic_cast<omxa::IPreviewComp*>(sessions_[layer].get());
+    }
+    if (NULL == comp) {
+        return ENODATA;
+    }
+    return comp->getParameterSets(out);
+}
+
+void fpvMount::reportReception(const ReceptionReport& rr, bool fresh,
+                               uint64_t octets)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+    int64_t now = monotonicUs();
+
+    if (fresh) {
+        worst_.fractionLost = std::max(worst_.fractionLost, rr.fractionLost);
+        worst_.rttMs = std::max(worst_.rttMs, rr.rttMs);
+        worst_.jitterMs = std::max(worst_.jitterMs, rr.jitterMs);
+        fresh_ = true;
+    }
+
+    /* the threads poll at the same period, report once for all of them */
+    if (FPV_RECEPTION_POLL_US * 9 / 10 <= now - reported_) {
+        if (fresh_ && 0 < clients_) {
+            sessions_[0]->reportReception(worst_);   /* fixed with layers */
+        }
+        reported_ = now;
+        worst_ = ReceptionReport();
+        fresh_ = false;
+    }
+
+    octets_ += octets;
+    if (0 == logged_) {
+        logged_ = now;
+    }
+    else if (FPV_THROUGHPUT_LOG_US <= now - logged_) {
+        QCAM_INFO("%s: %llu kbit/s to %u clients", name_.c_str(),
+                  (unsigned long long)(octets_ * 8000 / (now - logged_)),
+                  clients_);
+        octets_ = 0;
+        logged_ = now;
+    }
+}
+
+void fpvMount::setClientStats(const fpvH264* owner, std::vector<ClientStats>& stats)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+
+    if (stats.empty()) {
+        stats_.erase(owner);
+        return;
+    }
+    stats_[owner].swap(stats);
+}
+
+void fpvMount::getClientStats(std::vector<ClientStats>& out)
+{
+    std::unique_lock<std::mutex> lk(lock_);
+
+    for (auto& i : stats_) {
+        out.insert(out.end(), i.second.begin(), i.second.end());
+    }
+}
+
+fpvH264::fpvH264(UsageEnvironment& env, const fpvMountPtr& mount, unsigned layer)
+: OnDemandServerMediaSubsession(env, False), mount_(mount),   /* a source per client */
+  layer_(layer)
+{
+    m_pSDPLine = NULL;
+    m_fmtpLine[0] = 0;
 }
 
 fpvH264::~fpvH264(void)
 {
+    std::vector<ClientStats> none;
+
+    envir().taskScheduler().unscheduleDelayedTask(pollTask_);
+    mount_->setClientStats(this, none);
+
     if (m_pSDPLine) {
         free(m_pSDPLine);
         m_pSDPLine = NULL;
     }
 }
 
-fpvH264* fpvH264::createNew(UsageEnvironment& env, const char* params,
-                            int param_siz)
+fpvH264* fpvH264::createNew(UsageEnvironment& env, const fpvMountPtr& mount,
+                            unsigned layer)
 {
-    return new fpvH264(env, params, param_siz);
+    return new fpvH264(env, mount, layer);
 }
 
-/** Create the H264 video stream source and start the RTP session. */
+/** Create the H264 video stream source for a client. The first client of the
+ *  mount point starts the RTP session, the others share the same encoder. */
 FramedSource* fpvH264::createNewStreamSource(
     unsigned clientSessionId, unsigned& estBitrate)
 {
-    rtpSession_ = SessionMgr::get(QCAM_SESSION_RTP);
+    std::shared_ptr<FramedSource> src;
+    bool moving = FPV_LAYER_AUTO == layer_ && 1 < mount_->layerCount();
 
-    if (params_.length()) {
-        JSONParser js;
-        JSONType jt;
-
-        JSONParser_Ctor(&js, params_.c_str(), params_.length());
-        if (JSONPARSER_SUCCESS == JSONParser_GetType(&js, 0, &jt)
-            && JSONObject == jt) {
-            (void)rtpSession_->setConfig(js);
-        }
+    if (0 != mount_->openFramedSource(envir(), src, moving ? 0 : streamLayer())) {
+        return NULL;
     }
 
-    int rc = rtpSession_->start();
-    if (rc != EXIT_SUCCESS) {
-        return NULL;
+    /* a client of a simulcast starts at the top layer and is moved on its
+       receiver reports */
+    if (moving) {
+        src.reset(fpvLayerSource::createNew(envir(), mount_, src),
+                  [](FramedSource* p) { Medium::close(p); });
     }
 
     estBitrate = 90000;
 
-    /* todo: revisit for a better architecture */
-    omxa::IPreviewComp* comp = dynamic_cast<omxa::IPreviewComp*>(rtpSession_.get());
-    if (NULL == comp) {
+    /* the readers hand out their NAL units in place, packetized as is by
+       fpvRTPSink */
+    if (NULL == dynamic_cast<omxa::INalUnits*>(src.get())) {
+        QCAM_ERR("%s: the reader can't be packetized in place", mount_->name().c_str());
+        src.reset();
+        mount_->closeFramedSource(envir());
         return NULL;
     }
-    comp->openFramedSource(envir(), src_);
-    return H264VideoStreamDiscreteFramer::createNew(envir(), src_.get());
+    sources_[src.get()] = src;
+
+    if (NULL == pollTask_) {
+        pollTask_ = envir().taskScheduler().scheduleDelayedTask(
+            FPV_RECEPTION_POLL_US, pollReception0, this);
+    }
+
+    return src.get();
 }
 
 void fpvH264::closeStreamSource(FramedSource* inputSource)
 {
-    rtpSession_->stop();
+    if (0 < sinks_.erase(inputSource)) {
+        publishClients();
+    }
+
+    auto i = sources_.find(inputSource);
+    if (i == sources_.end()) {
+        OnDemandServerMediaSubsession::closeStreamSource(inputSource);
+        return;
+    }
+
+    /* the reader is owned by sources_, closed along with it */
+    sources_.erase(i);
+
+    if (sources_.empty()) {
+        envir().taskScheduler().unscheduleDelayedTask(pollTask_);
+    }
+
+    /* the last client stops the RTP session, after the grace period */
+    mount_->closeFramedSource(envir());
 }
 
-/** Create a new RTP sink that is used by the encoder to provide
- *  frames for streaming. */
-RTPSink * fpvH264::createNewRTPSink(Groupsock * rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource * inputSource)
+void fpvH264::pollReception0(void* clientData)
 {
-    H264VideoRTPSink *RTPSink = H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
-    OutPacketBuffer::increaseMaxSizeTo(500000); // allow for some possibly large H.264 frames
-    RTPSink->setPacketSizes(7, 1456);
-    return RTPSink;
+    ((fpvH264*)clientData)->pollReception();
 }
 
-char const * fpvH264::getAuxSDPLine(RTPSink * rtpSink, FramedSource * inputSource)
+/** Feed the worst of the clients' receiver reports since the last poll to
+ *  the session. The clients share the encoder, the stream has to fit the
+ *  worst link. The clients of a simulcast are rather moved down a layer on
+ *  loss, and back up after a while without. */
+void fpvH264::pollReception()
 {
-    if (m_pSDPLine != NULL)  {
-        return m_pSDPLine;
+    ReceptionReport worst;
+    bool fresh = false;
+    uint64_t octets = 0;
+    struct timeval now;
+
+    pollTask_ = envir().taskScheduler().scheduleDelayedTask(
+        FPV_RECEPTION_POLL_US, pollReception0, this);
+
+    gettimeofday(&now, NULL);
+    for (auto& i : sinks_) {
+        RTPTransmissionStatsDB::Iterator it(i.second.sink->transmissionStatsDB());
+        RTPTransmissionStats* stats;
+        unsigned bytes;
+        double elapsed;
+
+        /* bytes sent since the last poll, with the rtp headers */
+        i.second.sink->getTotalBitrate(bytes, elapsed);
+        octets += bytes;
+
+        double lost = -1;
+        while (NULL != (stats = it.next())) {
+            struct timeval const& rx = stats->lastTimeReceived();
+            int64_t age = (int64_t)(now.tv_sec - rx.tv_sec) * 1000000
+                + (now.tv_usec - rx.tv_usec);
+
+            if (FPV_RECEPTION_POLL_US <= age) {
+                continue;   /* no report since the last poll */
+            }
+            fresh = true;
+
+            /* fraction lost is 8 bit fixed point, the round trip delay is
+               in 1/65536 seconds and the jitter in 90 kHz clock units */
+            lost = std::max(lost, stats->packetLossRatio() / 256.0);
+            worst.fractionLost = std::max(worst.fractionLost, lost);
+            worst.rttMs = std::max(worst.rttMs,
+                (unsigned)((uint64_t)stats->roundTripDelay() * 1000 / 65536));
+            worst.jitterMs = std::max(worst.jitterMs, stats->jitter() / 90);
+        }
+
+        auto src = sources_.find(i.first);
+        fpvLayerSource* layered = NULL;
+        if (0 <= lost && src != sources_.end()) {
+            layered = dynamic_cast<fpvLayerSource*>(src->second.get());
+        }
+        if (NULL != layered) {
+            unsigned layer = layered->layer();
+
+            if (FPV_LAYER_DOWN_LOSS <= lost) {
+                i.second.clean = 0;
+                if (layer + 1 < mount_->layerCount()) {
+                    layered->switchTo(layer + 1);
+                }
+            }
+            else if (0 < lost) {
+                i.second.clean = 0;
+            }
+            else if (FPV_LAYER_UP_POLLS <= ++i.second.clean) {
+                i.second.clean = 0;
+                if (0 < layer) {
+                    layered->switchTo(layer - 1);
+                }
+            }
+        }
     }
 
-    if (m_pDummyRTPSink == NULL) {
-        m_pDummyRTPSink = rtpSink;
-        m_pDummyRTPSink->startPlaying(*inputSource, afterPlayingDummy, this);
-        chkForAuxSDPLine(this);
+    mount_->reportReception(worst, fresh, octets);
+    publishClients();
+}
+
+/** Hand the statistics of the clients of this thread to the mount point, to
+ *  be queried from the control socket. The counters are cumulative when the
+ *  client is packetized by fpvRTPSink, the reports are the last received. */
+void fpvH264::publishClients()
+{
+    std::vector<ClientStats> out;
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    for (auto& i : sinks_) {
+        const Client& c = i.second;
+        ClientStats cs;
+
+        if (0 == c.session) {
+            continue;   /* not set up by a client, e.g. the sdp dummy */
+        }
+        cs.mount = mount_->name();
+        cs.session = c.session;
+        cs.address = AddressString(c.address).val();
+        cs.port = c.port;
+        cs.tcp = c.tcp;
+        cs.since = c.since;
+        cs.time = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+        fpvRTPSink* sink = dynamic_cast<fpvRTPSink*>(c.sink);
+        if (NULL != sink) {
+            cs.packets = sink->packetsSent();
+            cs.octets = sink->octetsSent();
+            cs.failed = sink->packetsFailed();
+            cs.queue = sink->sendQueue();
+        }
+
+        RTPTransmissionStatsDB::Iterator it(c.sink->transmissionStatsDB());
+        RTPTransmissionStats* stats = it.next();   /* a receiver per unicast sink */
+        if (NULL != stats) {
+            struct timeval const& rx = stats->lastTimeReceived();
+            cs.fractionLost = stats->packetLossRatio() / 256.0;
+            cs.rttMs = (unsigned)((uint64_t)stats->roundTripDelay() * 1000 / 65536);
+            cs.jitterMs = stats->jitter() / 90;
+            cs.reported = (int64_t)rx.tv_sec * 1000000 + rx.tv_usec;
+        }
+
+        auto src = sources_.find(i.first);
+        omxa::IReaderStats* reader = NULL;
+        if (src != sources_.end()) {
+            reader = dynamic_cast<omxa::IReaderStats*>(src->second.get());
+        }
+        if (NULL != reader) {
+            omxa::ReaderStats rs;
+            reader->getStats(rs);
+            cs.dropped = rs.dropped;
+            cs.resyncs = rs.resyncs;
+            cs.overruns = rs.overruns;
+        }
+
+        fpvLayerSource* layered = NULL;
+        if (src != sources_.end()) {
+            layered = dynamic_cast<fpvLayerSource*>(src->second.get());
+        }
+        cs.layer = NULL != layered ? layered->layer() : streamLayer();
+        out.push_back(cs);
     }
+    mount_->setClientStats(this, out);
+}
 
-    envir().taskScheduler().doEventLoop(&m_done);
+/** Create a new RTP sink that is used by the encoder to provide
+ *  frames for streaming. The sink is seeded with the parameter sets when the
+ *  encoder has already produced them. The NAL units read in place are
+ *  packetized by fpvRTPSink, without copying them. */
+RTPSink * fpvH264::createNewRTPSink(Groupsock * rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource * inputSource)
+{
+    omxa::ParameterSets ps;
+    bool known = 0 == mount_->getParameterSets(ps, streamLayer());
+    fpvRTPSink* sink = fpvRTPSink::createNew(envir(), rtpGroupsock,
+                                             rtpPayloadTypeIfDynamic,
+                                             known ? &ps : NULL);
 
-    return m_pSDPLine;
+    sink->setPacing(mount_->pacing(), mount_->txtime());
+    sink->setFec(mount_->fec(), rtpPayloadTypeIfDynamic + FPV_FEC_PAYLOAD_TYPE);
+    sink->setNack(mount_->nack());
+    sinks_[inputSource].sink = sink;   /* for its receiver reports */
+    return sink;
 }
 
-void fpvH264::afterPlayingDummy(void * ptr)
+/** Set up the stream of a client. A client over udp is sent to straight from
+ *  the socket of its fpvRTPSink, a client over the RTSP connection is written
+ *  to by the sink a whole access unit at a time. */
+void fpvH264::getStreamParameters(unsigned clientSessionId,
+                                  netAddressBits clientAddress,
+                                  Port const& clientRTPPort,
+                                  Port const& clientRTCPPort,
+                                  int tcpSocketNum,
+                                  unsigned char rtpChannelId,
+                                  unsigned char rtcpChannelId,
+                                  netAddressBits& destinationAddress,
+                                  u_int8_t& destinationTTL,
+                                  Boolean& isMulticast,
+                                  Port& serverRTPPort,
+                                  Port& serverRTCPPort,
+                                  void*& streamToken)
 {
-    fpvH264 * mysess = (fpvH264 *) ptr;
-    mysess->afterPlayingDummy1();
+    OnDemandServerMediaSubsession::getStreamParameters(clientSessionId,
+        clientAddress, clientRTPPort, clientRTCPPort, tcpSocketNum,
+        rtpChannelId, rtcpChannelId, destinationAddress, destinationTTL,
+        isMulticast, serverRTPPort, serverRTCPPort, streamToken);
+
+    StreamState* state = (StreamState*)streamToken;
+    fpvRTPSink* sink = NULL;
+
+    if (NULL != state) {
+        sink = dynamic_cast<fpvRTPSink*>(state->rtpSink());
+
+        /* the client, for its statistics */
+        auto i = sinks_.find(state->mediaSource());
+        if (i != sinks_.end()) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            i->second.session = clientSessionId;
+            i->second.address = clientAddress;
+            i->second.port = 0 > tcpSocketNum ? ntohs(clientRTPPort.num()) : 0;
+            i->second.tcp = 0 <= tcpSocketNum;
+            i->second.since = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+        }
+    }
+    if (NULL != sink) {
+        sink->setDescribed(described_);
+    }
+    if (NULL != sink && 0 > tcpSocketNum) {
+        sink->setDestination(destinationAddress, clientRTPPort);
+    }
+    else if (NULL != sink) {
+        sink->setInterleaved(tcpSocketNum, rtpChannelId);
+    }
 }
 
-void fpvH264::afterPlayingDummy1()
+/** Build the SDP line from the cached parameter sets, this never waits for
+ *  the encoder. Until the encoder has produced the parameter sets, the SDP
+ *  omits sprop-parameter-sets and the readers deliver them in-band. */
+char const * fpvH264::getAuxSDPLine(RTPSink * rtpSink, FramedSource * inputSource)
 {
-    envir().taskScheduler().unscheduleDelayedTask(nextTask());
-    m_done = 0xff;
+    char const* sdp;
+    char extra[64] = "";   /* the lines of the feedback and the parity */
+    int n = 0;
+
+    if (m_pSDPLine != NULL)  {
+        return m_pSDPLine;
+    }
+
+    if (NULL != dynamic_cast<fpvRTPSink*>(rtpSink)) {
+        /* the parity packets, of the ulpfec format of RFC 5109 */
+        if (0 != mount_->fec()) {
+            fecPayloadType_ = rtpSink->rtpPayloadType() + FPV_FEC_PAYLOAD_TYPE;
+            n += snprintf(extra + n, sizeof(extra) - n, "a=rtpmap:%d ulpfec/90000\r\n",
+                          fecPayloadType_);
+        }
+        /* the generic NACKs of RFC 4585 are answered */
+        if (0 != mount_->nack()) {
+            snprintf(extra + n, sizeof(extra) - n, "a=rtcp-fb:%d nack\r\n",
+                     rtpSink->rtpPayloadType());
+        }
+    }
+
+    sdp = rtpSink->auxSDPLine();
+    if (sdp != NULL) {
+        m_pSDPLine = (char*)malloc(strlen(sdp) + strlen(extra) + 1);
+        if (NULL != m_pSDPLine) {   /* cache for the later clients */
+            strcpy(m_pSDPLine, sdp);
+            strcat(m_pSDPLine, extra);
+            return m_pSDPLine;
+        }
+    }
+
+    QCAM_INFO("%s: parameter sets not yet available", mount_->name().c_str());
+    snprintf(m_fmtpLine, sizeof(m_fmtpLine), "a=fmtp:%d packetization-mode=1\r\n%s",
+             rtpSink->rtpPayloadType(), extra);
+    return m_fmtpLine;
 }
 
-void fpvH264::chkForAuxSDPLine(void * ptr)
+/** The rtcp instance of a client. A sink keeping its packets for the NACKs
+ *  reads the rtcp socket, and passes the reports on to the instance. */
+RTCPInstance * fpvH264::createRTCP(Groupsock * RTCPgs, unsigned totSessionBW,
+                                   unsigned char const * cname, RTPSink * sink)
 {
-    fpvH264 * mysess = (fpvH264 *)ptr;
-    mysess->chkForAuxSDPLine1();
+    RTCPInstance* rtcp = OnDemandServerMediaSubsession::createRTCP(
+        RTCPgs, totSessionBW, cname, sink);
+    fpvRTPSink* fpv = dynamic_cast<fpvRTPSink*>(sink);
+
+    if (NULL != fpv && 0 != mount_->nack()) {
+        fpv->listenRTCP(rtcp, RTCPgs);
+    }
+    return rtcp;
 }
 
-void fpvH264::chkForAuxSDPLine1()
+/** The SDP of the base class, with the payload type of the parity packets
+ *  added to the formats of the media line when they are sent. The base class
+ *  keeps the SDP it made for good, it is made again until the parameter sets
+ *  are known. This is called for every DESCRIBE. */
+char const * fpvH264::sdpLines()
 {
     char const* sdp;
+    char fmt[8];
 
-    if (m_pSDPLine != NULL) {
-        m_done = 0xff;
+    described_ = monotonicUs();
+
+    if (NULL == m_pSDPLine && NULL != fSDPLines) {
+        delete[] fSDPLines;
+        fSDPLines = NULL;
+        baseSDP_ = NULL;
     }
-    else if (m_pDummyRTPSink != NULL && (sdp = m_pDummyRTPSink->auxSDPLine()) != NULL) {
-        m_pSDPLine = strDup(sdp);
-        m_pDummyRTPSink = NULL;
-        m_done = 0xff;
+
+    sdp = OnDemandServerMediaSubsession::sdpLines();
+
+    if (NULL == sdp || 0 == fecPayloadType_) {
+        return sdp;
+    }
+    if (sdp == baseSDP_) {
+        return sdp_.c_str();
     }
-    else {
-        int to_delay_us = 34000;
-        nextTask() = envir().taskScheduler().scheduleDelayedTask(to_delay_us, (TaskFunc*)chkForAuxSDPLine, this);
+
+    baseSDP_ = sdp;
+    sdp_ = sdp;
+    size_t m = sdp_.compare(0, 2, "m=") == 0 ? 0 : sdp_.find("\nm=");
+    size_t end = sdp_.find("\r\n", m);
+    if (std::string::npos != m && std::string::npos != end) {
+        snprintf(fmt, sizeof(fmt), " %d", fecPayloadType_);
+        sdp_.insert(end, fmt);
     }
+    return sdp_.c_str();
 }
 }
@@ -32,39 +32,235 @@
 
 #include "OnDemandServerMediaSubsession.hh"
 #include "omx/preview_component.h"
+#include "fpv_rtp_sink.h"
 #include "qcamvid_session.h"
+#include <map>
+#include <mutex>
+#include <vector>
 
 #ifndef FPV_H264_H
 #define  FPV_H264_H
 
+/* layer of a client left to the subsession, on the receiver reports */
+#define FPV_LAYER_AUTO ((unsigned)-1)
+
+/* milliseconds a mount point's sessions outlive its last client by default */
+#define FPV_IDLE_GRACE_MS 5000
+
 namespace camerad
 {
+class fpvH264;
+
+/** Transport statistics of a RTSP client, as of its thread's last poll of
+ *  the receiver reports. Times are wall clock, in microseconds. */
+struct ClientStats {
+    std::string mount;         /**< name of the mount point */
+    unsigned session = 0;      /**< RTSP client session id */
+    std::string address;       /**< address of the client */
+    unsigned port = 0;         /**< rtp port of the client, 0 over tcp */
+    bool tcp = false;          /**< interleaved in the RTSP connection */
+    int64_t since = 0;         /**< when the stream was set up */
+    uint64_t packets = 0;      /**< rtp packets sent */
+    uint64_t octets = 0;       /**< octets sent, rtp headers included */
+    uint64_t failed = 0;       /**< packets the kernel didn't take */
+    int queue = -1;            /**< octets in the socket send queue, -1 if unknown */
+    double fractionLost = 0;   /**< as of the last receiver report */
+    unsigned jitterMs = 0;     /**< as of the last receiver report */
+    unsigned rttMs = 0;        /**< as of the last receiver report */
+    int64_t reported = 0;      /**< when the last receiver report came, 0 if none */
+    uint32_t dropped = 0;      /**< frames dropped by the reader's backpressure */
+    uint32_t resyncs = 0;      /**< resyncs of the reader to a key frame */
+    uint32_t overruns = 0;     /**< times the reader was overrun by the encoder */
+    unsigned layer = 0;        /**< layer of the simulcast streamed */
+    int64_t time = 0;          /**< when the statistics were taken */
+};
+
+/** The multicast group a mount point is published to, the "multicast"
+ *  object of its session in camerad.json. */
+struct MulticastConfig {
+    std::string group;     /**< the group address, empty for unicast */
+    unsigned port = 0;     /**< rtp port, rtcp on the next one */
+    unsigned ttl = 1;
+    bool ssm = false;      /**< source specific (232/8), else any source */
+};
+
+/** A mount point, published by every scheduler thread of the server. The
+ *  subsessions of the threads share the rtp session, the first client of any
+ *  thread starts it and the last one stops it.
+ *
+ *  With "layers" in the params, the mount point is a simulcast: a rtp session
+ *  per layer, the lower ones scaled from the camera frames of layer 0. They
+ *  are all started and stopped together.
+ *
+ *  The sessions are kept running for a grace period after the last client,
+ *  a client coming back meanwhile, or the SETUP following the DESCRIBE of a
+ *  new client, doesn't wait for the camera and the encoder to start again. */
+class fpvMount : public std::enable_shared_from_this<fpvMount>
+{
+public:
+    fpvMount(const std::string& name, const char* params, int param_siz,
+             unsigned pacing = 0, bool txtime = false);
+    ~fpvMount();
+
+    const std::string& name() const { return name_; }
+
+    /** @return unsigned : percent of the frame interval to pace a frame over */
+    unsigned pacing() const { return pacing_; }
+
+    /** @return bool : pace with SO_TXTIME rather than a token bucket */
+    bool txtime() const { return txtime_; }
+
+    /** @return unsigned : media packets per parity packet, 0 for no FEC */
+    unsigned fec() const { return fec_; }
+
+    /** @return unsigned : deadline of the retransmissions in ms, 0 for no NACK */
+    unsigned nack() const { return nack_; }
+
+    /** @return bool : a fmp4 fragment per group of pictures, else per frame */
+    bool gopFragments() const { return gopFragments_; }
+
+    /** publish to a multicast group rather than to each client, set before
+     *  the mount point is served */
+    void setMulticast(const MulticastConfig& cfg) { multicast_ = cfg; }
+
+    /** @return const MulticastConfig& : the group is empty for unicast */
+    const MulticastConfig& multicast() const { return multicast_; }
+
+    /** @return RtpInfo& : of the multicast stream */
+    RtpInfo& rtpInfo() { return rtpInfo_; }
+
+    /** @return unsigned : layers of the simulcast, 1 when there is none */
+    unsigned layerCount() const { return layers_; }
+
+    /** @return std::string : name of a layer, the mount point's for layer 0 */
+    std::string layerName(unsigned layer) const;
+
+    /** open a reader of the rtp session for a client, the first client
+     *  starts the session. @return int : 0 on success */
+    int openFramedSource(UsageEnvironment& env, std::shared_ptr<FramedSource>& src,
+                         unsigned layer = 0);
+
+    /** open a reader of another layer for a client switching over to it,
+     *  @sa omxa::IPreviewComp::openSwitchSource(). The client is already
+     *  counted by openFramedSource(). @return int : 0 on success */
+    int openLayerSource(UsageEnvironment& env, unsigned layer,
+                        const struct timeval& after,
+                        std::shared_ptr<FramedSource>& src);
+
+    /** the client is done with its reader, the sessions are stopped the
+     *  grace period after the last one, on the scheduler of the caller */
+    void closeFramedSource(UsageEnvironment& env);
+
+    /** @return int : 0 on success or ENODATA when not yet known */
+    int getParameterSets(omxa::ParameterSets& out, unsigned layer = 0);
+
+    /** merge the receiver reports polled by a thread, the session is fed the
+     *  worst of them once a poll period. octets are sent since the last poll */
+    void reportReception(const ReceptionReport& rr, bool fresh, uint64_t octets);
+
+    /** replace the statistics of the clients of a subsession, an empty list
+     *  removes them */
+    void setClientStats(const fpvH264* owner, std::vector<ClientStats>& stats);
+
+    /** append the statistics of the clients over all the threads */
+    void getClientStats(std::vector<ClientStats>& out);
+
+private:
+    std::mutex lock_;      /**< serialize the threads' access to the session */
+    std::string name_;     /**< name of the rtp session backing the mount */
+    std::string params_;   /**< arguments from remote client to "start.rtsp" */
+    unsigned pacing_;      /**< @sa fpvRTPSink::setPacing() */
+    bool txtime_;          /**< @sa fpvRTPSink::setPacing() */
+    unsigned fec_ = 0;     /**< "fec" of the params, @sa fpvRTPSink::setFec() */
+    unsigned nack_ = 0;    /**< "nack" of the params, @sa fpvRTPSink::setNack() */
+    bool gopFragments_ = false;   /**< "fmp4-fragment" of the params is "gop" */
+    MulticastConfig multicast_;
+    RtpInfo rtpInfo_;
+    unsigned layers_ = 1;  /**< 1 + the "layers" of the params */
+    std::vector<std::shared_ptr<ISession>> sessions_;   /**< rtp streaming sessions, by layer */
+    unsigned clients_ = 0; /**< readers open over all the threads */
+    unsigned grace_ = FPV_IDLE_GRACE_MS;  /**< "idle-grace" of the params */
+    bool running_ = false;     /**< the sessions are started */
+    unsigned idleEpoch_ = 0;   /**< counts the last clients leaving, a stop
+                                    scheduled for an earlier one is stale */
+    ReceptionReport worst_;    /**< merged since the last report */
+    bool fresh_ = false;       /**< worst_ holds a report */
+    int64_t reported_ = 0;     /**< when the session was last reported to */
+    uint64_t octets_ = 0;      /**< sent since the last throughput log */
+    int64_t logged_ = 0;       /**< when the throughput was last logged */
+    std::map<const fpvH264*, std::vector<ClientStats>> stats_;  /**< clients by subsession */
+
+    int startSessions_locked();
+    void stopSessions_locked();
+
+    static void expireIdle0(void* clientData);
+};
+typedef std::shared_ptr<fpvMount> fpvMountPtr;
+
 class fpvH264 : public OnDemandServerMediaSubsession
 {
 public:
-    fpvH264(UsageEnvironment& env, const char* params, int param_siz);
+    /** @param layer : layer streamed to the clients, FPV_LAYER_AUTO to move
+     *  them between the layers on their receiver reports */
+    fpvH264(UsageEnvironment& env, const fpvMountPtr& mount,
+            unsigned layer = FPV_LAYER_AUTO);
     ~fpvH264(void);
 
 public:
     virtual char const * getAuxSDPLine(RTPSink * rtpSink, FramedSource * inputSource);
+    virtual char const * sdpLines();
+    virtual RTCPInstance * createRTCP(Groupsock * RTCPgs, unsigned totSessionBW,
+                                      unsigned char const * cname, RTPSink * sink);
     virtual FramedSource * createNewStreamSource(unsigned clientSessionId, unsigned & estBitrate); // "estBitrate" is the stream's estimated bitrate, in kbps
     virtual RTPSink * createNewRTPSink(Groupsock * rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource * inputSource);
     virtual void closeStreamSource(FramedSource* inputSource);
-    static fpvH264 * createNew(UsageEnvironment & env, const char* params, int param_siz);
+    virtual void getStreamParameters(unsigned clientSessionId,
+                                     netAddressBits clientAddress,
+                                     Port const& clientRTPPort,
+                                     Port const& clientRTCPPort,
+                                     int tcpSocketNum,
+                                     unsigned char rtpChannelId,
+                                     unsigned char rtcpChannelId,
+                                     netAddressBits& destinationAddress,
+                                     u_int8_t& destinationTTL,
+                                     Boolean& isMulticast,
+                                     Port& serverRTPPort,
+                                     Port& serverRTCPPort,
+                                     void*& streamToken);
+    static fpvH264 * createNew(UsageEnvironment & env, const fpvMountPtr& mount,
+                               unsigned layer = FPV_LAYER_AUTO);
+
+private:
+    /** a client streamed to, keyed by its source */
+    struct Client {
+        RTPSink* sink = NULL;
+        unsigned session = 0;
+        netAddressBits address = 0;
+        unsigned port = 0;
+        bool tcp = false;
+        int64_t since = 0;
+        unsigned clean = 0;    /**< polls without loss, to move up a layer */
+    };
 
-    void afterPlayingDummy1();
-    static void afterPlayingDummy(void * ptr);
+    /** @return unsigned : layer the clients start at */
+    unsigned streamLayer() const { return FPV_LAYER_AUTO == layer_ ? 0 : layer_; }
+
+    static void pollReception0(void* clientData);
+    void pollReception();
+    void publishClients();
 
-    static void chkForAuxSDPLine(void * ptr);
-    void chkForAuxSDPLine1();
 private:
     char * m_pSDPLine;
-    RTPSink * m_pDummyRTPSink;
-    char m_done;
-    omxa::PreviewComponentPtr  preComp_;
-    std::shared_ptr<ISession> rtpSession_ = nullptr;   /* rtp streaming session */
-    std::shared_ptr<FramedSource> src_;
-    std::string params_;   /**< arguments from remote client to "start.rtsp" */
+    char m_fmtpLine[128];  /**< sdp line while parameter sets are unknown */
+    unsigned char fecPayloadType_ = 0;   /**< announced in the sdp, 0 for none */
+    char const* baseSDP_ = NULL;   /**< the sdp of the base class, extended in sdp_ */
+    std::string sdp_;
+    fpvMountPtr mount_;    /**< the mount point served by this subsession */
+    unsigned layer_;       /**< layer streamed, @sa fpvH264() */
+    std::map<FramedSource*, std::shared_ptr<FramedSource>> sources_;  /**< readers of the clients, owned here */
+    std::map<FramedSource*, Client> sinks_;  /**< clients keyed by their source */
+    TaskToken pollTask_ = NULL;   /**< periodic poll of the receiver reports */
+    int64_t described_ = 0;  /**< monotonic time of the last DESCRIBE, in microseconds */
 };
 }
 #endif
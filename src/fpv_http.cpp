@@ -0,0 +1,710 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_http.h"
+#include "qcamvid_log.h"
+#include "camerad_util.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+/* octets of a request at most, up to its empty line */
+#define FPV_HTTP_REQUEST_MAX 2048
+
+/* octets ahead of a fragment for the size line of its chunk */
+#define FPV_HTTP_CHUNK_HEAD 10
+
+/* chunks written to a viewer at once */
+#define FPV_HTTP_IOV_MAX 16
+
+/* pending connections of the listener */
+#define FPV_HTTP_LISTEN_BACKLOG 8
+
+static const char FPV_HTTP_STREAM[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: video/mp4\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+namespace camerad
+{
+
+static int64_t monotonicUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+fpvHttpServer* fpvHttpServer::createNew(UsageEnvironment& env, unsigned port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (0 > sock) {
+        QCAM_ERR("http socket() : %s", strerror(errno));
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ReceivingInterfaceAddr;
+    addr.sin_port = htons(port);
+
+    if (0 != setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+        || 0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr))
+        || 0 != listen(sock, FPV_HTTP_LISTEN_BACKLOG)) {
+        QCAM_ERR("failed to listen on http port %u, err: %d", port, errno);
+        ::close(sock);
+        return NULL;
+    }
+
+    QCAM_INFO("fmp4 over http on port %u", port);
+    return new fpvHttpServer(env, sock);
+}
+
+fpvHttpServer::fpvHttpServer(UsageEnvironment& env, int sock)
+: env_(env), sock_(sock)
+{
+    env_.taskScheduler().setBackgroundHandling(sock_, SOCKET_READABLE,
+                                               incoming0, this);
+}
+
+fpvHttpServer::~fpvHttpServer()
+{
+    while (!channels_.empty()) {
+        removeMount(channels_.begin()->first);
+    }
+    while (!viewers_.empty()) {
+        closeViewer(viewers_.begin()->second.get());
+    }
+    env_.taskScheduler().disableBackgroundHandling(sock_);
+    ::close(sock_);
+}
+
+void fpvHttpServer::addMount(const fpvMountPtr& mount)
+{
+    std::unique_ptr<Channel>& c = channels_[mount->name()];
+
+    c.reset(new Channel);
+    c->server = this;
+    c->mount = mount;
+    c->gop = mount->gopFragments();
+}
+
+void fpvHttpServer::removeMount(const std::string& name)
+{
+    auto i = channels_.find(name);
+
+    if (i == channels_.end()) {
+        return;
+    }
+
+    std::vector<Viewer*> viewers(i->second->viewers.begin(),
+                                 i->second->viewers.end());
+    for (Viewer* v : viewers) {
+        closeViewer(v);
+    }
+    closeReader(i->second.get());
+    channels_.erase(i);
+}
+
+void fpvHttpServer::incoming0(void* clientData, int mask)
+{
+    ((fpvHttpServer*)clientData)->incoming();
+}
+
+void fpvHttpServer::incoming()
+{
+    for (;;) {
+        int on = 1;
+        int sock = accept4(sock_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (0 > sock) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                QCAM_ERR("http accept : %s", strerror(errno));
+            }
+            return;
+        }
+
+        /* a fragment goes out as soon as it is muxed */
+        (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        std::unique_ptr<Viewer>& v = viewers_[sock];
+        v.reset(new Viewer);
+        v->server = this;
+        v->sock = sock;
+        v->since = monotonicUs();
+
+        env_.taskScheduler().setBackgroundHandling(sock, SOCKET_READABLE,
+                                                   handleViewer0, v.get());
+    }
+}
+
+void fpvHttpServer::handleViewer0(void* clientData, int mask)
+{
+    Viewer* v = (Viewer*)clientData;
+
+    v->server->handleViewer(v, mask);
+}
+
+void fpvHttpServer::handleViewer(Viewer* v, int mask)
+{
+    if (mask & SOCKET_READABLE) {
+        char buf[512];
+        ssize_t n = recv(v->sock, buf, sizeof(buf), 0);
+
+        if (0 == n || (0 > n && EAGAIN != errno && EINTR != errno)) {
+            closeViewer(v);
+            return;
+        }
+
+        /* anything past the request is ignored */
+        if (0 < n && NULL == v->channel) {
+            v->request.append(buf, n);
+            if (std::string::npos != v->request.find("\r\n\r\n")) {
+                serve(v);
+                return;
+            }
+            if (FPV_HTTP_REQUEST_MAX < v->request.size()) {
+                respond(v, "400 Bad Request");
+                return;
+            }
+        }
+    }
+
+    if ((mask & SOCKET_WRITABLE) && v->blocked) {
+        v->blocked = false;
+        env_.taskScheduler().setBackgroundHandling(v->sock, SOCKET_READABLE,
+                                                   handleViewer0, v);
+        flush(v);
+    }
+}
+
+/** GET /<mount>.mp4 makes the connection a viewer of the mount point */
+void fpvHttpServer::serve(Viewer* v)
+{
+    char method[8];
+    char path[256];
+    std::string name;
+    static const std::string ext(".mp4");
+
+    if (2 != sscanf(v->request.c_str(), "%7s %255s HTTP/", method, path)) {
+        respond(v, "400 Bad Request");
+        return;
+    }
+    if (0 != strcmp(method, "GET")) {
+        respond(v, "405 Method Not Allowed");
+        return;
+    }
+
+    name = ('/' == path[0]) ? path + 1 : path;
+    name = name.substr(0, name.find('?'));
+    if (name.size() > ext.size()
+        && 0 == name.compare(name.size() - ext.size(), ext.size(), ext)) {
+        name.resize(name.size() - ext.size());
+    }
+
+    auto i = channels_.find(name);
+    if (i == channels_.end()) {
+        respond(v, "404 Not Found");
+        return;
+    }
+
+    Channel* c = i->second.get();
+    if (!c->src && 0 != openReader(c)) {
+        respond(v, "503 Service Unavailable");
+        return;
+    }
+
+    v->channel = c;
+    v->head = FPV_HTTP_STREAM;
+    v->next = (c->first <= c->sync && c->sync < c->end()) ? c->sync : c->end();
+    c->viewers.insert(v);
+
+    QCAM_INFO("%s: http viewer %d, %zu viewers", name.c_str(), v->sock,
+              c->viewers.size());
+
+    flush(v);
+}
+
+/** answer a request with no stream and close the connection */
+void fpvHttpServer::respond(Viewer* v, const char* status)
+{
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\n"
+                     "Content-Length: 0\r\n"
+                     "Connection: close\r\n"
+                     "\r\n", status);
+
+    QCAM_INFO("http %d: %s", v->sock, status);
+    (void)send(v->sock, buf, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+    closeViewer(v);
+}
+
+/** write what the viewer is yet to get, until it is caught up or its socket
+    is full */
+void fpvHttpServer::flush(Viewer* v)
+{
+    Channel* c = v->channel;
+    struct iovec iov[FPV_HTTP_IOV_MAX];
+    struct msghdr msg;
+
+    while (!v->blocked) {
+        size_t n = 0;
+
+        /* the init segment once known, ahead of the fragments */
+        if (!v->inited && !c->init.empty()) {
+            v->head.erase(0, v->headAt);
+            v->headAt = 0;
+            v->head += c->init;
+            v->inited = true;
+        }
+
+        if (v->headAt < v->head.size()) {
+            iov[n].iov_base = &v->head[v->headAt];
+            iov[n].iov_len = v->head.size() - v->headAt;
+            n++;
+        }
+        if (v->partial.data) {
+            iov[n].iov_base = (char*)v->partial.data->data() + v->partial.begin
+                + v->partialAt;
+            iov[n].iov_len = v->partial.data->size() - v->partial.begin
+                - v->partialAt;
+            n++;
+        }
+
+        if (v->inited) {
+            if (v->next < c->first) {   /* lapped by the ring */
+                v->next = c->first;
+                v->needSync = true;
+                v->skips++;
+            }
+            while (v->needSync && v->next < c->end()) {
+                v->needSync = !c->ring[v->next - c->first].sync;
+                if (v->needSync) {
+                    v->next++;
+                }
+            }
+            for (uint64_t seq = v->next;
+                 !v->needSync && seq < c->end() && n < FPV_HTTP_IOV_MAX; seq++) {
+                const Chunk& k = c->ring[seq - c->first];
+
+                iov[n].iov_base = (char*)k.data->data() + k.begin;
+                iov[n].iov_len = k.data->size() - k.begin;
+                n++;
+            }
+        }
+
+        if (0 == n) {
+            return;   /* caught up */
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        ssize_t sent = sendmsg(v->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (0 > sent) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                v->blocked = true;
+                env_.taskScheduler().setBackgroundHandling(
+                    v->sock, SOCKET_READABLE | SOCKET_WRITABLE, handleViewer0, v);
+                return;
+            }
+            closeViewer(v);
+            return;
+        }
+
+        /* account for what was taken, in the order of the iovecs */
+        size_t left = sent;
+        size_t len = std::min(left, v->head.size() - v->headAt);
+
+        v->octets += sent;
+        v->headAt += len;
+        left -= len;
+
+        if (v->partial.data) {
+            size_t rest = v->partial.data->size() - v->partial.begin - v->partialAt;
+
+            len = std::min(left, rest);
+            v->partialAt += len;
+            left -= len;
+            if (len == rest) {
+                v->partial = Chunk();
+                v->partialAt = 0;
+            }
+        }
+
+        while (0 < left) {
+            const Chunk& k = c->ring[v->next - c->first];
+
+            len = k.data->size() - k.begin;
+            if (left < len) {
+                v->partial = k;
+                v->partialAt = left;
+                left = 0;
+            }
+            else {
+                left -= len;
+            }
+            v->next++;
+        }
+    }
+}
+
+void fpvHttpServer::closeViewer(Viewer* v)
+{
+    Channel* c = v->channel;
+    int sock = v->sock;
+
+    env_.taskScheduler().disableBackgroundHandling(sock);
+    ::close(sock);
+
+    if (NULL != c) {
+        c->viewers.erase(v);
+        QCAM_INFO("%s: http viewer %d left after %lld ms, %llu octets, "
+                  "%u skips", c->mount->name().c_str(), sock,
+                  (long long)(monotonicUs() - v->since) / 1000,
+                  (unsigned long long)v->octets, v->skips);
+
+        /* the reader may be delivering, it is closed from the event loop */
+        if (c->viewers.empty() && NULL == c->idleTask) {
+            c->idleTask = env_.taskScheduler().scheduleDelayedTask(
+                0, closeIdle0, c);
+        }
+    }
+    viewers_.erase(sock);
+}
+
+/** open a reader of the rtp session of the mount point */
+int fpvHttpServer::openReader(Channel* c)
+{
+    int rc = 0;
+
+    TRY(rc, c->mount->openFramedSource(env_, c->src));
+
+    c->nals = dynamic_cast<omxa::INalUnits*>(c->src.get());
+    c->boundary = dynamic_cast<omxa::IFrameBoundary*>(c->src.get());
+    if (NULL == c->nals) {
+        QCAM_ERR("%s: the reader can't be muxed", c->mount->name().c_str());
+        c->src.reset();
+        c->mount->closeFramedSource(env_);
+        THROW(rc, ENOTSUP);
+    }
+
+    resetStream(c);
+    c->nals->readInPlace();
+    readNext(c);
+
+    CATCH(rc) {
+        QCAM_ERR("%s: failed to open the http reader : %d",
+                 c->mount->name().c_str(), rc);
+    }
+    return rc;
+}
+
+void fpvHttpServer::closeReader(Channel* c)
+{
+    env_.taskScheduler().unscheduleDelayedTask(c->idleTask);
+    if (!c->src) {
+        return;
+    }
+
+    c->src->stopGettingFrames();
+    c->src.reset();
+    c->nals = NULL;
+    c->boundary = NULL;
+    c->mount->closeFramedSource(env_);
+    resetStream(c);
+
+    QCAM_INFO("%s: no http viewer left", c->mount->name().c_str());
+}
+
+void fpvHttpServer::closeIdle0(void* clientData)
+{
+    Channel* c = (Channel*)clientData;
+
+    c->idleTask = NULL;
+    if (c->viewers.empty()) {
+        c->server->closeReader(c);
+    }
+}
+
+/** forget the stream, its next sync frame starts it over */
+void fpvHttpServer::resetStream(Channel* c)
+{
+    c->ps = omxa::ParameterSets();
+    c->init.clear();
+    c->mdat.clear();
+    c->samples.clear();
+    c->frameAt = 0;
+    c->frameSync = false;
+    c->framePts = -1;
+    c->lastPts = -1;
+    c->ring.clear();
+    c->first = c->sync = c->keep = 0;
+    c->octets = 0;
+}
+
+void fpvHttpServer::readNext(Channel* c)
+{
+    c->src->getNextFrame(none_, sizeof(none_), afterGettingFrame, c,
+                         onSourceClosure, c);
+}
+
+void fpvHttpServer::afterGettingFrame(void* clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned durationInMicroseconds)
+{
+    Channel* c = (Channel*)clientData;
+
+    c->server->takeAccessUnit(c, presentationTime);
+    c->server->readNext(c);
+}
+
+/** the reader is evicted or the session stopped, the viewers reconnect */
+void fpvHttpServer::onSourceClosure(void* clientData)
+{
+    Channel* c = (Channel*)clientData;
+    std::vector<Viewer*> viewers(c->viewers.begin(), c->viewers.end());
+
+    QCAM_ERR("%s: the http reader is closed", c->mount->name().c_str());
+    for (Viewer* v : viewers) {
+        c->server->closeViewer(v);
+    }
+    if (NULL == c->idleTask) {
+        c->idleTask = c->server->env_.taskScheduler().scheduleDelayedTask(
+            0, closeIdle0, c);
+    }
+}
+
+/** append the NAL units of the access unit to the frame being read, with
+    their length prefixes */
+void fpvHttpServer::takeAccessUnit(Channel* c, struct timeval presentationTime)
+{
+    bool endsFrame = NULL == c->boundary || c->boundary->endsFrame();
+
+    if (0 > c->framePts) {
+        c->framePts = (int64_t)presentationTime.tv_sec * 1000000
+            + presentationTime.tv_usec;
+        c->frameAt = c->mdat.size();
+        c->frameSync = false;
+    }
+
+    for (const struct iovec& nal : c->nals->nalUnits()) {
+        const uint8_t* p = (const uint8_t*)nal.iov_base;
+        uint8_t len[4];
+
+        if (0 == nal.iov_len) {
+            continue;
+        }
+        switch (p[0] & 0x1F) {
+        case 7:
+            c->ps.sps.assign(p, p + nal.iov_len);
+            continue;
+        case 8:
+            c->ps.pps.assign(p, p + nal.iov_len);
+            continue;
+        case 9:   /* access unit delimiter */
+            continue;
+        case 5:
+            c->frameSync = true;
+            break;
+        default:
+            break;
+        }
+
+        len[0] = nal.iov_len >> 24;
+        len[1] = nal.iov_len >> 16;
+        len[2] = nal.iov_len >> 8;
+        len[3] = nal.iov_len;
+        c->mdat.append((const char*)len, sizeof(len));
+        c->mdat.append((const char*)p, nal.iov_len);
+    }
+
+    if (endsFrame) {
+        endFrame(c);
+    }
+}
+
+/** make the frame read a sample, and a fragment of it or of the group of
+    pictures it ends */
+void fpvHttpServer::endFrame(Channel* c)
+{
+    int64_t pts = c->framePts;
+    bool sync = c->frameSync;
+    Fmp4Sample sample;
+
+    c->framePts = -1;
+
+    if (sync) {
+        omxa::ParameterSets ps = c->ps;
+
+        if (ps.empty()) {
+            (void)c->mount->getParameterSets(ps);
+        }
+        if (!ps.empty() && (c->init.empty()
+                            || ps.sps != c->mux.parameterSets().sps
+                            || ps.pps != c->mux.parameterSets().pps)) {
+            if (!c->init.empty()) {
+                std::vector<Viewer*> viewers(c->viewers.begin(),
+                                             c->viewers.end());
+
+                QCAM_INFO("%s: the parameter sets changed, the http viewers "
+                          "reconnect", c->mount->name().c_str());
+                for (Viewer* v : viewers) {
+                    closeViewer(v);
+                }
+                c->mdat.erase(0, c->frameAt);
+                c->frameAt = 0;
+                c->samples.clear();
+                c->ring.clear();
+                c->first = c->sync = c->keep = 0;
+                c->octets = 0;
+                c->init.clear();
+            }
+
+            if (0 == c->mux.init(ps)) {
+                const std::string& seg = c->mux.initSegment();
+                char line[FPV_HTTP_CHUNK_HEAD + 1];
+
+                snprintf(line, sizeof(line), "%zx\r\n", seg.size());
+                c->init = line;
+                c->init += seg;
+                c->init += "\r\n";
+                c->base = pts;
+                c->lastPts = -1;
+
+                QCAM_INFO("%s: fmp4 %ux%u", c->mount->name().c_str(),
+                          c->mux.width(), c->mux.height());
+            }
+            else {
+                QCAM_ERR("%s: the sps can't be muxed", c->mount->name().c_str());
+            }
+        }
+    }
+
+    if (c->init.empty()) {   /* the stream starts with a sync frame */
+        c->mdat.resize(c->frameAt);
+        return;
+    }
+
+    /* the duration of a sample is known once the next one is read */
+    if (0 <= c->lastPts && c->lastPts < pts && pts - c->lastPts < 1000000) {
+        c->duration = (pts - c->lastPts) * FMP4_TIMESCALE / 1000000;
+    }
+    c->lastPts = pts;
+    if (!c->samples.empty()) {
+        c->samples.back().duration = c->duration;
+    }
+
+    /* a group of pictures ends before its next sync frame, or when it is
+       too big to be held */
+    if (c->gop && !c->samples.empty()
+        && (sync || FPV_HTTP_RING_OCTETS / 4 < c->frameAt)) {
+        pushFragment(c, c->frameAt);
+    }
+
+    if (c->samples.empty()) {
+        c->decodeTime = (uint64_t)std::max<int64_t>(pts - c->base, 0)
+            * FMP4_TIMESCALE / 1000000;
+    }
+    sample.size = c->mdat.size() - c->frameAt;
+    sample.duration = c->duration;
+    sample.sync = sync;
+    c->samples.push_back(sample);
+    c->frameAt = c->mdat.size();
+
+    if (!c->gop) {
+        pushFragment(c, c->mdat.size());
+    }
+}
+
+/** mux the samples in to a chunk of the ring and hand it to the viewers */
+void fpvHttpServer::pushFragment(Channel* c, size_t octets)
+{
+    std::shared_ptr<std::string> out = std::make_shared<std::string>();
+    char line[FPV_HTTP_CHUNK_HEAD + 1];
+    Chunk k;
+    int n;
+
+    /* the size line goes in front, once the fragment is muxed */
+    out->reserve(FPV_HTTP_CHUNK_HEAD + 128 + 12 * c->samples.size() + octets + 2);
+    out->assign(FPV_HTTP_CHUNK_HEAD, '\0');
+    c->mux.fragment(c->samples, c->decodeTime, c->mdat.data(), octets, *out);
+
+    n = snprintf(line, sizeof(line), "%zx\r\n", out->size() - FPV_HTTP_CHUNK_HEAD);
+    k.begin = FPV_HTTP_CHUNK_HEAD - n;
+    memcpy(&(*out)[k.begin], line, n);
+    out->append("\r\n", 2);
+    k.sync = c->samples.front().sync;
+    k.data = out;
+
+    c->mdat.erase(0, octets);
+    c->frameAt -= octets;
+    c->samples.clear();
+
+    /* keep the group of pictures before the latest, for the slow viewers */
+    if (k.sync) {
+        c->keep = c->sync;
+        c->sync = c->end();
+    }
+    c->ring.push_back(k);
+    c->octets += out->size();
+    while (c->first < c->keep
+           || (FPV_HTTP_RING_OCTETS < c->octets && 1 < c->ring.size())) {
+        c->octets -= c->ring.front().data->size();
+        c->ring.pop_front();
+        c->first++;
+    }
+
+    /* the viewers caught up take it right away */
+    std::vector<Viewer*> viewers(c->viewers.begin(), c->viewers.end());
+    for (Viewer* v : viewers) {
+        if (!v->blocked) {
+            flush(v);
+        }
+    }
+}
+}
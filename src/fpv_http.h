@@ -0,0 +1,164 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_HTTP_H__
+#define __FPV_HTTP_H__
+
+#include <deque>
+#include <map>
+#include <set>
+#include "fpv_h264.h"
+#include "fpv_fmp4.h"
+
+/* octets of the fragments a mount point keeps for its viewers at most */
+#define FPV_HTTP_RING_OCTETS (4 << 20)
+
+namespace camerad
+{
+
+/**
+ Serve the mount points as fragmented MP4 over HTTP/1.1, for the players
+ which can't play RTSP, such as the browsers (Media Source Extensions).
+ GET /<mount>.mp4, e.g. /cam0/720p.mp4, answers an endless chunked stream:
+ the init segment, then a fragment for every frame, or for every group of
+ pictures with the mount point's "fmp4-fragment" : "gop".
+
+ A mount point holds a single reader of its rtp session while it has viewers
+ and muxes every fragment once, in to a ring shared by its viewers. The
+ fragments are kept as http chunks from the group of pictures before the
+ latest one on, a viewer starts at the latest sync fragment and a viewer
+ lapped by the ring skips to it.
+
+ The server runs in the environment of the first thread of the FpvServer.
+ **/
+class fpvHttpServer
+{
+public:
+    /** @return fpvHttpServer* : NULL if it can't listen on the port */
+    static fpvHttpServer* createNew(UsageEnvironment& env, unsigned port);
+    ~fpvHttpServer();
+
+    void addMount(const fpvMountPtr& mount);
+    void removeMount(const std::string& name);
+
+private:
+    struct Viewer;
+
+    /** a fragment, framed as a http chunk from begin */
+    struct Chunk {
+        std::shared_ptr<const std::string> data;
+        size_t begin = 0;
+        bool sync = false;
+    };
+
+    /** the fragments of a mount point, muxed once for all its viewers */
+    struct Channel {
+        fpvHttpServer* server = NULL;
+        fpvMountPtr mount;
+        bool gop = false;          /**< a fragment per group of pictures */
+        std::shared_ptr<FramedSource> src;   /**< reader, while there are viewers */
+        omxa::INalUnits* nals = NULL;
+        omxa::IFrameBoundary* boundary = NULL;
+        TaskToken idleTask = NULL;   /**< closes the reader without viewers */
+
+        Fmp4Muxer mux;
+        omxa::ParameterSets ps;    /**< in the stream, ahead of the sync frames */
+        std::string init;          /**< http chunk of the init segment, once known */
+        std::string mdat;          /**< the samples of the next fragment */
+        std::vector<Fmp4Sample> samples;
+        size_t frameAt = 0;        /**< of the frame being read, in mdat */
+        bool frameSync = false;
+        int64_t framePts = -1;     /**< us, of the frame being read */
+        int64_t base = 0;          /**< us, decode time 0 */
+        int64_t lastPts = -1;      /**< us, of the last sample */
+        uint64_t decodeTime = 0;   /**< of the first of the samples */
+        uint32_t duration = FMP4_TIMESCALE / 30;   /**< the frame interval */
+
+        std::deque<Chunk> ring;
+        uint64_t first = 0;        /**< sequence of the front of the ring */
+        uint64_t sync = 0;         /**< sequence of the latest sync fragment */
+        uint64_t keep = 0;         /**< the ring is trimmed up to this one */
+        size_t octets = 0;         /**< in the ring */
+        std::set<Viewer*> viewers;
+
+        uint64_t end() const { return first + ring.size(); }
+    };
+
+    /** a http connection, a viewer of a channel once its request is served */
+    struct Viewer {
+        fpvHttpServer* server = NULL;
+        int sock = -1;
+        std::string request;
+        Channel* channel = NULL;
+        std::string head;          /**< the response and the init segment */
+        size_t headAt = 0;         /**< octets of head written */
+        bool inited = false;       /**< the init segment is in head */
+        Chunk partial;             /**< written in part */
+        size_t partialAt = 0;
+        uint64_t next = 0;         /**< sequence of the next chunk to write */
+        bool needSync = true;      /**< skip to the next sync fragment */
+        bool blocked = false;      /**< waits for the socket to be writable */
+        uint64_t octets = 0;
+        uint32_t skips = 0;        /**< times lapped by the ring */
+        int64_t since = 0;
+    };
+
+    fpvHttpServer(UsageEnvironment& env, int sock);
+
+    static void incoming0(void* clientData, int mask);
+    void incoming();
+    static void handleViewer0(void* clientData, int mask);
+    void handleViewer(Viewer* v, int mask);
+    void serve(Viewer* v);
+    void respond(Viewer* v, const char* status);
+    void flush(Viewer* v);
+    void closeViewer(Viewer* v);
+
+    int openReader(Channel* c);
+    void closeReader(Channel* c);
+    static void closeIdle0(void* clientData);
+    void readNext(Channel* c);
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    static void onSourceClosure(void* clientData);
+    void takeAccessUnit(Channel* c, struct timeval presentationTime);
+    void endFrame(Channel* c);
+    void pushFragment(Channel* c, size_t octets);
+    void resetStream(Channel* c);
+
+    UsageEnvironment& env_;
+    int sock_;                 /**< listening */
+    uint8_t none_[1];          /**< the readers deliver in place */
+    std::map<std::string, std::unique_ptr<Channel>> channels_;   /**< by mount point */
+    std::map<int, std::unique_ptr<Viewer>> viewers_;   /**< by socket */
+};
+}
+
+#endif /* !__FPV_HTTP_H__ */
@@ -0,0 +1,335 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_multicast.h"
+#include "qcamvid_log.h"
+#include "camerad.h"
+#include "camerad_util.h"
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* payload type of the multicast stream, its parity packets on the next one */
+#define FPV_MULTICAST_PAYLOAD_TYPE 96
+
+/* session bandwidth for the rtcp interval, in kbps */
+#define FPV_MULTICAST_SESSION_KBPS 4000
+
+/* rtp port of a group without one */
+#define FPV_MULTICAST_PORT 5004
+
+/* delay of the reopening of an ended stream, in microseconds. A reader
+   failing to open, or closed right away, is retried at this pace */
+#define FPV_MULTICAST_RESTART_US 100000
+
+namespace camerad
+{
+
+fpvMulticastStream* fpvMulticastStream::createNew(UsageEnvironment& env,
+                                                  const fpvMountPtr& mount)
+{
+    fpvMulticastStream* me = new fpvMulticastStream(env, mount);
+
+    if (0 != me->start()) {
+        delete me;
+        return NULL;
+    }
+    return me;
+}
+
+fpvMulticastStream::fpvMulticastStream(UsageEnvironment& env,
+                                       const fpvMountPtr& mount)
+: env_(env), mount_(mount)
+{
+}
+
+fpvMulticastStream::~fpvMulticastStream()
+{
+    env_.taskScheduler().unscheduleDelayedTask(restart_);
+    if (NULL != sink_) {
+        sink_->stopPlaying();
+    }
+    Medium::close(rtcp_);   /* ahead of the sink it reports on */
+    Medium::close(sink_);
+
+    if (src_) {
+        src_.reset();
+        mount_->closeFramedSource(env_);
+    }
+    delete rtcpGS_;
+    delete rtpGS_;
+}
+
+/** open a reader of the rtp session and send it to the group */
+int fpvMulticastStream::start()
+{
+    const MulticastConfig& cfg = mount_->multicast();
+    omxa::ParameterSets ps;
+    struct in_addr group;
+    unsigned char cname[64];
+    int rc = 0;
+
+    group.s_addr = inet_addr(cfg.group.c_str());
+    rtpGS_ = new Groupsock(env_, group, Port(cfg.port), cfg.ttl);
+    rtcpGS_ = new Groupsock(env_, group, Port(cfg.port + 1), cfg.ttl);
+    if (cfg.ssm) {   /* we're the source */
+        rtpGS_->multicastSendOnly();
+        rtcpGS_->multicastSendOnly();
+    }
+
+    TRY(rc, mount_->openFramedSource(env_, src_));
+
+    if (NULL == dynamic_cast<omxa::INalUnits*>(src_.get())) {
+        QCAM_ERR("%s: the reader can't be sent to a group", mount_->name().c_str());
+        THROW(rc, ENOTSUP);
+    }
+
+    sink_ = fpvRTPSink::createNew(env_, rtpGS_, FPV_MULTICAST_PAYLOAD_TYPE,
+                                  0 == mount_->getParameterSets(ps) ? &ps : NULL);
+    sink_->setPacing(mount_->pacing(), mount_->txtime());
+    sink_->setFec(mount_->fec(), FPV_MULTICAST_PAYLOAD_TYPE + 1);
+    sink_->setDestination(group.s_addr, Port(cfg.port));
+    sink_->publishRtpInfo(&mount_->rtpInfo());
+
+    gethostname((char*)cname, sizeof(cname) - 1);
+    cname[sizeof(cname) - 1] = 0;
+    rtcp_ = RTCPInstance::createNew(env_, rtcpGS_, FPV_MULTICAST_SESSION_KBPS,
+                                    cname, sink_, NULL, cfg.ssm ? True : False);
+
+    sink_->startPlaying(*src_, afterPlaying, this);
+
+    QCAM_INFO("%s: multicast to %s:%u, ttl %u, %s", mount_->name().c_str(),
+              cfg.group.c_str(), cfg.port, cfg.ttl, cfg.ssm ? "ssm" : "asm");
+
+    CATCH(rc) {}
+    return rc;
+}
+
+/** the reader was evicted or closed, the group would be silent from now
+    on. Reopen it from the event loop, out of the closure of the source */
+void fpvMulticastStream::afterPlaying(void* clientData)
+{
+    fpvMulticastStream* me = (fpvMulticastStream*)clientData;
+
+    QCAM_ERR("%s: the multicast stream ended, restarting",
+             me->mount_->name().c_str());
+    me->env_.taskScheduler().unscheduleDelayedTask(me->restart_);
+    me->restart_ = me->env_.taskScheduler().scheduleDelayedTask(
+        FPV_MULTICAST_RESTART_US, restart0, me);
+}
+
+void fpvMulticastStream::restart0(void* clientData)
+{
+    ((fpvMulticastStream*)clientData)->restart();
+}
+
+/** a new reader of the rtp session for the sink, which carries on the
+    sequence numbers and the rtcp of the group. Retried until it opens */
+void fpvMulticastStream::restart()
+{
+    restart_ = NULL;
+    sink_->stopPlaying();
+    if (src_) {
+        src_.reset();
+        mount_->closeFramedSource(env_);
+    }
+
+    int rc = mount_->openFramedSource(env_, src_);
+    if (0 != rc) {
+        QCAM_ERR("%s: failed to reopen the multicast stream, err: %d",
+                 mount_->name().c_str(), rc);
+        restart_ = env_.taskScheduler().scheduleDelayedTask(
+            FPV_MULTICAST_RESTART_US, restart0, this);
+        return;
+    }
+
+    sink_->startPlaying(*src_, afterPlaying, this);
+    QCAM_INFO("%s: multicast stream restarted", mount_->name().c_str());
+}
+
+fpvMulticast* fpvMulticast::createNew(UsageEnvironment& env, const fpvMountPtr& mount)
+{
+    return new fpvMulticast(env, mount);
+}
+
+fpvMulticast::fpvMulticast(UsageEnvironment& env, const fpvMountPtr& mount)
+: ServerMediaSubsession(env), mount_(mount)
+{
+}
+
+fpvMulticast::~fpvMulticast()
+{
+}
+
+int fpvMulticast::getConfig(int camera, const std::string& session,
+                            MulticastConfig& out)
+{
+    JSONParser js;
+    JSONID jsid;
+    char group[INET_ADDRSTRLEN];
+    unsigned int val;
+    int flag;
+    int n;
+    int rc = 0;
+
+    TRY(rc, cfgGetSession(camera, session.c_str(), js));
+
+    if (JSONPARSER_SUCCESS != JSONParser_Lookup(&js, 0, "multicast.group", 0, &jsid)
+        || JSONPARSER_SUCCESS != JSONParser_GetString(&js, jsid, group,
+                                                      sizeof(group), &n)) {
+        THROW(rc, ENOENT);
+    }
+    if ((int)sizeof(group) < n || !IN_MULTICAST(ntohl(inet_addr(group)))) {
+        QCAM_ERR("invalid multicast group of session %s", session.c_str());
+        THROW(rc, EINVAL);
+    }
+    out.group = group;
+
+    out.port = FPV_MULTICAST_PORT;
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "multicast.port", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)
+        && 0 < val && val < 65535) {
+        out.port = val & ~1u;   /* rtp on the even port */
+    }
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "multicast.ttl", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)
+        && 0 < val && val < 256) {
+        out.ttl = val;
+    }
+
+    /* source specific by default in 232/8 */
+    out.ssm = 232 == (ntohl(inet_addr(group)) >> 24);
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "multicast.ssm", 0, &jsid)
+        && JSONPARSER_SUCCESS == JSONParser_GetBool(&js, jsid, &flag)) {
+        out.ssm = 0 != flag;
+    }
+
+    CATCH(rc) {}
+    return rc;
+}
+
+/** The sdp of the group, as PassiveServerMediaSubsession makes it. Until
+ *  the encoder has produced the parameter sets they are sent in-band and the
+ *  sdp is made again for the next client. */
+char const* fpvMulticast::sdpLines()
+{
+    const MulticastConfig& cfg = mount_->multicast();
+    omxa::ParameterSets ps;
+    char const* range;
+    char fmtp[512];
+    char fec[64] = "";
+    char fecType[8] = "";
+    char line[256];
+
+    if (complete_) {
+        return sdp_.c_str();
+    }
+
+    complete_ = 0 == mount_->getParameterSets(ps) && 4 <= ps.sps.size();
+    if (complete_) {
+        char* sps = base64Encode((char const*)ps.sps.data(), ps.sps.size());
+        char* pps = base64Encode((char const*)ps.pps.data(), ps.pps.size());
+
+        snprintf(fmtp, sizeof(fmtp), "a=fmtp:%d packetization-mode=1;"
+                 "profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s\r\n",
+                 FPV_MULTICAST_PAYLOAD_TYPE, ps.sps[1], ps.sps[2], ps.sps[3],
+                 sps, pps);
+        delete[] sps;
+        delete[] pps;
+    }
+    else {
+        snprintf(fmtp, sizeof(fmtp), "a=fmtp:%d packetization-mode=1\r\n",
+                 FPV_MULTICAST_PAYLOAD_TYPE);
+    }
+
+    if (0 != mount_->fec()) {
+        snprintf(fecType, sizeof(fecType), " %d", FPV_MULTICAST_PAYLOAD_TYPE + 1);
+        snprintf(fec, sizeof(fec), "a=rtpmap:%d ulpfec/90000\r\n",
+                 FPV_MULTICAST_PAYLOAD_TYPE + 1);
+    }
+
+    snprintf(line, sizeof(line), "m=video %u RTP/AVP %d%s\r\n"
+             "c=IN IP4 %s/%u\r\n"
+             "a=rtpmap:%d H264/90000\r\n",
+             cfg.port, FPV_MULTICAST_PAYLOAD_TYPE, fecType,
+             cfg.group.c_str(), cfg.ttl, FPV_MULTICAST_PAYLOAD_TYPE);
+
+    range = rangeSDPLine();
+    sdp_ = line;
+    sdp_ += range;
+    sdp_ += fmtp;
+    sdp_ += fec;
+    sdp_ += "a=control:";
+    sdp_ += trackId();
+    sdp_ += "\r\n";
+    delete[] (char*)range;
+
+    return sdp_.c_str();
+}
+
+/** every client is handed the group, whatever transport it asked for */
+void fpvMulticast::getStreamParameters(unsigned clientSessionId,
+                                       netAddressBits clientAddress,
+                                       Port const& clientRTPPort,
+                                       Port const& clientRTCPPort,
+                                       int tcpSocketNum,
+                                       unsigned char rtpChannelId,
+                                       unsigned char rtcpChannelId,
+                                       netAddressBits& destinationAddress,
+                                       u_int8_t& destinationTTL,
+                                       Boolean& isMulticast,
+                                       Port& serverRTPPort,
+                                       Port& serverRTCPPort,
+                                       void*& streamToken)
+{
+    const MulticastConfig& cfg = mount_->multicast();
+
+    isMulticast = True;
+    destinationAddress = inet_addr(cfg.group.c_str());
+    destinationTTL = cfg.ttl;
+    serverRTPPort = Port(cfg.port);
+    serverRTCPPort = Port(cfg.port + 1);
+    streamToken = NULL;
+}
+
+/** The stream is running, the client joins it where it is. Unlike
+ *  PassiveServerMediaSubsession, the timestamps aren't rebased on every
+ *  PLAY, which would make them jump for the other viewers. */
+void fpvMulticast::startStream(unsigned clientSessionId, void* streamToken,
+                               TaskFunc* rtcpRRHandler,
+                               void* rtcpRRHandlerClientData,
+                               unsigned short& rtpSeqNum,
+                               unsigned& rtpTimestamp,
+                               ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                               void* serverRequestAlternativeByteHandlerClientData)
+{
+    rtpSeqNum = mount_->rtpInfo().seq;
+    rtpTimestamp = mount_->rtpInfo().timestamp;
+}
+}
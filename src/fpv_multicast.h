@@ -0,0 +1,125 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_MULTICAST_H__
+#define __FPV_MULTICAST_H__
+
+#include "fpv_h264.h"
+
+namespace camerad
+{
+
+/**
+ The multicast stream of a mount point, one rtp stream on the wire whatever
+ the number of viewers. It is sent by the first thread of the server, and
+ holds a reader of the rtp session for as long as the mount point is
+ published. A reader evicted or closed is reopened, the group carries on.
+ **/
+class fpvMulticastStream
+{
+public:
+    /** @return fpvMulticastStream* : NULL if the stream can't be started */
+    static fpvMulticastStream* createNew(UsageEnvironment& env,
+                                         const fpvMountPtr& mount);
+    ~fpvMulticastStream();
+
+private:
+    fpvMulticastStream(UsageEnvironment& env, const fpvMountPtr& mount);
+    int start();
+    static void afterPlaying(void* clientData);
+    static void restart0(void* clientData);
+    void restart();
+
+    UsageEnvironment& env_;
+    fpvMountPtr mount_;
+    Groupsock* rtpGS_ = NULL;
+    Groupsock* rtcpGS_ = NULL;
+    std::shared_ptr<FramedSource> src_;   /**< reader of the rtp session */
+    fpvRTPSink* sink_ = NULL;
+    RTCPInstance* rtcp_ = NULL;
+    TaskToken restart_ = NULL;   /**< reopening of the reader, once it ended */
+};
+
+/**
+ The subsession of a multicast mount point, published by every thread. As
+ PassiveServerMediaSubsession, it describes the group and hands it to the
+ clients, the stream being sent by the fpvMulticastStream of the mount
+ point. It never touches the sink, which belongs to another thread.
+ **/
+class fpvMulticast : public ServerMediaSubsession
+{
+public:
+    static fpvMulticast* createNew(UsageEnvironment& env, const fpvMountPtr& mount);
+
+    /**
+     Read the "multicast" object of a session of a camera in camerad.json.
+
+     @param camera : index of the camera
+     @param session : name of the session
+     @param out : the group, the rtp port, the ttl and whether it is SSM
+
+     @return int : ENOENT if the session isn't multicast, EINVAL if the
+             group isn't valid.
+     **/
+    static int getConfig(int camera, const std::string& session,
+                         MulticastConfig& out);
+
+protected:
+    fpvMulticast(UsageEnvironment& env, const fpvMountPtr& mount);
+    virtual ~fpvMulticast();
+
+    virtual char const* sdpLines();
+    virtual void getStreamParameters(unsigned clientSessionId,
+                                     netAddressBits clientAddress,
+                                     Port const& clientRTPPort,
+                                     Port const& clientRTCPPort,
+                                     int tcpSocketNum,
+                                     unsigned char rtpChannelId,
+                                     unsigned char rtcpChannelId,
+                                     netAddressBits& destinationAddress,
+                                     u_int8_t& destinationTTL,
+                                     Boolean& isMulticast,
+                                     Port& serverRTPPort,
+                                     Port& serverRTCPPort,
+                                     void*& streamToken);
+    virtual void startStream(unsigned clientSessionId, void* streamToken,
+                             TaskFunc* rtcpRRHandler,
+                             void* rtcpRRHandlerClientData,
+                             unsigned short& rtpSeqNum,
+                             unsigned& rtpTimestamp,
+                             ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                             void* serverRequestAlternativeByteHandlerClientData);
+
+private:
+    fpvMountPtr mount_;
+    std::string sdp_;        /**< the sdp lines, final once complete_ */
+    bool complete_ = false;  /**< with the parameter sets */
+};
+}
+
+#endif /* !__FPV_MULTICAST_H__ */
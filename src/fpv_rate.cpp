@@ -0,0 +1,100 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_rate.h"
+#include "qcamvid_log.h"
+#include <algorithm>
+#include <cmath>
+
+#define RATE_LOSS_HIGH       0.10   /* loss above this cuts the bitrate */
+#define RATE_LOSS_LOW        0.02   /* loss below this is a clean report */
+#define RATE_QUEUE_MS        100    /* rtt above the recent minimum by this much */
+#define RATE_QUEUE_DECREASE  0.85   /* cut on queueing, before the link drops */
+#define RATE_INCREASE        1.08   /* raise per clean report */
+#define RATE_CLEAN_REPORTS   3      /* clean reports before raising the bitrate */
+#define RATE_MIN_CHANGE      0.02   /* smaller changes are not applied */
+#define RATE_RTT_WINDOW      30     /* reports for the minimum rtt */
+
+namespace camerad
+{
+
+void RateController::reset(unsigned long min, unsigned long max,
+                           unsigned long start)
+{
+    min_ = std::min(min, max);
+    max_ = std::max(min, max);
+    rate_ = std::min(std::max(start, min_), max_);
+    good_ = 0;
+    rtts_.clear();
+}
+
+bool RateController::update(const ReceptionReport& rr, unsigned long& bps)
+{
+    double rate = rate_;
+    unsigned baseRtt = 0;
+
+    /* the minimum over a window follows route changes */
+    if (0 != rr.rttMs) {
+        rtts_.push_back(rr.rttMs);
+        if (RATE_RTT_WINDOW < rtts_.size()) {
+            rtts_.pop_front();
+        }
+        baseRtt = *std::min_element(rtts_.begin(), rtts_.end());
+    }
+
+    if (RATE_LOSS_HIGH < rr.fractionLost) {
+        rate *= 1.0 - 0.5 * rr.fractionLost;
+        good_ = 0;
+    }
+    else if (0 != rr.rttMs && baseRtt + RATE_QUEUE_MS < rr.rttMs) {
+        rate *= RATE_QUEUE_DECREASE;
+        good_ = 0;
+    }
+    else if (rr.fractionLost < RATE_LOSS_LOW) {
+        if (RATE_CLEAN_REPORTS <= ++good_) {
+            rate *= RATE_INCREASE;
+        }
+    }
+    else {   /* between the thresholds, hold */
+        good_ = 0;
+    }
+
+    rate = std::min(std::max(rate, (double)min_), (double)max_);
+    if (std::abs(rate - rate_) < RATE_MIN_CHANGE * rate_) {
+        return false;
+    }
+
+    QCAM_INFO("bitrate %lu -> %lu bps, loss: %u%%, rtt: %u ms, jitter: %u ms",
+              (unsigned long)rate_, (unsigned long)rate,
+              (unsigned)(rr.fractionLost * 100), rr.rttMs, rr.jitterMs);
+    rate_ = rate;
+    bps = (unsigned long)rate;
+    return true;
+}
+
+}
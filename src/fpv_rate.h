@@ -0,0 +1,82 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_RATE_H__
+#define __FPV_RATE_H__
+
+#include <deque>
+
+namespace camerad
+{
+
+/** Reception quality of the stream, from the RTCP receiver reports */
+struct ReceptionReport {
+    double fractionLost = 0;   /**< fraction of the packets lost, 0 to 1 */
+    unsigned rttMs = 0;        /**< round trip time; 0 when unknown */
+    unsigned jitterMs = 0;     /**< interarrival jitter */
+};
+
+/**
+ Adapts the encoder bitrate to the reception reports, within the configured
+ bounds. The rate is cut multiplicatively on loss or when the round trip time
+ grows above its recent minimum, i.e the link is queueing. It is raised
+ slowly after several clean reports, and held in between, so that it does
+ not oscillate around the capacity of the link.
+ **/
+class RateController {
+    unsigned long min_ = 0;
+    unsigned long max_ = 0;
+    double rate_ = 0;           /* current bitrate */
+    unsigned good_ = 0;         /* consecutive clean reports */
+    std::deque<unsigned> rtts_; /* recent round trip times */
+
+public:
+    /**
+     @param min : lowest bitrate, bits per second
+     @param max : highest bitrate, bits per second
+     @param start : initial bitrate, bits per second
+     **/
+    void reset(unsigned long min, unsigned long max, unsigned long start);
+
+    /** the controller is disabled when the bounds are equal */
+    bool enabled() const { return min_ < max_; }
+
+    unsigned long bitrate() const { return (unsigned long)rate_; }
+
+    /**
+     Account for a reception report.
+
+     @param rr : the worst of the reports received from the clients
+     @param bps : [out] new bitrate
+     @return bool : true if the bitrate is to be changed to bps.
+     **/
+    bool update(const ReceptionReport& rr, unsigned long& bps);
+};
+
+}
+#endif /* !__FPV_RATE_H__ */
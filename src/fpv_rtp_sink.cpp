@@ -0,0 +1,1176 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_rtp_sink.h"
+#include "qcamvid_log.h"
+#include "GroupsockHelper.hh"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+/* udp segmentation offload, linux 4.18 */
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+/* octets of a packet, rtp header included, as H264VideoRTPSink was set up */
+#define RTP_SINK_MAX_PACKET 1456
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD_MAX (RTP_SINK_MAX_PACKET - RTP_HEADER_SIZE)
+
+/* octets of a parity packet at most, the media payloads leave room for the
+   FEC headers, @sa fpvRTPSink::payloadMax() */
+#define RTP_FEC_PACKET RTP_SINK_MAX_PACKET
+
+/* packets in the history of the NACKs, a power of 2 */
+#define RTP_NACK_HISTORY 256
+
+/* octets of a rtcp compound packet read at most */
+#define RTP_RTCP_MAX 1500
+
+/* rtcp transport layer feedback, the generic NACK format */
+#define RTCP_RTPFB 205
+#define RTCP_FMT_NACK 1
+
+/* NAL unit types of the aggregation and the fragmentation packets */
+#define NAL_STAP_A 24
+#define NAL_FU_A 28
+
+/* NAL units aggregated in a STAP-A packet at most */
+#define RTP_STAP_MAX_NALS 16
+
+/* segments of a UDP_SEGMENT message at most, UDP_MAX_SEGMENTS */
+#define RTP_GSO_MAX_SEGMENTS 64
+
+/* octets of a UDP_SEGMENT message at most, within an ip datagram */
+#define RTP_GSO_MAX_OCTETS 65000
+
+/* iovecs of a message and messages of a sendmmsg() call at most, UIO_MAXIOV */
+#define RTP_UIO_MAXIOV 1024
+
+/* access units per send cost log */
+#define RTP_SINK_LOG_FRAMES 300
+
+/* departure time of the packets, linux 4.19 */
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+/* frame interval until measured, in microseconds */
+#define RTP_PACE_INTERVAL_US 33333
+
+/* packets of a message when pacing, the burst of the token bucket */
+#define RTP_PACE_SEGMENTS 4
+
+/* octets of the burst of the token bucket, a paced message at most */
+#define RTP_PACE_BURST (RTP_PACE_SEGMENTS * RTP_SINK_MAX_PACKET)
+
+/* unsent octets past which a tcp socket isn't writable, linux 3.12 */
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+
+/* octets of the '$' header of an interleaved packet */
+#define RTP_TCP_FRAMING 4
+
+/* send buffer of a RTP over TCP connection, for the window of a fast link */
+#define RTP_TCP_SNDBUF (2 << 20)
+
+/* octets left unsent in the kernel at most, the rest waits in the ring */
+#define RTP_TCP_NOTSENT_LOWAT (128 << 10)
+
+/* poll period of a backed up connection, in microseconds */
+#define RTP_TCP_POLL_US 2000
+
+/* an access unit backed up this long is cut short, in microseconds */
+#define RTP_TCP_STALL_US 500000
+
+/* a packet partly written this long breaks the framing, in microseconds */
+#define RTP_TCP_BROKEN_US 2000000
+
+/* unsent octets of a socket, linux 2.6.32 */
+#ifndef SIOCOUTQNSD
+#define SIOCOUTQNSD 0x894B
+#endif
+
+namespace camerad
+{
+
+/** struct sock_txtime of linux/net_tstamp.h */
+struct TxTimeConfig {
+    int32_t clockid;
+    uint32_t flags;
+};
+
+static int64_t monotonicUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int64_t threadCpuNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+fpvRTPSink* fpvRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs,
+                                  unsigned char rtpPayloadFormat,
+                                  const omxa::ParameterSets* ps)
+{
+    return new fpvRTPSink(env, RTPgs, rtpPayloadFormat, ps);
+}
+
+fpvRTPSink::fpvRTPSink(UsageEnvironment& env, Groupsock* RTPgs,
+                       unsigned char rtpPayloadFormat,
+                       const omxa::ParameterSets* ps)
+: H264VideoRTPSink(env, RTPgs, rtpPayloadFormat,
+                   ps ? ps->sps.data() : NULL, ps ? ps->sps.size() : 0,
+                   ps ? ps->pps.data() : NULL, ps ? ps->pps.size() : 0),
+  interval_(RTP_PACE_INTERVAL_US), flat_(RTP_SINK_MAX_PACKET)
+{
+    memset(&dest_, 0, sizeof(dest_));
+}
+
+fpvRTPSink::~fpvRTPSink()
+{
+    stopPlaying();
+}
+
+void fpvRTPSink::setDestination(netAddressBits addr, Port const& port)
+{
+    int fd = fRTPInterface.gs()->socketNum();
+    int segment = 0;
+    socklen_t len = sizeof(segment);
+    char ip[INET_ADDRSTRLEN];
+
+    dest_.sin_family = AF_INET;
+    dest_.sin_addr.s_addr = addr;
+    dest_.sin_port = port.num();
+    direct_ = true;
+
+    /* the option is known to the kernels which segment udp */
+    gso_ = 0 == getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &len);
+
+    if (0 != pacing_ && wantTxtime_) {
+        TxTimeConfig cfg = { CLOCK_MONOTONIC, 0 };
+        txtime_ = 0 == setsockopt(fd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg));
+    }
+
+    QCAM_INFO("rtp sink %p: to %s:%u, udp segmentation offload %s, "
+              "pacing %u%% of the frame interval%s", this,
+              inet_ntop(AF_INET, &dest_.sin_addr, ip, sizeof(ip)),
+              ntohs(dest_.sin_port), gso_ ? "on" : "off", pacing_,
+              0 == pacing_ ? "" : (txtime_ ? " with SO_TXTIME" : " with a token bucket"));
+}
+
+void fpvRTPSink::setInterleaved(int sock, unsigned char channel)
+{
+    unsigned size;
+    int lowat = RTP_TCP_NOTSENT_LOWAT;
+    int on = 1;
+    bool limited;
+
+    tcpSocket_ = sock;
+    tcpChannel_ = channel;
+    tcpBroken_ = false;
+
+    /* a window for the bitrate, of which little is left unsent. Whole
+       access units are written, don't hold back their last segment */
+    size = increaseSendBufferTo(envir(), sock, RTP_TCP_SNDBUF);
+    limited = 0 == setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat,
+                              sizeof(lowat));
+    tcpSndbuf_ = size;
+    tcpLimited_ = limited;
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    QCAM_INFO("rtp sink %p: interleaved on channel %u, %u KB send buffer, "
+              "unsent data %s", this, channel, size / 1024,
+              limited ? "limited" : "unlimited");
+}
+
+void fpvRTPSink::setNack(unsigned deadlineMs)
+{
+    nackDeadline_ = (int64_t)deadlineMs * 1000;
+    if (0 != deadlineMs) {
+        sent_.resize(RTP_NACK_HISTORY);
+        history_.resize(RTP_NACK_HISTORY * RTP_FEC_PACKET);
+        rtcpBuf_.resize(RTP_RTCP_MAX);
+    }
+}
+
+void fpvRTPSink::listenRTCP(RTCPInstance* rtcp, Groupsock* rtcpGS)
+{
+    if (0 == nackDeadline_ || !direct_ || NULL == rtcp || NULL == rtcpGS) {
+        return;
+    }
+
+    /* replaces the read handler of the rtcp instance, which turns it off
+       when closed, ahead of the sink */
+    rtcp_ = rtcp;
+    rtcpSocket_ = rtcpGS->socketNum();
+    envir().taskScheduler().setBackgroundHandling(rtcpSocket_, SOCKET_READABLE,
+                                                  readRTCP0, this);
+}
+
+int fpvRTPSink::sendQueue() const
+{
+    int queued = -1;
+
+    if (0 <= tcpSocket_) {
+        return 0 == ioctl(tcpSocket_, SIOCOUTQ, &queued) ? queued : -1;
+    }
+    if (!direct_ || 0 != ioctl(fRTPInterface.gs()->socketNum(), SIOCOUTQ, &queued)) {
+        return -1;
+    }
+    return queued;
+}
+
+Boolean fpvRTPSink::sourceIsCompatibleWithUs(MediaSource& source)
+{
+    return NULL != dynamic_cast<omxa::INalUnits*>(&source);
+}
+
+Boolean fpvRTPSink::continuePlaying()
+{
+    nals_ = dynamic_cast<omxa::INalUnits*>(fSource);
+    boundary_ = dynamic_cast<omxa::IFrameBoundary*>(fSource);
+    nals_->readInPlace();
+
+    readNext();
+    return True;
+}
+
+void fpvRTPSink::stopPlaying()
+{
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+    MediaSink::stopPlaying();
+}
+
+void fpvRTPSink::readNext0(void* clientData)
+{
+    ((fpvRTPSink*)clientData)->readNext();
+}
+
+void fpvRTPSink::readNext()
+{
+    nextTask() = NULL;
+    if (NULL == fSource) {
+        return;
+    }
+    fSource->getNextFrame(none_, sizeof(none_), afterGettingFrame, this,
+                          onSourceClosure, this);
+}
+
+void fpvRTPSink::afterGettingFrame(void* clientData, unsigned frameSize,
+                                   unsigned numTruncatedBytes,
+                                   struct timeval presentationTime,
+                                   unsigned durationInMicroseconds)
+{
+    ((fpvRTPSink*)clientData)->sendFrame(presentationTime);
+}
+
+/** packetize the access unit delivered by the source and send it, or start
+    pacing it */
+void fpvRTPSink::sendFrame(struct timeval presentationTime)
+{
+    int64_t cpu = threadCpuNs();
+    int64_t pts = (int64_t)presentationTime.tv_sec * 1000000
+        + presentationTime.tv_usec;
+    bool endsFrame = NULL != boundary_ && boundary_->endsFrame();
+
+    fCurrentTimestamp = convertToRTPTimestamp(presentationTime);
+    fMostRecentPresentationTime = presentationTime;
+    if (0 == fInitialPresentationTime.tv_sec
+        && 0 == fInitialPresentationTime.tv_usec) {
+        fInitialPresentationTime = presentationTime;
+    }
+
+    /* the frame interval, between the starts of the frames. In slice mode
+       a frame spans several access units, each gets its share */
+    if (frameStart_) {
+        if (0 != lastPts_ && lastPts_ < pts && pts - lastPts_ < 1000000) {
+            interval_ = (interval_ * 7 + (pts - lastPts_)) / 8;
+        }
+        lastPts_ = pts;
+        units_ = 0;
+    }
+    units_++;
+    if (endsFrame) {
+        unitsPerFrame_ = units_;
+    }
+    frameStart_ = endsFrame;
+
+    packetize(nals_->nalUnits(), endsFrame);
+    if (direct_ && 0 != nackDeadline_) {
+        keep();
+    }
+    if (NULL != rtpInfo_) {
+        rtpInfo_->seq = fSeqNo;
+        rtpInfo_->timestamp = fCurrentTimestamp;
+    }
+
+    start_ = monotonicUs();
+    window_ = interval_ * pacing_ / 100 / unitsPerFrame_;
+    octets_ = 0;
+    for (const Packet& p : packets_) {
+        octets_ += p.size_;
+    }
+
+    if (0 <= tcpSocket_) {
+        interleave();
+        if (!sendInterleaved()) {   /* backed up, polled until writable */
+            cpuNs_ += threadCpuNs() - cpu;
+            return;
+        }
+    }
+    else if (!direct_) {
+        sendEach();
+    }
+    else if (0 == window_ || txtime_) {   /* the whole access unit at once */
+        batch(0);
+        while (next_ < messages_.size() && sendMessages(messages_.size() - next_)) {
+        }
+    }
+    else {   /* a burst, then at the rate spreading it over the window */
+        batch(0);
+        rate_ = (double)octets_ / window_;
+        tokens_ = RTP_PACE_BURST;
+        filled_ = start_;
+        cpuNs_ += threadCpuNs() - cpu;
+        pace();
+        return;
+    }
+
+    cpuNs_ += threadCpuNs() - cpu;
+    sent();
+}
+
+void fpvRTPSink::pace0(void* clientData)
+{
+    ((fpvRTPSink*)clientData)->pace();
+}
+
+/** send the messages the token bucket allows, the rest when it refills */
+void fpvRTPSink::pace()
+{
+    int64_t cpu = threadCpuNs();
+    int64_t now = monotonicUs();
+
+    nextTask() = NULL;
+    tokens_ = std::min<double>(RTP_PACE_BURST, tokens_ + (now - filled_) * rate_);
+    filled_ = now;
+
+    while (next_ < messages_.size()) {
+        size_t count = 0;
+
+        while (next_ + count < messages_.size()
+               && messageSize(next_ + count) <= tokens_) {
+            tokens_ -= messageSize(next_ + count);
+            count++;
+        }
+        /* a message larger than the burst goes once the bucket is full,
+           rather than waiting for tokens it never holds */
+        if (0 == count && RTP_PACE_BURST <= tokens_) {
+            tokens_ = 0;
+            count = 1;
+        }
+        if (0 == count || !sendMessages(count)) {
+            break;
+        }
+    }
+    cpuNs_ += threadCpuNs() - cpu;
+
+    if (next_ < messages_.size()) {
+        uint32_t size = std::min<uint32_t>(messageSize(next_), RTP_PACE_BURST);
+        int64_t wait = (int64_t)((size - tokens_) / rate_) + 1;
+
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(wait, pace0, this);
+        return;
+    }
+    sent();
+}
+
+/** copy the packets of the access unit in to the history, over the oldest */
+void fpvRTPSink::keep()
+{
+    int64_t now = monotonicUs();
+
+    for (const Packet& p : packets_) {
+        const uint8_t* h = (const uint8_t*)iov_[p.iov_].iov_base;
+        uint16_t seq = h[2] << 8 | h[3];
+        Sent& slot = sent_[seq % RTP_NACK_HISTORY];
+        uint8_t* out = &history_[(seq % RTP_NACK_HISTORY) * RTP_FEC_PACKET];
+
+        for (uint32_t i = p.iov_; i < p.iov_ + p.iovCount_; i++) {
+            memcpy(out, iov_[i].iov_base, iov_[i].iov_len);
+            out += iov_[i].iov_len;
+        }
+        slot.time_ = now;
+        slot.seq_ = seq;
+        slot.size_ = p.size_;
+        slot.resent_ = false;
+    }
+}
+
+void fpvRTPSink::readRTCP0(void* clientData, int mask)
+{
+    ((fpvRTPSink*)clientData)->readRTCP();
+}
+
+/** answer the NACKs of a rtcp packet, then hand it to the rtcp instance */
+void fpvRTPSink::readRTCP()
+{
+    struct sockaddr_in from;
+    socklen_t len = sizeof(from);
+    ssize_t size = recvfrom(rtcpSocket_, rtcpBuf_.data(), rtcpBuf_.size(), 0,
+                            (struct sockaddr*)&from, &len);
+
+    if (0 >= size) {
+        return;
+    }
+    nack(rtcpBuf_.data(), size);
+    rtcp_->injectReport(rtcpBuf_.data(), size, from);
+}
+
+/** resend the packets of the generic NACKs to this ssrc in a compound packet */
+void fpvRTPSink::nack(const uint8_t* rtcp, size_t size)
+{
+    u_int32_t ssrc = SSRC();
+    int64_t now = monotonicUs();
+
+    for (size_t off = 0; off + 4 <= size; ) {
+        const uint8_t* p = rtcp + off;
+        size_t len = ((p[2] << 8 | p[3]) + 1) * 4;
+
+        if (2 != p[0] >> 6 || size < off + len) {
+            return;   /* malformed */
+        }
+        off += len;
+
+        if (RTCP_RTPFB != p[1] || RTCP_FMT_NACK != (p[0] & 0x1F) || 12 > len
+            || ssrc != (u_int32_t)(p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11])) {
+            continue;
+        }
+
+        /* a lost packet and a bitmask of the 16 following it */
+        for (size_t fci = 12; fci + 4 <= len; fci += 4) {
+            uint16_t pid = p[fci] << 8 | p[fci + 1];
+            uint16_t blp = p[fci + 2] << 8 | p[fci + 3];
+
+            resend(pid, now);
+            for (int i = 0; i < 16; i++) {
+                if (0 != (blp & (1 << i))) {
+                    resend(pid + i + 1, now);
+                }
+            }
+        }
+    }
+}
+
+/** resend a packet of the history, once and within the deadline */
+void fpvRTPSink::resend(uint16_t seq, int64_t now)
+{
+    Sent& slot = sent_[seq % RTP_NACK_HISTORY];
+    const uint8_t* packet = &history_[(seq % RTP_NACK_HISTORY) * RTP_FEC_PACKET];
+
+    nacked_++;
+    if (0 == slot.size_ || seq != slot.seq_ || nackDeadline_ < now - slot.time_) {
+        late_++;
+        return;
+    }
+    if (slot.resent_) {
+        return;
+    }
+    slot.resent_ = true;
+
+    if (0 > sendto(fRTPInterface.gs()->socketNum(), packet, slot.size_, 0,
+                   (struct sockaddr*)&dest_, sizeof(dest_))) {
+        failed_++;
+        totalFailed_++;
+        return;
+    }
+    resent_++;
+    syscalls_++;
+    fPacketCount++;
+    fOctetCount += slot.size_ - RTP_HEADER_SIZE;
+    fTotalOctetCount += slot.size_;
+    totalPackets_++;
+    totalOctets_ += slot.size_;
+}
+
+/** the access unit is out, account for it and read the next one */
+void fpvRTPSink::sent()
+{
+    if (0 != described_) {
+        QCAM_INFO("rtp sink %p: first access unit sent %lld ms after the DESCRIBE",
+                  this, (long long)((start_ - described_) / 1000));
+        described_ = 0;
+    }
+
+    spreadUs_ += (direct_ && txtime_) ? window_ : monotonicUs() - start_;
+    sentPackets_ += packets_.size();
+    sentParity_ += parityCount_;
+    sentOctets_ += octets_;
+    totalPackets_ += packets_.size();
+    totalOctets_ += octets_;
+    if (RTP_SINK_LOG_FRAMES == ++frames_) {
+        QCAM_INFO("rtp sink %p: %.1f packets (%.1f parity) and %.2f syscalls per "
+                  "access unit, spread over %lld us, %lld us CPU per Mbit, "
+                  "%llu packets failed, %llu resent of %llu nacked (%llu late), "
+                  "%llu cut short",
+                  this, (double)sentPackets_ / frames_,
+                  (double)sentParity_ / frames_, (double)syscalls_ / frames_,
+                  (long long)(spreadUs_ / frames_),
+                  (long long)(cpuNs_ * 1000 / (int64_t)std::max<uint64_t>(sentOctets_ * 8, 1)),
+                  (unsigned long long)failed_, (unsigned long long)resent_,
+                  (unsigned long long)nacked_, (unsigned long long)late_,
+                  (unsigned long long)stalled_);
+        frames_ = 0;
+        sentPackets_ = 0;
+        sentParity_ = 0;
+        syscalls_ = 0;
+        sentOctets_ = 0;
+        cpuNs_ = 0;
+        spreadUs_ = 0;
+        failed_ = 0;
+        nacked_ = 0;
+        resent_ = 0;
+        late_ = 0;
+        stalled_ = 0;
+    }
+
+    /* read the next one from the event loop, not recursing through the
+       source while a burst of access units is at hand */
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, readNext0, this);
+}
+
+/**
+ @return size_t : octets of the payload of a media packet at most. The parity
+ packets carry the FEC headers on top of the longest payload of their group,
+ the media packets leave room for them so that a parity packet isn't larger
+ than a media packet, nor fragmented by IP.
+ **/
+size_t fpvRTPSink::payloadMax() const
+{
+    return 0 != fecGroup_ ? RTP_PAYLOAD_MAX - FEC_HEADER_SIZE : RTP_PAYLOAD_MAX;
+}
+
+/**
+ build the packets of an access unit in packets_, each gathered in iov_ from
+ its headers and slices of the NAL units. The RTCP counters of RTPSink are
+ accounted for here, as MultiFramedRTPSink does whether the packet gets out
+ or not.
+ **/
+void fpvRTPSink::packetize(const std::vector<struct iovec>& nals, bool endsFrame)
+{
+    size_t payload = payloadMax();
+    size_t bound = 0;
+
+    headerSize_ = 0;
+    iov_.clear();
+    packets_.clear();
+
+    /* the headers of a packet per fragment, or per NAL unit at most. The
+       pointers in to headers_ must hold while building the packets */
+    for (const struct iovec& nal : nals) {
+        bound += (nal.iov_len / (payload - 2) + 1) * (RTP_HEADER_SIZE + 2) + 3;
+    }
+    if (headers_.size() < bound) {
+        headers_.resize(bound);
+    }
+
+    for (size_t i = 0; i < nals.size(); ) {
+        if (payload < nals[i].iov_len) {
+            fragment(nals[i]);
+            i++;
+            continue;
+        }
+
+        /* aggregate the small NAL units that follow, the parameter sets and
+           SEI ahead of a frame or the small slices */
+        size_t count = 1;
+        size_t size = 1 + 2 + nals[i].iov_len;
+
+        while (i + count < nals.size() && count < RTP_STAP_MAX_NALS
+               && size + 2 + nals[i + count].iov_len <= payload) {
+            size += 2 + nals[i + count].iov_len;
+            count++;
+        }
+        aggregate(&nals[i], count);
+        i += count;
+    }
+
+    if (endsFrame && !packets_.empty()) {
+        headers_[packets_.back().header_ + 1] |= 0x80;   /* marker bit */
+    }
+
+    parityCount_ = 0;
+    if (0 != fecGroup_) {
+        protect();
+    }
+
+    for (const Packet& p : packets_) {
+        fPacketCount++;
+        fOctetCount += p.size_ - RTP_HEADER_SIZE;
+        fTotalOctetCount += p.size_;
+    }
+}
+
+/**
+ start a packet with its rtp header, the next sequence number is taken.
+
+ @param headerSize : octets of the rtp header and the payload headers
+ @return uint8_t* : the payload headers, after the rtp header
+ **/
+uint8_t* fpvRTPSink::addPacket(unsigned headerSize)
+{
+    uint8_t* h = &headers_[headerSize_];
+    u_int32_t ssrc = SSRC();
+
+    h[0] = 0x80;   /* version 2 */
+    h[1] = fRTPPayloadType;
+    h[2] = fSeqNo >> 8;
+    h[3] = fSeqNo & 0xFF;
+    h[4] = fCurrentTimestamp >> 24;
+    h[5] = fCurrentTimestamp >> 16;
+    h[6] = fCurrentTimestamp >> 8;
+    h[7] = fCurrentTimestamp;
+    h[8] = ssrc >> 24;
+    h[9] = ssrc >> 16;
+    h[10] = ssrc >> 8;
+    h[11] = ssrc;
+    fSeqNo++;
+
+    packets_.push_back(Packet{ (uint32_t)headerSize_, (uint32_t)iov_.size(), 0, 0 });
+    headerSize_ += headerSize;
+    addSlice(h, headerSize);
+    return h + RTP_HEADER_SIZE;
+}
+
+/** append a slice to the packet last started */
+void fpvRTPSink::addSlice(const void* base, size_t len)
+{
+    Packet& p = packets_.back();
+
+    iov_.push_back(iovec{ (void*)base, len });
+    p.iovCount_++;
+    p.size_ += len;
+}
+
+/**
+ fragment a NAL unit in FU-A packets. The fragments are evenly sized, the
+ packets of the same size are segmented by the kernel in one message.
+ **/
+void fpvRTPSink::fragment(const struct iovec& nal)
+{
+    const uint8_t* data = (const uint8_t*)nal.iov_base;
+    size_t rest = nal.iov_len - 1;   /* the NAL header goes in the FU headers */
+    size_t payload = payloadMax();
+    size_t count = (rest + payload - 2 - 1) / (payload - 2);
+    size_t chunk = (rest + count - 1) / count;
+
+    for (size_t offset = 0; offset < rest; offset += chunk) {
+        uint8_t* h = addPacket(RTP_HEADER_SIZE + 2);
+
+        h[0] = (data[0] & 0xE0) | NAL_FU_A;   /* FU indicator */
+        h[1] = data[0] & 0x1F;                /* FU header */
+        if (0 == offset) {
+            h[1] |= 0x80;   /* start */
+        }
+        if (rest <= offset + chunk) {
+            h[1] |= 0x40;   /* end */
+        }
+        addSlice(data + 1 + offset, std::min(chunk, rest - offset));
+    }
+}
+
+/** send NAL units in a single NAL unit packet or in a STAP-A packet */
+void fpvRTPSink::aggregate(const struct iovec* nals, size_t count)
+{
+    uint8_t nri = 0;
+    uint8_t forbidden = 0;
+
+    if (1 == count) {
+        addPacket(RTP_HEADER_SIZE);
+        addSlice(nals[0].iov_base, nals[0].iov_len);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* nal = (const uint8_t*)nals[i].iov_base;
+
+        nri = std::max<uint8_t>(nri, nal[0] & 0x60);
+        forbidden |= nal[0] & 0x80;
+    }
+
+    uint8_t* h = addPacket(RTP_HEADER_SIZE + 1 + 2);
+    h[0] = forbidden | nri | NAL_STAP_A;
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* size = h + 1;   /* the first size is part of the header */
+
+        if (0 != i) {
+            size = &headers_[headerSize_];
+            headerSize_ += 2;
+            addSlice(size, 2);
+        }
+        size[0] = nals[i].iov_len >> 8;
+        size[1] = nals[i].iov_len & 0xFF;
+        addSlice(nals[i].iov_base, nals[i].iov_len);
+    }
+}
+
+/**
+ append the parity packets of the access unit. Every block of
+ FEC_MASK_PACKETS media packets is split in groups of fecGroup_, the packets
+ of a block interleaved over its groups.
+ **/
+void fpvRTPSink::protect()
+{
+    size_t media = packets_.size();
+    size_t count = 0;
+    size_t group = 0;
+
+    for (size_t b = 0; b < media; b += FEC_MASK_PACKETS) {
+        size_t n = std::min<size_t>(FEC_MASK_PACKETS, media - b);
+        count += (n + fecGroup_ - 1) / fecGroup_;
+    }
+    if (groups_.size() < count) {
+        groups_.resize(count);
+    }
+    if (parity_.size() < count * RTP_FEC_PACKET) {
+        parity_.resize(count * RTP_FEC_PACKET);
+    }
+
+    for (size_t b = 0; b < media; b += FEC_MASK_PACKETS) {
+        size_t n = std::min<size_t>(FEC_MASK_PACKETS, media - b);
+        size_t groups = (n + fecGroup_ - 1) / fecGroup_;
+        const uint8_t* h = &headers_[packets_[b].header_];
+
+        for (size_t k = 0; k < groups; k++) {
+            groups_[group + k].reset(h[2] << 8 | h[3]);
+        }
+        for (size_t j = 0; j < n; j++) {
+            const Packet& p = packets_[b + j];
+            groups_[group + j % groups].add(&iov_[p.iov_], p.iovCount_);
+        }
+        group += groups;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* out = &parity_[i * RTP_FEC_PACKET];
+        size_t size = groups_[i].write(out, fecPayloadType_, fSeqNo++,
+                                       fCurrentTimestamp, SSRC());
+
+        packets_.push_back(Packet{ 0, (uint32_t)iov_.size(), 1, (uint32_t)size });
+        iov_.push_back(iovec{ out, size });
+    }
+    parityCount_ = count;
+}
+
+/**
+ group the packets from the given one in messages of the sendmmsg() call.
+ With the segmentation offload, packets of the same size go in one message,
+ the last segment of it may be shorter. When pacing, a message is at most the
+ octets of the burst of the token bucket and its departure time is set with
+ SO_TXTIME.
+ **/
+void fpvRTPSink::batch(size_t packet)
+{
+    const size_t space = CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t));
+    const uint32_t octets = 0 != window_ ? RTP_PACE_BURST : RTP_GSO_MAX_OCTETS;
+    uint64_t before = 0;   /* octets of the access unit ahead of a message */
+
+    for (size_t i = 0; i < packet; i++) {
+        before += packets_[i].size_;
+    }
+
+    next_ = 0;
+    messages_.clear();
+    for (size_t i = packet; i < packets_.size(); i++) {
+        const Packet& p = packets_[i];
+
+        if (gso_ && !messages_.empty()) {
+            Message& m = messages_.back();
+            const Packet& first = packets_[m.packet_];
+            const Packet& last = packets_[m.packet_ + m.count_ - 1];
+
+            if (last.size_ == first.size_ && p.size_ <= first.size_
+                && m.count_ < RTP_GSO_MAX_SEGMENTS
+                && (m.count_ + 1) * first.size_ <= octets
+                && p.iov_ + p.iovCount_ - first.iov_ <= RTP_UIO_MAXIOV) {
+                m.count_++;
+                continue;
+            }
+        }
+        messages_.push_back(Message{ (uint32_t)i, 1 });
+    }
+
+    msgs_.resize(messages_.size());
+    control_.resize(messages_.size() * space);
+    for (size_t i = 0; i < messages_.size(); i++) {
+        const Message& m = messages_[i];
+        const Packet& first = packets_[m.packet_];
+        const Packet& last = packets_[m.packet_ + m.count_ - 1];
+        struct msghdr& h = msgs_[i].msg_hdr;
+        struct cmsghdr* cm;
+        size_t used = 0;
+
+        memset(&msgs_[i], 0, sizeof(msgs_[i]));
+        memset(&control_[i * space], 0, space);
+        h.msg_name = &dest_;
+        h.msg_namelen = sizeof(dest_);
+        h.msg_iov = &iov_[first.iov_];
+        h.msg_iovlen = last.iov_ + last.iovCount_ - first.iov_;
+        h.msg_control = &control_[i * space];
+        h.msg_controllen = space;
+        cm = CMSG_FIRSTHDR(&h);
+
+        if (1 < m.count_) {
+            uint16_t size = first.size_;
+
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(size));
+            memcpy(CMSG_DATA(cm), &size, sizeof(size));
+            used += CMSG_SPACE(sizeof(size));
+            cm = CMSG_NXTHDR(&h, cm);
+        }
+        if (txtime_ && 0 != window_) {
+            /* departs as its octets are due, at the rate over the window */
+            uint64_t ns = (start_ + window_ * before / std::max<uint32_t>(octets_, 1)) * 1000;
+
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_TXTIME;
+            cm->cmsg_len = CMSG_LEN(sizeof(ns));
+            memcpy(CMSG_DATA(cm), &ns, sizeof(ns));
+            used += CMSG_SPACE(sizeof(ns));
+        }
+
+        h.msg_controllen = used;
+        if (0 == used) {
+            h.msg_control = NULL;
+        }
+        for (uint32_t k = 0; k < m.count_; k++) {
+            before += packets_[m.packet_ + k].size_;
+        }
+    }
+}
+
+/** @return uint32_t : octets of a message, all its packets */
+uint32_t fpvRTPSink::messageSize(size_t message) const
+{
+    const Message& m = messages_[message];
+    uint32_t size = 0;
+
+    for (uint32_t i = m.packet_; i < m.packet_ + m.count_; i++) {
+        size += packets_[i].size_;
+    }
+    return size;
+}
+
+/**
+ send the messages from next_ on to dest_, in as few syscalls as the kernel
+ allows. When the segmentation offload fails, the rest of the access unit is
+ batched again without it.
+
+ @param count : messages to send
+ @return bool : false when the rest of the access unit is lost
+ **/
+bool fpvRTPSink::sendMessages(size_t count)
+{
+    int fd = fRTPInterface.gs()->socketNum();
+    size_t end = next_ + count;
+
+    while (next_ < end) {
+        int rc = sendmmsg(fd, &msgs_[next_],
+                          std::min<size_t>(end - next_, RTP_UIO_MAXIOV), 0);
+        syscalls_++;
+
+        if (0 < rc) {
+            next_ += rc;
+            continue;
+        }
+        if (EINTR == errno) {
+            continue;
+        }
+        if (gso_ && 1 < messages_[next_].count_
+            && (EIO == errno || EINVAL == errno || EOPNOTSUPP == errno)) {
+            QCAM_INFO("rtp sink %p: udp segmentation offload failed, err: %d",
+                      this, errno);
+            gso_ = false;
+            batch(messages_[next_].packet_);
+            return true;
+        }
+
+        /* the rest of the access unit is lost, as with a failing sendto() */
+        for (size_t i = next_; i < messages_.size(); i++) {
+            failed_ += messages_[i].count_;
+            totalFailed_ += messages_[i].count_;
+        }
+        next_ = messages_.size();
+        return false;
+    }
+    return true;
+}
+
+/** send the access unit through the rtp interface, a packet at a time */
+void fpvRTPSink::sendEach()
+{
+    for (const Packet& p : packets_) {
+        size_t size = 0;
+
+        for (uint32_t i = p.iov_; i < p.iov_ + p.iovCount_; i++) {
+            memcpy(&flat_[size], iov_[i].iov_base, iov_[i].iov_len);
+            size += iov_[i].iov_len;
+        }
+        if (!fRTPInterface.sendPacket(flat_.data(), size)) {
+            failed_++;
+            totalFailed_++;
+        }
+        syscalls_++;
+    }
+}
+
+/** frame the packets of the access unit for the RTSP connection */
+void fpvRTPSink::interleave()
+{
+    framing_.resize(packets_.size() * RTP_TCP_FRAMING);
+    tcpIov_.clear();
+    tcpStart_.clear();
+
+    for (size_t i = 0; i < packets_.size(); i++) {
+        const Packet& p = packets_[i];
+        uint8_t* f = &framing_[i * RTP_TCP_FRAMING];
+
+        f[0] = '$';
+        f[1] = tcpChannel_;
+        f[2] = p.size_ >> 8;
+        f[3] = p.size_ & 0xFF;
+        tcpStart_.push_back(tcpIov_.size());
+        tcpIov_.push_back(iovec{ f, RTP_TCP_FRAMING });
+        tcpIov_.insert(tcpIov_.end(), iov_.begin() + p.iov_,
+                       iov_.begin() + p.iov_ + p.iovCount_);
+    }
+    tcpStart_.push_back(tcpIov_.size());
+    tcpPacket_ = 0;
+    tcpWritten_ = 0;
+}
+
+/** gather the unwritten octets in to tcpOut_, up to the iovec given */
+void fpvRTPSink::gather(size_t end)
+{
+    size_t skip = tcpWritten_;
+
+    tcpOut_.clear();
+    for (size_t i = tcpStart_[tcpPacket_]; i < end && tcpOut_.size() < RTP_UIO_MAXIOV; i++) {
+        struct iovec v = tcpIov_[i];
+
+        if (v.iov_len <= skip) {
+            skip -= v.iov_len;
+            continue;
+        }
+        v.iov_base = (uint8_t*)v.iov_base + skip;
+        v.iov_len -= skip;
+        skip = 0;
+        tcpOut_.push_back(v);
+    }
+}
+
+/** account for the octets written, over the packets they complete */
+void fpvRTPSink::advance(size_t written)
+{
+    tcpWritten_ += written;
+    while (tcpPacket_ < packets_.size()
+           && RTP_TCP_FRAMING + packets_[tcpPacket_].size_ <= tcpWritten_) {
+        tcpWritten_ -= RTP_TCP_FRAMING + packets_[tcpPacket_].size_;
+        tcpPacket_++;
+    }
+}
+
+/**
+ octets the socket takes without a partial write: below the low water mark
+ of the unsent data, else within half the send buffer, of which the kernel
+ accounts about as much again for the segments
+ **/
+size_t fpvRTPSink::tcpRoom() const
+{
+    int queued = 0;
+    size_t limit = tcpLimited_ ? RTP_TCP_NOTSENT_LOWAT : tcpSndbuf_ / 2;
+
+    if (0 != ioctl(tcpSocket_, tcpLimited_ ? SIOCOUTQNSD : SIOCOUTQ, &queued)) {
+        return limit;   /* the writev() tells what is wrong */
+    }
+    return (size_t)queued < limit ? limit - queued : 0;
+}
+
+/** the iovec past the whole packets the socket takes from the one next */
+size_t fpvRTPSink::wholePackets() const
+{
+    size_t room = tcpRoom();
+    size_t packet = tcpPacket_;
+
+    while (packet < packets_.size() && RTP_TCP_FRAMING + packets_[packet].size_ <= room) {
+        room -= RTP_TCP_FRAMING + packets_[packet].size_;
+        packet++;
+    }
+    return tcpStart_[packet];
+}
+
+/** count the packets left of the access unit as failed */
+void fpvRTPSink::dropInterleaved()
+{
+    failed_ += packets_.size() - tcpPacket_;
+    totalFailed_ += packets_.size() - tcpPacket_;
+    tcpPacket_ = packets_.size();
+    tcpWritten_ = 0;
+}
+
+/**
+ stop streaming on the RTSP connection, closed or with its framing broken. It
+ is shut down for the RTSP server to end the session, the RTP interface
+ writing on would only break the '$' framing of the client further.
+ **/
+void fpvRTPSink::breakInterleaved(int err)
+{
+    QCAM_ERR("rtp sink %p: stopped streaming on the RTSP connection, "
+             "%zu octets of a packet written, err: %d", this, tcpWritten_, err);
+    (void)shutdown(tcpSocket_, SHUT_RDWR);
+    tcpBroken_ = true;
+    dropInterleaved();
+}
+
+/**
+ wait for the connection to drain. The packets left are dropped once the
+ access unit is too late, at a packet boundary only: a packet partly written
+ is resumed until the connection is given up on.
+
+ @return bool : true when the access unit is done with
+ **/
+bool fpvRTPSink::waitWritable()
+{
+    int64_t late = monotonicUs() - start_;
+
+    if (0 == tcpWritten_ && RTP_TCP_STALL_US <= late) {
+        dropInterleaved();
+        stalled_++;
+        return true;
+    }
+    if (0 != tcpWritten_ && RTP_TCP_BROKEN_US <= late) {
+        breakInterleaved(ETIMEDOUT);
+        return true;
+    }
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(
+        RTP_TCP_POLL_US, pollWritable0, this);
+    return false;
+}
+
+/**
+ write the access unit in to the RTSP connection from the packet last
+ written, without blocking. Only the whole packets the socket takes are
+ written, the RTCP and the RTSP replies of the event loop go in between. A
+ packet the kernel took partly anyway is resumed first once writable, as are
+ the packets left. The reader falls behind meanwhile and drops the late
+ frames.
+
+ @return bool : true when the access unit is done with, false when polling
+         for the connection to be writable
+ **/
+bool fpvRTPSink::sendInterleaved()
+{
+    if (tcpBroken_) {
+        dropInterleaved();
+        return true;
+    }
+    while (tcpPacket_ < packets_.size()) {
+        size_t end = 0 != tcpWritten_ ? tcpStart_[tcpPacket_ + 1] : wholePackets();
+
+        if (end == tcpStart_[tcpPacket_]) {   /* not a whole packet of room */
+            return waitWritable();
+        }
+        gather(end);
+
+        ssize_t n = writev(tcpSocket_, tcpOut_.data(), tcpOut_.size());
+        syscalls_++;
+        if (0 < n) {
+            advance(n);
+            continue;
+        }
+        if (0 > n && EINTR == errno) {
+            continue;
+        }
+        if (0 > n && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            return waitWritable();
+        }
+        breakInterleaved(0 > n ? errno : EPIPE);
+        return true;
+    }
+    return true;
+}
+
+void fpvRTPSink::pollWritable0(void* clientData)
+{
+    ((fpvRTPSink*)clientData)->pollWritable();
+}
+
+/** resume the access unit once the connection has drained below the low
+    water mark, or give up on it once too late */
+void fpvRTPSink::pollWritable()
+{
+    int64_t cpu = threadCpuNs();
+    struct pollfd pfd = { tcpSocket_, POLLOUT, 0 };
+
+    nextTask() = NULL;
+    if (0 == poll(&pfd, 1, 0) && RTP_TCP_STALL_US > monotonicUs() - start_) {
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(
+            RTP_TCP_POLL_US, pollWritable0, this);
+        return;
+    }
+
+    bool done = sendInterleaved();
+    cpuNs_ += threadCpuNs() - cpu;
+    if (done) {
+        sent();
+    }
+}
+}
@@ -0,0 +1,349 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_RTP_SINK_H__
+#define __FPV_RTP_SINK_H__
+
+#include "liveMedia.hh"
+#include "omx/preview_component.h"
+#include "fpv_fec.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+namespace camerad
+{
+
+/** the position of a stream, for the RTP-Info of the clients served by
+ *  another thread than the sink's */
+struct RtpInfo {
+    std::atomic<uint32_t> seq{0};         /**< of the next packet */
+    std::atomic<uint32_t> timestamp{0};   /**< of the last access unit */
+};
+
+/**
+ A H264 RTP sink (RFC 6184, non-interleaved mode) which packetizes the NAL
+ units in place, straight out of the omx buffers of its reader
+ (@sa omxa::INalUnits). The small NAL units of an access unit are aggregated
+ in STAP-A packets and the large ones are fragmented in FU-A packets. Every
+ packet is gathered from its headers and a slice of the NAL units, nothing is
+ copied.
+
+ A whole access unit goes out in one sendmmsg() call. Where the kernel
+ supports UDP segmentation offload (UDP_SEGMENT), the fragments of a NAL unit
+ are evenly sized and the packets of the same size go out as one message of
+ the call, segmented by the kernel or the NIC.
+
+ The packets of an access unit may be paced over a share of the frame
+ interval, rather than going out at line rate. An IDR frame burst overflows
+ the queues of the Wi-Fi drivers. The departure time of every message is set
+ with SO_TXTIME where configured, which is enforced by the fq or etf qdisc
+ of the interface. Otherwise the messages are sent from the event loop as a
+ token bucket allows.
+
+ Parity packets (ULPFEC, @sa FecParity) may be sent after the media packets
+ of every access unit. The media packets are interleaved over the parity
+ groups, a burst of losses as long as the groups are many is recovered.
+
+ The packets sent over udp may be kept in a history of fixed slots, to answer
+ the generic NACKs of RFC 4585 with the packets as they were sent. A packet
+ is resent once at most, and not past the deadline, after which it is of no
+ use to the decoder. The sink reads the rtcp socket for the NACKs and passes
+ the reports on to the RTCPInstance.
+
+ The packets of a client streaming over the RTSP connection (RTP over TCP)
+ go out in as few writev() as the socket takes, each packet behind its '$'
+ framing header (RFC 2326 10.12). The kernel keeps little more than
+ TCP_NOTSENT_LOWAT unsent, the backlog of a slow link stays in the ring of the reader, which
+ drops the late frames (@sa omxa::PreviewParameters::latencyBudgetMs). Only
+ the whole packets the socket has room for are written, the RTCP and the RTSP
+ replies go in between packets; a packet the kernel takes partly anyway is
+ resumed once writable, never blocking. A connection closed or with its
+ framing broken is shut down, not left to the RTP interface. Without the
+ socket, the packets go out one at a time through the RTP interface, as with
+ H264VideoRTPSink.
+
+ The sink keeps the SDP of H264VideoRTPSink and the counters of RTPSink for
+ the RTCP sender reports. The syscalls per frame and the CPU time per Mbit
+ sent are logged for diagnostics.
+ **/
+class fpvRTPSink : public H264VideoRTPSink
+{
+public:
+    /**
+     @param ps : parameter sets of the stream for the SDP, NULL if not yet
+            known
+     **/
+    static fpvRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs,
+                                 unsigned char rtpPayloadFormat,
+                                 const omxa::ParameterSets* ps = NULL);
+
+    /**
+     send the packets straight to the client, from the socket of the sink.
+     Without a destination they go through the RTP interface one by one.
+
+     @param addr : ip address of the client, in network byte order
+     @param port : rtp port of the client
+     **/
+    void setDestination(netAddressBits addr, Port const& port);
+
+    /**
+     send the packets interleaved in the RTSP connection straight from the
+     sink, set when the client sets up RTP over TCP.
+
+     @param sock : the RTSP connection of the client
+     @param channel : rtp channel id of the interleaved stream
+     **/
+    void setInterleaved(int sock, unsigned char channel);
+
+    /**
+     spread the packets of an access unit over a share of the frame interval,
+     set ahead of the destination.
+
+     @param percent : of the frame interval, 0 to send at line rate
+     @param txtime : set the departure times with SO_TXTIME. The kernel takes
+            the option whatever the qdisc, only the fq or etf qdisc holds the
+            packets until then, they go out in a burst otherwise.
+     **/
+    void setPacing(unsigned percent, bool txtime = false)
+    {
+        pacing_ = percent;
+        wantTxtime_ = txtime;
+    }
+
+    /**
+     send a parity packet per group of media packets of an access unit.
+
+     @param group : media packets per parity packet, 0 for none
+     @param payloadType : of the parity packets
+     **/
+    void setFec(unsigned group, unsigned char payloadType)
+    {
+        fecGroup_ = group;
+        fecPayloadType_ = payloadType;
+    }
+
+    /**
+     keep the packets sent for the NACKs of the receiver, set ahead of the
+     destination.
+
+     @param deadlineMs : age of a packet past which it isn't resent, 0 to
+            keep none
+     **/
+    void setNack(unsigned deadlineMs);
+
+    /**
+     read the rtcp socket of the client for its NACKs, the reports are handed
+     to the rtcp instance. Only with setNack() and a destination.
+     **/
+    void listenRTCP(RTCPInstance* rtcp, Groupsock* rtcpGS);
+
+    /** log the latency of the first access unit sent from the DESCRIBE of the
+     *  client, at the given monotonic time in microseconds */
+    void setDescribed(int64_t us) { described_ = us; }
+
+    /** keep info up to date with the stream, NULL for none */
+    void publishRtpInfo(RtpInfo* info) { rtpInfo_ = info; }
+
+    /** @return uint64_t : packets sent since the sink was created */
+    uint64_t packetsSent() const { return totalPackets_; }
+
+    /** @return uint64_t : octets sent, rtp headers included */
+    uint64_t octetsSent() const { return totalOctets_; }
+
+    /** @return uint64_t : packets the kernel didn't take */
+    uint64_t packetsFailed() const { return totalFailed_; }
+
+    /** @return int : octets queued in the socket, -1 when sent through the
+                rtp interface */
+    int sendQueue() const;
+
+    virtual void stopPlaying();
+
+protected:
+    fpvRTPSink(UsageEnvironment& env, Groupsock* RTPgs,
+               unsigned char rtpPayloadFormat, const omxa::ParameterSets* ps);
+    virtual ~fpvRTPSink();
+
+    virtual Boolean continuePlaying();
+
+private:
+    virtual Boolean sourceIsCompatibleWithUs(MediaSource& source);
+
+    /** a packet, gathered from iov_ */
+    struct Packet {
+        uint32_t header_;     /**< offset of the rtp header in headers_ */
+        uint32_t iov_;        /**< first iovec of the packet */
+        uint32_t iovCount_;
+        uint32_t size_;       /**< octets, rtp header included */
+    };
+
+    /** a message of the sendmmsg() call */
+    struct Message {
+        uint32_t packet_;     /**< first packet of the message */
+        uint32_t count_;      /**< packets, segmented by the kernel if more than 1 */
+    };
+
+    static void readNext0(void* clientData);
+    void readNext();
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void sendFrame(struct timeval presentationTime);
+
+    size_t payloadMax() const;
+    void packetize(const std::vector<struct iovec>& nals, bool endsFrame);
+    uint8_t* addPacket(unsigned headerSize);
+    void addSlice(const void* base, size_t len);
+    void fragment(const struct iovec& nal);
+    void aggregate(const struct iovec* nals, size_t count);
+    void protect();
+    void keep();
+    static void readRTCP0(void* clientData, int mask);
+    void readRTCP();
+    void nack(const uint8_t* rtcp, size_t size);
+    void resend(uint16_t seq, int64_t now);
+
+    void batch(size_t packet);
+    bool sendMessages(size_t count);
+    uint32_t messageSize(size_t message) const;
+    static void pace0(void* clientData);
+    void pace();
+    void sendEach();
+    void interleave();
+    bool sendInterleaved();
+    void gather(size_t end);
+    void advance(size_t written);
+    size_t tcpRoom() const;
+    size_t wholePackets() const;
+    void dropInterleaved();
+    void breakInterleaved(int err);
+    bool waitWritable();
+    static void pollWritable0(void* clientData);
+    void pollWritable();
+    void sent();
+
+    omxa::INalUnits* nals_ = NULL;         /**< the source, reading in place */
+    omxa::IFrameBoundary* boundary_ = NULL;
+    uint8_t none_[1];                      /**< no data is copied to the sink */
+
+    RtpInfo* rtpInfo_ = NULL;
+
+    struct sockaddr_in dest_;
+    bool direct_ = false;   /**< sending to dest_ from the socket of the sink */
+    bool gso_ = false;      /**< the kernel supports UDP_SEGMENT */
+
+    /* pacing of the access units */
+    unsigned pacing_ = 0;   /**< percent of the frame interval */
+    bool wantTxtime_ = false;   /**< @sa setPacing() */
+    bool txtime_ = false;   /**< departure times set with SO_TXTIME */
+    int64_t interval_;      /**< frame interval, in microseconds */
+    int64_t lastPts_ = 0;   /**< presentation time of the last frame */
+    bool frameStart_ = true;    /**< the next access unit starts a frame */
+    unsigned units_ = 0;        /**< access units of the frame so far */
+    unsigned unitsPerFrame_ = 1;
+    int64_t window_ = 0;    /**< the access unit is spread over, in microseconds */
+    int64_t start_ = 0;     /**< when the access unit started, in microseconds */
+    int64_t described_ = 0; /**< @sa setDescribed(), 0 once logged */
+    uint32_t octets_ = 0;   /**< octets of the access unit */
+    double tokens_ = 0;     /**< token bucket, in octets */
+    double rate_ = 0;       /**< octets per microsecond */
+    int64_t filled_ = 0;    /**< when the bucket was last filled */
+    size_t next_ = 0;       /**< next message to send */
+
+    /* rtp over tcp */
+    int tcpSocket_ = -1;           /**< RTSP connection of the client, -1 for none */
+    unsigned char tcpChannel_ = 0;
+    std::vector<uint8_t> framing_; /**< the '$' headers of the packets */
+    std::vector<struct iovec> tcpIov_;   /**< the packets behind their framing */
+    std::vector<uint32_t> tcpStart_;     /**< first iovec of every packet */
+    std::vector<struct iovec> tcpOut_;   /**< the rest, for a writev() */
+    size_t tcpPacket_ = 0;         /**< packet being written */
+    size_t tcpWritten_ = 0;        /**< octets of it written */
+    size_t tcpSndbuf_ = 0;         /**< octets of the send buffer */
+    bool tcpLimited_ = false;      /**< unsent data limited to TCP_NOTSENT_LOWAT */
+    bool tcpBroken_ = false;       /**< streaming stopped on the connection */
+    uint64_t stalled_ = 0;         /**< access units cut short, the socket backed up */
+
+    /* parity packets */
+    unsigned fecGroup_ = 0;           /**< media packets per parity packet */
+    unsigned char fecPayloadType_ = 0;
+    std::vector<FecParity> groups_;   /**< of the access unit */
+    std::vector<uint8_t> parity_;     /**< the parity packets of the access unit */
+    size_t parityCount_ = 0;
+
+    /** a packet of the history */
+    struct Sent {
+        int64_t time_ = 0;    /**< when it was packetized, in microseconds */
+        uint16_t seq_ = 0;
+        uint16_t size_ = 0;   /**< 0 while empty */
+        bool resent_ = false;
+    };
+
+    /* retransmissions */
+    int64_t nackDeadline_ = 0;     /**< in microseconds, 0 for no history */
+    std::vector<Sent> sent_;       /**< slots by the low bits of the sequence */
+    std::vector<uint8_t> history_; /**< the packets of the slots */
+    RTCPInstance* rtcp_ = NULL;
+    int rtcpSocket_ = -1;
+    std::vector<uint8_t> rtcpBuf_;
+
+    /* the packets of the access unit being sent, kept for the capacity */
+    std::vector<uint8_t> headers_;        /**< rtp and payload headers */
+    size_t headerSize_ = 0;               /**< octets used in headers_ */
+    std::vector<struct iovec> iov_;
+    std::vector<Packet> packets_;
+    std::vector<Message> messages_;
+    std::vector<struct mmsghdr> msgs_;
+    std::vector<uint8_t> control_;        /**< UDP_SEGMENT control messages */
+    std::vector<uint8_t> flat_;           /**< a packet, for the rtp interface */
+
+    /* send cost, for diagnostics */
+    uint32_t frames_ = 0;
+    uint64_t sentPackets_ = 0;
+    uint64_t sentParity_ = 0;
+    uint64_t syscalls_ = 0;
+    uint64_t sentOctets_ = 0;
+    int64_t cpuNs_ = 0;
+    int64_t spreadUs_ = 0;  /**< access units spread over */
+    uint64_t failed_ = 0;   /**< packets the kernel didn't take */
+    uint64_t nacked_ = 0;   /**< packets asked for again */
+    uint64_t resent_ = 0;
+    uint64_t late_ = 0;     /**< asked for past the deadline or out of the history */
+
+    /* since the sink was created, for the statistics of the client */
+    uint64_t totalPackets_ = 0;
+    uint64_t totalOctets_ = 0;
+    uint64_t totalFailed_ = 0;
+};
+}
+
+#endif /* !__FPV_RTP_SINK_H__ */
@@ -0,0 +1,329 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_scheduler.h"
+#include "qcamvid_log.h"
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* ready sockets harvested per wakeup */
+#define SCHEDULER_MAX_EVENTS 64
+
+/* period of the event loop lag probe, in microseconds */
+#define SCHEDULER_PROBE_US 100000
+
+/* probes per lag log */
+#define SCHEDULER_PROBE_COUNT 600
+
+namespace camerad
+{
+
+static int64_t monotonicUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t epollEvents(int conditionSet)
+{
+    uint32_t events = 0;
+
+    if (conditionSet & SOCKET_READABLE) {
+        events |= EPOLLIN;
+    }
+    if (conditionSet & SOCKET_WRITABLE) {
+        events |= EPOLLOUT;
+    }
+    if (conditionSet & SOCKET_EXCEPTION) {
+        events |= EPOLLPRI;
+    }
+    return events;
+}
+
+/** the conditions of select(), an error or hangup reads as readable */
+static int conditionSet(uint32_t events)
+{
+    int set = 0;
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        set |= SOCKET_READABLE;
+    }
+    if (events & (EPOLLOUT | EPOLLERR)) {
+        set |= SOCKET_WRITABLE;
+    }
+    if (events & EPOLLPRI) {
+        set |= SOCKET_EXCEPTION;
+    }
+    return set;
+}
+
+EpollTaskScheduler* EpollTaskScheduler::createNew()
+{
+    struct epoll_event ev;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int tmfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int rc = 0;
+
+    if (0 > epfd || 0 > evfd || 0 > tmfd) {
+        rc = errno;
+    }
+    else {
+        ev.events = EPOLLIN;
+        ev.data.fd = evfd;
+        if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev)) {
+            rc = errno;
+        }
+        ev.data.fd = tmfd;
+        if (0 == rc && 0 != epoll_ctl(epfd, EPOLL_CTL_ADD, tmfd, &ev)) {
+            rc = errno;
+        }
+    }
+
+    if (0 != rc) {
+        QCAM_ERR("epoll scheduler not available, err: %d", rc);
+        if (0 <= epfd) { close(epfd); }
+        if (0 <= evfd) { close(evfd); }
+        if (0 <= tmfd) { close(tmfd); }
+        return NULL;
+    }
+
+    return new EpollTaskScheduler(epfd, evfd, tmfd);
+}
+
+EpollTaskScheduler::EpollTaskScheduler(int epfd, int eventfd, int timerfd)
+: epfd_(epfd), eventfd_(eventfd), timerfd_(timerfd)
+{
+    probeDue_ = monotonicUs() + SCHEDULER_PROBE_US;
+    probeTask_ = scheduleDelayedTask(SCHEDULER_PROBE_US, probe0, this);
+}
+
+EpollTaskScheduler::~EpollTaskScheduler()
+{
+    unscheduleDelayedTask(probeTask_);
+    close(timerfd_);
+    close(eventfd_);
+    close(epfd_);
+}
+
+void EpollTaskScheduler::triggerEvent(EventTriggerId eventTriggerId,
+                                      void* clientData)
+{
+    uint64_t one = 1;
+    ssize_t rc;
+
+    BasicTaskScheduler0::triggerEvent(eventTriggerId, clientData);
+
+    /* wake the loop, the trigger is marked before */
+    rc = write(eventfd_, &one, sizeof(one));
+    (void)rc;
+}
+
+void EpollTaskScheduler::SingleStep(unsigned maxDelayTime)
+{
+    struct epoll_event events[SCHEDULER_MAX_EVENTS];
+    DelayInterval const& timeToDelay = fDelayQueue.timeToNextAlarm();
+    int64_t us = (int64_t)timeToDelay.seconds() * 1000000 + timeToDelay.useconds();
+    int timeout = -1;
+    int n;
+
+    if (0 < maxDelayTime && (int64_t)maxDelayTime < us) {
+        us = maxDelayTime;
+    }
+
+    /* a pending trigger or a task due doesn't wait */
+    if (0 != fTriggersAwaitingHandling || 0 >= us) {
+        timeout = 0;
+    }
+    else {
+        struct itimerspec its = {};
+
+        its.it_value.tv_sec = us / 1000000;
+        its.it_value.tv_nsec = (us % 1000000) * 1000;
+        (void)timerfd_settime(timerfd_, 0, &its, NULL);
+    }
+
+    n = epoll_wait(epfd_, events, SCHEDULER_MAX_EVENTS, timeout);
+    if (0 > n) {
+        if (EINTR != errno) {
+            QCAM_ERR("epoll_wait failed, err: %d", errno);
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        uint64_t count;
+
+        if (fd == eventfd_ || fd == timerfd_) {
+            ssize_t rc = read(fd, &count, sizeof(count));
+            (void)rc;
+            continue;
+        }
+
+        /* an earlier handler may have closed or changed this socket */
+        auto h = handlers_.find(fd);
+        if (h == handlers_.end()) {
+            continue;
+        }
+        int set = conditionSet(events[i].events) & h->second.conditionSet_;
+        if (0 != set) {
+            (*h->second.proc_)(h->second.clientData_, set);
+        }
+    }
+
+    /* after the sockets, in case a triggered handler changes them */
+    handleTriggers();
+
+    fDelayQueue.handleAlarm();
+}
+
+/** handle a triggered event, making forward progress through all of them */
+void EpollTaskScheduler::handleTriggers()
+{
+    if (0 == fTriggersAwaitingHandling) {
+        return;
+    }
+
+    if (fTriggersAwaitingHandling == fLastUsedTriggerMask) {
+        /* a single trigger, the common case */
+        fTriggersAwaitingHandling &= ~fLastUsedTriggerMask;
+        if (NULL != fTriggeredEventHandlers[fLastUsedTriggerNum]) {
+            (*fTriggeredEventHandlers[fLastUsedTriggerNum])(
+                fTriggeredEventClientDatas[fLastUsedTriggerNum]);
+        }
+        return;
+    }
+
+    unsigned i = fLastUsedTriggerNum;
+    EventTriggerId mask = fLastUsedTriggerMask;
+
+    do {
+        i = (i + 1) % MAX_NUM_EVENT_TRIGGERS;
+        mask >>= 1;
+        if (0 == mask) {
+            mask = 0x80000000;
+        }
+
+        if (0 != (fTriggersAwaitingHandling & mask)) {
+            fTriggersAwaitingHandling &= ~mask;
+            if (NULL != fTriggeredEventHandlers[i]) {
+                (*fTriggeredEventHandlers[i])(fTriggeredEventClientDatas[i]);
+            }
+            fLastUsedTriggerMask = mask;
+            fLastUsedTriggerNum = i;
+            break;
+        }
+    } while (i != fLastUsedTriggerNum);
+}
+
+void EpollTaskScheduler::setBackgroundHandling(int socketNum, int conditionSet,
+                                               BackgroundHandlerProc* handlerProc,
+                                               void* clientData)
+{
+    struct epoll_event ev;
+
+    if (0 > socketNum) {
+        return;
+    }
+
+    auto h = handlers_.find(socketNum);
+
+    if (0 == conditionSet || NULL == handlerProc) {
+        if (h != handlers_.end()) {
+            (void)epoll_ctl(epfd_, EPOLL_CTL_DEL, socketNum, &ev);
+            handlers_.erase(h);
+        }
+        return;
+    }
+
+    ev.events = epollEvents(conditionSet);
+    ev.data.fd = socketNum;
+    int rc = epoll_ctl(epfd_, (h == handlers_.end()) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                       socketNum, &ev);
+
+    /* closed without clearing its handler, epoll dropped the old socket */
+    if (0 != rc && ENOENT == errno) {
+        rc = epoll_ctl(epfd_, EPOLL_CTL_ADD, socketNum, &ev);
+    }
+    if (0 != rc) {
+        QCAM_ERR("failed to watch socket %d, err: %d", socketNum, errno);
+        return;
+    }
+    handlers_[socketNum] = Handler{ conditionSet, handlerProc, clientData };
+}
+
+void EpollTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum)
+{
+    if (0 > oldSocketNum || 0 > newSocketNum) {
+        return;
+    }
+
+    auto h = handlers_.find(oldSocketNum);
+    if (h == handlers_.end()) {
+        return;
+    }
+
+    Handler handler = h->second;
+    setBackgroundHandling(oldSocketNum, 0, NULL, NULL);
+    setBackgroundHandling(newSocketNum, handler.conditionSet_, handler.proc_,
+                          handler.clientData_);
+}
+
+void EpollTaskScheduler::probe0(void* clientData)
+{
+    ((EpollTaskScheduler*)clientData)->probe();
+}
+
+/** account for how late the probe runs, i.e how long the loop was busy */
+void EpollTaskScheduler::probe()
+{
+    int64_t now = monotonicUs();
+    int64_t lag = std::max<int64_t>(0, now - probeDue_);
+
+    lagCount_++;
+    lagSum_ += lag;
+    lagMax_ = std::max(lagMax_, lag);
+    if (SCHEDULER_PROBE_COUNT == lagCount_) {
+        QCAM_INFO("scheduler %p event loop lag avg: %lld us, max: %lld us",
+                  this, (long long)(lagSum_ / lagCount_), (long long)lagMax_);
+        lagCount_ = 0;
+        lagSum_ = 0;
+        lagMax_ = 0;
+    }
+
+    probeDue_ = now + SCHEDULER_PROBE_US;
+    probeTask_ = scheduleDelayedTask(SCHEDULER_PROBE_US, probe0, this);
+}
+}
@@ -0,0 +1,97 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __FPV_SCHEDULER_H__
+#define __FPV_SCHEDULER_H__
+
+#include "BasicUsageEnvironment.hh"
+#include <unordered_map>
+#include <stdint.h>
+
+namespace camerad
+{
+
+/**
+ A liveMedia task scheduler on epoll. The cost of a wakeup doesn't grow with
+ the number of sockets, and there is no FD_SETSIZE limit on them.
+
+ The event triggers are signaled through an eventfd, a trigger from another
+ thread wakes the loop right away rather than at the next scheduler tick. The
+ delayed tasks are timed by a timerfd, in microseconds.
+
+ The sockets are level-triggered. A liveMedia handler reads one message per
+ call, edge-triggered sockets would stall with data left in them.
+
+ The loop measures its own lag, how late a periodic probe task runs, and logs
+ it for diagnostics.
+ **/
+class EpollTaskScheduler : public BasicTaskScheduler0
+{
+public:
+    /** @return EpollTaskScheduler* : NULL if epoll isn't available */
+    static EpollTaskScheduler* createNew();
+    virtual ~EpollTaskScheduler();
+
+    virtual void triggerEvent(EventTriggerId eventTriggerId, void* clientData = NULL);
+
+protected:
+    EpollTaskScheduler(int epfd, int eventfd, int timerfd);
+
+    virtual void SingleStep(unsigned maxDelayTime);
+
+    virtual void setBackgroundHandling(int socketNum, int conditionSet,
+                                       BackgroundHandlerProc* handlerProc,
+                                       void* clientData);
+    virtual void moveSocketHandling(int oldSocketNum, int newSocketNum);
+
+private:
+    struct Handler {
+        int conditionSet_;
+        BackgroundHandlerProc* proc_;
+        void* clientData_;
+    };
+
+    int epfd_;
+    int eventfd_;   /**< signaled by triggerEvent() */
+    int timerfd_;   /**< expires at the next delayed task */
+    std::unordered_map<int, Handler> handlers_;   /**< keyed by socket */
+
+    /* event loop lag, for diagnostics */
+    TaskToken probeTask_ = NULL;
+    int64_t probeDue_ = 0;      /**< when the probe is due, in microseconds */
+    uint32_t lagCount_ = 0;
+    int64_t lagSum_ = 0;
+    int64_t lagMax_ = 0;
+
+    void handleTriggers();
+    static void probe0(void* clientData);
+    void probe();
+};
+}
+
+#endif /* !__FPV_SCHEDULER_H__ */
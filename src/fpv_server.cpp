@@ -32,17 +32,93 @@
 #include <netdb.h>
 #include <ifaddrs.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 #include "fpv_server.h"
 #include "fpv_h264.h"
+#include "fpv_multicast.h"
+#include "fpv_http.h"
+#include "fpv_scheduler.h"
 #include "qcamvid_log.h"
+#include "json/json_parser.h"
+
+/* pending connections of a listener */
+#define FPV_LISTEN_BACKLOG 20
 
 namespace camerad
 {
 
-FpvServer::FpvServer()
+/**
+ A RTSP server listening on a socket shared with the servers of the other
+ threads. liveMedia doesn't set SO_REUSEPORT on its stream sockets, so the
+ listener is made here.
+ **/
+class fpvRTSPServer : public RTSPServer
+{
+public:
+    static fpvRTSPServer* createNew(UsageEnvironment& env, Port port)
+    {
+        int sock = listenShared(port);
+
+        if (0 > sock) {
+            env.setResultErrMsg("failed to listen: ");
+            return NULL;
+        }
+        return new fpvRTSPServer(env, sock, port);
+    }
+
+protected:
+    fpvRTSPServer(UsageEnvironment& env, int sock, Port port)
+    : RTSPServer(env, sock, port, NULL, 0) {}
+
+    /** @return int : the listening socket, -1 on error */
+    static int listenShared(Port port)
+    {
+        struct sockaddr_in addr;
+        int on = 1;
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (0 > sock) {
+            return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ReceivingInterfaceAddr;
+        addr.sin_port = port.num();
+
+        if (0 != setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+            || 0 != setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))
+            || 0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr))
+            || 0 != fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK)
+            || 0 != listen(sock, FPV_LISTEN_BACKLOG)) {
+            QCAM_ERR("failed to listen on port %d, err: %d", ntohs(port.num()), errno);
+            ::close(sock);
+            return -1;
+        }
+        return sock;
+    }
+};
+
+/* out of line, where fpvMulticastStream and fpvHttpServer are complete */
+FpvServer::Shard::Shard(FpvServer* server) : server_(server)
+{
+}
+
+FpvServer::Shard::~Shard()
+{
+}
+
+FpvServer::FpvServer(unsigned threads, unsigned pacing, unsigned httpPort,
+                     bool txtime)
 {
     stopflag_ = 0;
     port_ = 554;
+    threads_ = (0 < threads) ? threads : 1;
+    pacing_ = pacing;
+    txtime_ = txtime;
+    httpPort_ = httpPort;
 }
 
 /**
@@ -99,39 +175,101 @@ bailout:
     return result;
 }
 
-void FpvServer::dispatchSignal(FpvServer* me) {
-    me->doSession();
-}
-
-void FpvServer::doRTSP()
+/** Every thread runs its own liveMedia environment, the listeners of the
+ *  threads share the port and the kernel spreads the connections. */
+void FpvServer::doRTSP(Shard* shard)
 {
-    (void)useNetInterface(net_iface_);
+    FpvServer* me = shard->server_;
 
-    scheduler_ = BasicTaskScheduler::createNew();
-    env_ = BasicUsageEnvironment::createNew(*scheduler_);
+    shard->scheduler_ = EpollTaskScheduler::createNew();
+    if (NULL == shard->scheduler_) {
+        shard->scheduler_ = BasicTaskScheduler::createNew();
+    }
+    shard->env_ = BasicUsageEnvironment::createNew(*shard->scheduler_);
 
-    rtsp_ = RTSPServer::createNew(*env_, port_, NULL, 0);
+    if (1 == me->threads_) {
+        shard->rtsp_ = RTSPServer::createNew(*shard->env_, me->port_, NULL, 0);
+    }
+    else {
+        shard->rtsp_ = fpvRTSPServer::createNew(*shard->env_, me->port_);
+    }
 
-    signal_ = scheduler_->createEventTrigger((TaskFunc*)FpvServer::dispatchSignal);
+    shard->signal_ = shard->scheduler_->createEventTrigger(
+        (TaskFunc*)FpvServer::doSession);
 
-    start_promise_.set_value(true);
+    if (0 != me->httpPort_ && NULL != shard->rtsp_
+        && shard == me->shards_.front().get()) {
+        shard->http_.reset(fpvHttpServer::createNew(*shard->env_, me->httpPort_));
+    }
 
-    scheduler_->doEventLoop(&stopflag_);
+    shard->start_promise_.set_value(NULL != shard->rtsp_);
+
+    shard->scheduler_->doEventLoop(&me->stopflag_);
+
+    /* no more requests nor wake ups from the other threads */
+    RTSPServer* rtsp = shard->rtsp_;
+    TaskScheduler* scheduler = shard->scheduler_;
+    UsageEnvironment* env = shard->env_;
+    {
+        std::unique_lock<std::mutex> lk(me->lock_);
+        shard->rtsp_ = NULL;
+        shard->scheduler_ = NULL;
+        shard->env_ = NULL;
+    }
+
+    /* release the readers of the multicast streams, in the thread */
+    shard->streams_.clear();
+    shard->http_.reset();
+
+    /* the client sessions and the media sessions go along with the server,
+       the subsessions release their mount points */
+    Medium::close(rtsp);
+    scheduler->deleteEventTrigger(shard->signal_);
+    shard->signal_ = 0;
+
+    if (!env->reclaim()) {
+        QCAM_ERR("rtsp thread environment still in use");
+    }
+    delete scheduler;
 }
 
 int FpvServer::start(const std::string& iface_name)
 {
-    if (task_.joinable()) {
+    std::unique_lock<std::mutex> lk(lock_);
+    unsigned serving = 0;
+
+    if (!shards_.empty()) {
         return EALREADY;
     }
-    std::future<bool> start_ready = start_promise_.get_future();
 
-    net_iface_ = iface_name;   /* use this network interface */
+    /* use this network interface, before any thread makes a socket */
+    net_iface_ = iface_name;
+    (void)useNetInterface(net_iface_);
+
+    QCAM_INFO("start fpv server, %u threads", threads_);
+    for (unsigned i = 0; i < threads_; i++) {
+        shards_.emplace_back(new Shard(this));
+
+        Shard* shard = shards_.back().get();
+        std::future<bool> start_ready = shard->start_promise_.get_future();
 
-    QCAM_INFO("start fpv server");
-    task_ = std::thread(&FpvServer::doRTSP, this);
+        shard->task_ = std::thread(&FpvServer::doRTSP, shard);
+        if (start_ready.get()) {
+            serving++;
+        }
+    }
 
-    start_ready.wait();
+    if (serving < threads_) {
+        QCAM_ERR("%u of %u rtsp threads failed to listen on port %d",
+                 threads_ - serving, threads_, port_);
+    }
+    if (0 == serving) {   /* nothing to serve on, don't leave them running */
+        lk.unlock();
+        stop();
+        lk.lock();
+        shards_.clear();
+        return EADDRINUSE;
+    }
 
     return 0;
 }
@@ -139,51 +277,241 @@ int FpvServer::start(const std::string& iface_name)
 int FpvServer::stop()
 {
     stopflag_ = 1;
-    if (task_.joinable()) {
-        task_.join();
+
+    /* wake the threads to see the stop flag, a thread done with it has
+       already released its scheduler */
+    {
+        std::unique_lock<std::mutex> lk(lock_);
+        for (std::unique_ptr<Shard>& shard : shards_) {
+            if (NULL != shard->scheduler_) {
+                shard->scheduler_->triggerEvent(shard->signal_, shard.get());
+            }
+        }
+    }
+    for (std::unique_ptr<Shard>& shard : shards_) {
+        if (shard->task_.joinable()) {
+            shard->task_.join();
+        }
     }
     return 0;
 }
 
+bool FpvServer::parseMount(const char* params, int param_siz, unsigned& id,
+                           std::string& name)
+{
+    JSONParser js;
+    JSONType jt;
+    JSONID jsid;
+    char buf[64];
+    int name_siz;
+
+    if (0 == param_siz) {
+        return false;
+    }
+
+    JSONParser_Ctor(&js, params, param_siz);
+    if (JSONPARSER_SUCCESS != JSONParser_GetType(&js, 0, &jt)
+        || JSONObject != jt
+        || JSONPARSER_SUCCESS != JSONParser_Lookup(&js, 0, "name", 0, &jsid)
+        || JSONPARSER_SUCCESS != JSONParser_GetString(&js, jsid, buf,
+                                                      sizeof(buf), &name_siz)
+        || (int)sizeof(buf) < name_siz) {
+        return false;
+    }
+
+    id = 0;
+    if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "id", 0, &jsid)) {
+        (void)JSONParser_GetUInt(&js, jsid, &id);
+    }
+    name = buf;
+    return true;
+}
+
+std::string FpvServer::mountName(const char* params, int param_siz)
+{
+    unsigned int id;
+    std::string name;
+
+    if (!parseMount(params, param_siz, id, name)) {
+        return FPV_DEFAULT_MOUNT;   /* legacy single mount point */
+    }
+    return "cam" + std::to_string(id) + "/" + name;
+}
+
+bool FpvServer::serving_locked()
+{
+    for (std::unique_ptr<Shard>& shard : shards_) {
+        if (NULL != shard->rtsp_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** queue the request to every serving thread */
+void FpvServer::post_locked(const Request& req)
+{
+    for (std::unique_ptr<Shard>& shard : shards_) {
+        if (NULL != shard->rtsp_) {
+            shard->requests_.push(req);
+            shard->scheduler_->triggerEvent(shard->signal_, shard.get());
+        }
+    }
+}
+
 int FpvServer::addSession(unsigned int uid, const char* param, int param_siz)
 {
     std::unique_lock<std::mutex> lk(lock_);
-    if (0 == rtsp_) {
+    if (!serving_locked()) {
         return ENOSR;
     }
 
-    /** push the params in to a queue */
-    requests_.push(Request(uid, param, param_siz));
+    std::string name = mountName(param, param_siz);
+    if (0 != mounts_.count(name)) {
+        return EEXIST;
+    }
 
-    if (NULL != scheduler_) {
-        scheduler_->triggerEvent(signal_, this);
+    /* the params are retained by the mount point, for the first client */
+    std::shared_ptr<fpvMount> mount = std::make_shared<fpvMount>(
+        name, param, param_siz, pacing_, txtime_);
+
+    unsigned int id;
+    std::string session;
+    MulticastConfig multicast;
+    if (parseMount(param, param_siz, id, session)) {
+        int rc = fpvMulticast::getConfig(id, session, multicast);
+
+        if (EINVAL == rc) {
+            return rc;
+        }
+        if (0 == rc) {
+            mount->setMulticast(multicast);
+        }
     }
+    mounts_[name] = mount;
+
+    post_locked(Request(Request::ADD, uid, name, mount));
 
     return 0;
 }
 
-void FpvServer::doSession()
+int FpvServer::removeSession(unsigned int uid, const char* param, int param_siz)
 {
     std::unique_lock<std::mutex> lk(lock_);
+    if (!serving_locked()) {
+        return ENOSR;
+    }
+
+    std::string name = mountName(param, param_siz);
+    auto i = mounts_.find(name);
+    if (i == mounts_.end()) {
+        return ENOENT;
+    }
+
+    post_locked(Request(Request::REMOVE, uid, name, i->second));
+    mounts_.erase(i);
+
+    return 0;
+}
+
+size_t FpvServer::sessionCount()
+{
+    std::unique_lock<std::mutex> lk(lock_);
+    return mounts_.size();
+}
+
+void FpvServer::getStats(std::vector<ClientStats>& out)
+{
+    std::vector<std::shared_ptr<fpvMount>> mounts;
+
+    /* the mounts are locked by the serving threads, not under lock_ */
+    {
+        std::unique_lock<std::mutex> lk(lock_);
+        for (auto& i : mounts_) {
+            mounts.push_back(i.second);
+        }
+    }
+    for (auto& i : mounts) {
+        i->getClientStats(out);
+    }
+}
+
+void FpvServer::doSession(Shard* shard)
+{
+    std::unique_lock<std::mutex> lk(shard->server_->lock_);
     Request req;
 
-    while (!requests_.empty()) {
+    while (!shard->requests_.empty()) {
+
+        req = shard->requests_.front();
+        shard->requests_.pop();
+
+        bool first = shard == shard->server_->shards_.front().get();
+
+        if (Request::REMOVE == req.type_) {
+            QCAM_INFO("remove rtsp session : %s", req.name_.c_str());
+            shard->rtsp_->deleteServerMediaSession(req.name_.c_str());
+            for (unsigned k = 1; k < req.mount_->layerCount(); k++) {
+                shard->rtsp_->deleteServerMediaSession(
+                    req.mount_->layerName(k).c_str());
+            }
+            shard->streams_.erase(req.name_);
+            if (shard->http_) {
+                shard->http_->removeMount(req.name_);
+            }
+            continue;
+        }
 
-        req = requests_.front();
-        requests_.pop();
+        const MulticastConfig& multicast = req.mount_->multicast();
+        ServerMediaSubsession* subsession;
 
-        /* make a media session.
-           TODO: process the params for the session name. */
+        if (multicast.group.empty()) {
+            /* forward params to video subsession, each mount point owns an
+               rtp session of the same name, shared by the threads */
+            subsession = fpvH264::createNew(*shard->env_, req.mount_);
+        }
+        else {
+            /* one stream to the group, sent by the first thread */
+            if (first) {
+                fpvMulticastStream* stream =
+                    fpvMulticastStream::createNew(*shard->env_, req.mount_);
+
+                if (NULL == stream) {
+                    QCAM_ERR("failed to start the multicast of %s", req.name_.c_str());
+                }
+                shard->streams_[req.name_].reset(stream);
+            }
+            subsession = fpvMulticast::createNew(*shard->env_, req.mount_);
+        }
+
+        /* make a media session, named after the mount point */
         ServerMediaSession* sms = ServerMediaSession::createNew(
-            *env_, "fpvview", 0, "session stream for fpv", true);
+            *shard->env_, req.name_.c_str(), 0, "session stream for fpv",
+            multicast.group.empty() || multicast.ssm);
+
+        sms->addSubsession(subsession);
+
+        if (first && shard->http_) {
+            shard->http_->addMount(req.mount_);
+        }
+
+        shard->rtsp_->addServerMediaSession(sms);
 
-        /* forward params to video subsession */
-        fpvH264* h264subsession = fpvH264::createNew(
-                *env_, req.param_.c_str(), req.param_.length());
+        char* url = shard->rtsp_->rtspURL(sms);
+        QCAM_INFO("add rtsp session : %s", url);
+        delete[] url;
 
-        sms->addSubsession(h264subsession);
+        /* a media session per layer of a simulcast, for the clients picking
+           theirs rather than being moved between them */
+        for (unsigned k = 1; multicast.group.empty()
+                 && k < req.mount_->layerCount(); k++) {
+            std::string name = req.mount_->layerName(k);
 
-        rtsp_->addServerMediaSession(sms);
+            sms = ServerMediaSession::createNew(
+                *shard->env_, name.c_str(), 0, "session stream for fpv", True);
+            sms->addSubsession(fpvH264::createNew(*shard->env_, req.mount_, k));
+            shard->rtsp_->addServerMediaSession(sms);
+        }
     }
 
     return;
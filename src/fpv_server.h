@@ -34,33 +34,85 @@
 #include <future>
 #include <queue>
 #include <mutex>
+#include <map>
+#include <memory>
+#include <vector>
 
 #include "liveMedia.hh"
 #include "BasicUsageEnvironment.hh"
 
+/** mount point of the sessions published without a name */
+#define FPV_DEFAULT_MOUNT "fpvview"
+
 namespace camerad
 {
+class fpvMount;
+class fpvMulticastStream;
+class fpvHttpServer;
+struct ClientStats;
 
 /**
  FpvServer provides a hosting environment and a run-time thread for the liveMedia
  RTSP service. FpvServer::start() wil start the environment and optionally binds
  the network listener to a given iface.
 
- After the server
+ The server may run several threads, each with its own liveMedia scheduler,
+ environment and RTSP listener on the same port (SO_REUSEPORT). The kernel
+ spreads the incoming RTSP connections over the threads, every thread
+ publishes every mount point and the rtp sessions are shared by the threads.
+
+ Optionally the first thread serves the mount points as fragmented MP4 over
+ HTTP as well, @sa fpvHttpServer
 **/
 class FpvServer
 {
     struct Request {
+        enum Type {
+            ADD,      /**< publish a new mount point */
+            REMOVE,   /**< withdraw an existing mount point */
+        } type_;
         unsigned int uid_;
-        std::string param_;
-        Request() : uid_(-1) {}
-        Request(unsigned int uid, const char* param, int param_siz)
-        : uid_(uid), param_(param, param_siz){}
-        Request(const Request& r) : uid_(r.uid_), param_(r.param_) {}
+        std::string name_;    /**< name of the mount point */
+        std::shared_ptr<fpvMount> mount_;   /**< shared by the threads */
+        Request() : type_(ADD), uid_(-1) {}
+        Request(Type type, unsigned int uid, const std::string& name,
+                const std::shared_ptr<fpvMount>& mount)
+        : type_(type), uid_(uid), name_(name), mount_(mount) {}
+    };
+
+    /** a scheduler thread, serving its share of the clients */
+    struct Shard {
+        FpvServer* server_;
+        std::thread task_;                /**< a hosting thread */
+        std::promise<bool> start_promise_;
+        std::queue<Request> requests_;    /**< queue of requests to this thread */
+        EventTriggerId signal_ = 0;       /**< used to resume asynchronous operations */
+
+        /** LiveMedia parameters */
+        TaskScheduler* scheduler_ = NULL;
+        UsageEnvironment* env_ = NULL;
+        RTSPServer* rtsp_ = NULL;
+
+        /** the multicast streams, sent by the first thread */
+        std::map<std::string, std::unique_ptr<fpvMulticastStream>> streams_;
+
+        /** fmp4 over http, served by the first thread */
+        std::unique_ptr<fpvHttpServer> http_;
+
+        Shard(FpvServer* server);
+        ~Shard();
     };
 
 public:
-	FpvServer();
+    /**
+     @param threads : number of the threads serving the RTSP clients
+     @param pacing : percent of the frame interval the rtp packets of a frame
+            are spread over, 0 to send them at line rate
+     @param httpPort : port of the fmp4 over http, 0 not to serve it
+     @param txtime : pace with SO_TXTIME, @sa fpvRTPSink::setPacing()
+     **/
+	FpvServer(unsigned threads = 1, unsigned pacing = 0, unsigned httpPort = 0,
+	          bool txtime = false);
 	virtual ~FpvServer(){};
 
     /**
@@ -79,7 +131,8 @@ public:
      @param iface_name : the name of interface. For example the utility command
        `ifconfig` will list the available network interfaces.
 
-     @return int
+     @return int : 0 when at least one thread listens on the RTSP port,
+       EADDRINUSE when none does, the threads are then stopped.
      **/
 	int start(const std::string& iface_name = "");
 
@@ -95,39 +148,92 @@ public:
      the add request to the FpvSerer. Actual processing will occur asynchronously.
      When successfully added, the session becomes visible over RTSP.
 
+     Each session is published on its own mount point, derived from the params
+     "id" (camera index) and "name" as "cam<id>/<name>". e.g.
+     rtsp://host/cam0/720p. Without a "name" the session is published on the
+     legacy mount point FPV_DEFAULT_MOUNT. Every mount point is backed by its own
+     encoding pipeline.
+
+     A named session with a "multicast" object in camerad.json is sent to the
+     multicast group from the time it is added, and the RTSP clients are
+     handed the group. @sa fpvMulticast
+
      @param [in] uid : unique request id by the client. Response must include
             this identifier.
      @param [in] params : json string with request parameters.
      @param [in] param_siz : size of the string at params.
 
-     @return int
+     @return int : EEXIST if the mount point is already published.
      **/
     int addSession(unsigned int uid, const char* params, int param_siz);
 
+    /**
+     Withdraw the session published by addSession(). The mount point is
+     identified from params in the same way as addSession(). Actual processing
+     will occur asynchronously.
+
+     @param [in] uid : unique request id by the client.
+     @param [in] params : json string with request parameters.
+     @param [in] param_siz : size of the string at params.
+
+     @return int : ENOENT if there is no such mount point.
+     **/
+    int removeSession(unsigned int uid, const char* params, int param_siz);
+
+    /**
+     @return size_t : number of the mount points currently published.
+     **/
+    size_t sessionCount();
+
+    /**
+     Collect the transport statistics of the RTSP clients of all the mount
+     points. The statistics are refreshed once a second by the serving threads.
+
+     @param [out] out : the clients are appended to it.
+     **/
+    void getStats(std::vector<ClientStats>& out);
+
+    /**
+     Derive the name of the mount point from the request params.
+
+     @param [in] params : json string with request parameters.
+     @param [in] param_siz : size of the string at params.
+
+     @return std::string : name of the mount point, such as "cam0/720p"
+     **/
+    static std::string mountName(const char* params, int param_siz);
+
+    /**
+     Get the camera index and the session name from the request params.
+
+     @return bool : false when the params don't name a session.
+     **/
+    static bool parseMount(const char* params, int param_siz, unsigned& id,
+                           std::string& name);
+
     UsageEnvironment& env() {
-        return *env_;
+        return *shards_.front()->env_;
     }
 
 private:
 
-    std::promise<bool> start_promise_;
-
     char stopflag_;
     int  port_;
+    unsigned threads_;  /**< number of the threads to start */
+    unsigned pacing_;   /**< of the frame interval, for the mount points */
+    bool txtime_;       /**< pace with SO_TXTIME, for the mount points */
+    unsigned httpPort_; /**< of the fmp4 over http, 0 for none */
     std::string net_iface_;
-    std::thread task_;      /**< a hosting thread */
-    std::queue<Request> requests_;   /**< queue of requests to server */
+    std::vector<std::unique_ptr<Shard>> shards_;   /**< the serving threads */
+    std::map<std::string, std::shared_ptr<fpvMount>> mounts_;   /**< the published mount points */
     std::mutex lock_;   /**< serialize the access to this object */
-    EventTriggerId signal_; /**< used to resume asynchronous operations */
 
-    /** LiveMedia parameters */
-    TaskScheduler* scheduler_;
-    UsageEnvironment* env_;
-    RTSPServer* rtsp_;
+    /** @return bool : true if any thread is serving */
+    bool serving_locked();
+    void post_locked(const Request& req);
 
-    void doRTSP();
-    void doSession();
-    static void dispatchSignal(FpvServer* me);
+    static void doRTSP(Shard* shard);
+    static void doSession(Shard* shard);
 };
 }
 
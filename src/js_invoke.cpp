@@ -31,6 +31,9 @@
 #include "qcamvid_log.h"
 #include "json/json_gen.h"
 #include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 void jsCall::dump(void) {
     JSONParser js;
@@ -148,3 +151,61 @@ void jsResult_Send(
     QCAM_INFO("RES : %s", psz);
 }
 
+
+void jsResult_SendJSON(
+    int sock,
+    unsigned int uid,
+    const char* json,
+    int siz)
+{
+    JSONGen gen;
+    char buf[128];
+    const char *psz;
+    int nsize = sizeof(buf);
+
+    JSONGen_Ctor(&gen, buf, nsize, jsGen_Realloc, 0);
+    JSONGen_BeginObject(&gen);
+    JSONGen_PutKey(&gen, "id", 0);
+    JSONGen_PutUInt(&gen, uid);
+
+    JSONGen_PutKey(&gen, "result", 0);
+    JSONGen_PutJSON(&gen, json, siz);
+
+    JSONGen_EndObject(&gen);
+
+    if (JSONGEN_SUCCESS == JSONGen_GetJSON(&gen, &psz, &nsize)) {
+        write(sock, psz, nsize);
+        QCAM_INFO("RES : %d bytes", nsize);
+    }
+    else {
+        QCAM_ERR("failed to build the result of %u", uid);
+        jsResult_Send(sock, uid, ENOMEM);
+    }
+    JSONGen_Dtor(&gen);
+}
+
+int jsGen_Realloc(void* ctx, int size, void** pp)
+{
+    void* p;
+
+    if (0 == size) {
+        free(*pp);
+        *pp = NULL;
+        return JSONGEN_SUCCESS;
+    }
+
+    p = realloc(*pp, size);
+    if (NULL == p) {
+        return JSONGEN_ERROR;
+    }
+    *pp = p;
+    return JSONGEN_SUCCESS;
+}
+
+int jsGen_PutUInt64(JSONGen* gen, uint64_t num)
+{
+    char buf[24];
+    int n = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)num);
+
+    return JSONGen_PutJSON(gen, buf, n);
+}
@@ -30,6 +30,7 @@
 #define __JS_INVOKE_H__
 
 #include "json/json_parser.h"
+#include "json/json_gen.h"
 #include <stdint.h>
 
 struct jsCall {
@@ -56,4 +57,17 @@ void jsResult_Send(
     unsigned int uid,
     int result /**< 0 is a successful, non zero is error */);
 
+/** send a successful result carrying a JSON value */
+void jsResult_SendJSON(
+    int sock,
+    unsigned int uid,
+    const char* json, /**< JSON formatted result */
+    int siz);
+
+/** JSONGenReallocFunc on the heap, the buffer is freed by JSONGen_Dtor() */
+int jsGen_Realloc(void* ctx, int size, void** pp);
+
+/** put a 64 bit unsigned number, JSONGen_PutDouble() would round it */
+int jsGen_PutUInt64(JSONGen* gen, uint64_t num);
+
 #endif /* !__JS_INVOKE_H__ */
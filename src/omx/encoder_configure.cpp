@@ -504,14 +504,14 @@ fprintf(stderr, "%s : %d\n", "nLTRPeriod",                   pConfig->nLTRPeriod
                                                OMX_IndexParamVideoAvc,
                                                (OMX_PTR) &avcdata);
                   }
-                  OMX_U32 slice_delivery_mode = 0;
+                  OMX_U32 slice_delivery_mode = (OMX_U32) pConfig->bSliceDelivery;
 #ifdef _ANDROID_
                   property_get("vidc.venc.slicedeliverymode", value, "0");
-                  slice_delivery_mode = atoi(value);
+                  slice_delivery_mode |= atoi(value);
 #endif
                   if ((result == OMX_ErrorNone) && (slice_delivery_mode))
                   {
-                     VENC_TEST_MSG_HIGH("Slice delivery mode enabled via setprop command", 0, 0, 0);
+                     VENC_TEST_MSG_HIGH("Slice delivery mode enabled", 0, 0, 0);
                      QOMX_EXTNINDEX_PARAMTYPE extnIndex;
                      extnIndex.nPortIndex = PORT_INDEX_OUT;
                      extnIndex.bEnable = OMX_TRUE;
@@ -1130,4 +1130,36 @@ OMX_ERRORTYPE Configure(OMX_HANDLETYPE hEncoder,
     return e.Configure(&Config);
 }
 
+OMX_ERRORTYPE SetBitrate(OMX_HANDLETYPE hEncoder, OMX_U32 nBitrate)
+{
+    OMX_ERRORTYPE result;
+    OMX_VIDEO_CONFIG_BITRATETYPE bitrate; // OMX_IndexConfigVideoBitrate
+
+    bitrate.nSize = sizeof(bitrate);
+    bitrate.nPortIndex = (OMX_U32) PORT_INDEX_OUT; // output
+    result = OMX_GetConfig(hEncoder,
+                           OMX_IndexConfigVideoBitrate,
+                           (OMX_PTR) &bitrate);
+    if (result == OMX_ErrorNone)
+    {
+        bitrate.nEncodeBitrate = nBitrate;
+        result = OMX_SetConfig(hEncoder,
+                               OMX_IndexConfigVideoBitrate,
+                               (OMX_PTR) &bitrate);
+    }
+    return result;
+}
+
+OMX_ERRORTYPE RequestIntraRefresh(OMX_HANDLETYPE hEncoder)
+{
+    OMX_CONFIG_INTRAREFRESHVOPTYPE vop; // OMX_IndexConfigVideoIntraVOPRefresh
+
+    OMX_INIT_STRUCT(&vop, OMX_CONFIG_INTRAREFRESHVOPTYPE);
+    vop.nPortIndex = (OMX_U32) PORT_INDEX_OUT; // output
+    vop.IntraRefreshVOP = OMX_TRUE;
+    return OMX_SetConfig(hEncoder,
+                         OMX_IndexConfigVideoIntraVOPRefresh,
+                         (OMX_PTR) &vop);
+}
+
 }}}/* namespace omx::video::encoder */
@@ -135,6 +135,8 @@ namespace encoder {
       //Config file Key: IDR Period
       OMX_U32 nHierPNumLayers;
       //Config file key: HierPNumLayers
+      OMX_BOOL bSliceDelivery;
+      //Config file key: SliceDelivery
       ////////////////////////////////////////
       //======== Mpeg4 static config
       OMX_S32 nHECInterval;
@@ -234,6 +236,23 @@ OMX_ERRORTYPE Configure(OMX_HANDLETYPE hEncoder, OMX_VIDEO_CODINGTYPE eCodec,
                         OMX_S32& nInputBufferSize, OMX_S32& nOutputBufferSize,
                         EncoderConfigType& Config);
 
+/////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Change the target bitrate of a running encoder
+ *
+ * @param hEncoder The encoder
+ * @param nBitrate The target bitrate, in bits per second
+ */
+OMX_ERRORTYPE SetBitrate(OMX_HANDLETYPE hEncoder, OMX_U32 nBitrate);
+
+/**
+ * @brief Request the next frame of a running encoder to be an IDR frame
+ *
+ * @param hEncoder The encoder
+ */
+OMX_ERRORTYPE RequestIntraRefresh(OMX_HANDLETYPE hEncoder);
+
 }}} /* namespace omx::video::encoder */
 
 #endif /* !__OMX_VIDEO_ENCODER_CONFIGURE_H__ */
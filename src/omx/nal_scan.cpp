@@ -0,0 +1,149 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "omx/nal_scan.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace omxa {
+
+/**
+ look at the third octet of a window, a value above 1 rules out a prefix at
+ any of the three positions ending there, so skip over all of them.
+ **/
+const uint8_t* findStartCodeScalar(const uint8_t* p, const uint8_t* end)
+{
+    while (p + 3 <= end) {
+        if (1 < p[2]) {
+            p += 3;
+        }
+        else if (1 == p[2]) {
+            if (0 == p[1] && 0 == p[0]) {
+                return p;
+            }
+            p += 3;
+        }
+        else {
+            p++;
+        }
+    }
+    return end;
+}
+
+#if defined(__AVX2__)
+
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    /* compare 32 windows at a time, i.e p[i], p[i+1], p[i+2] */
+    while (p + 32 + 2 <= end) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)p);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(p + 2));
+        __m256i m = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                             _mm256_cmpeq_epi8(b, zero)),
+            _mm256_cmpeq_epi8(c, one));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return findStartCodeScalar(p, end);
+}
+
+#elif defined(__SSE2__)
+
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    /* compare 16 windows at a time, i.e p[i], p[i+1], p[i+2] */
+    while (p + 16 + 2 <= end) {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + 2));
+        __m128i m = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+            _mm_cmpeq_epi8(c, one));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+
+    return findStartCodeScalar(p, end);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    /* compare 16 windows at a time, i.e p[i], p[i+1], p[i+2] */
+    while (p + 16 + 2 <= end) {
+        uint8x16_t m = vandq_u8(
+            vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero)),
+            vceqq_u8(vld1q_u8(p + 2), one));
+        uint64x2_t m64 = vreinterpretq_u64_u8(m);
+
+        if (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)) {
+            /* there is no movemask on NEON, locate it within this block */
+            return findStartCodeScalar(p, p + 16 + 2);
+        }
+        p += 16;
+    }
+
+    return findStartCodeScalar(p, end);
+}
+
+#else
+
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end)
+{
+    return findStartCodeScalar(p, end);
+}
+
+#endif
+
+} /* namespace omxa */
@@ -0,0 +1,55 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __OMXA_NAL_SCAN_H__
+#define __OMXA_NAL_SCAN_H__
+
+#include <stdint.h>
+
+namespace omxa {
+
+/**
+ Find the first H.264 start code prefix (00 00 01) in the given range. A four
+ octet start code (00 00 00 01) is found at its last three octets.
+
+ The scan is vectorized for the target (AVX2, SSE2 or NEON) with a scalar
+ fallback, as this is the hottest loop on the streaming path.
+
+ @param p : beginning of the range
+ @param end : end of the range
+
+ @return const uint8_t* : the first octet of the prefix or end if not found.
+ **/
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end);
+
+/** the portable scan findStartCode() ends with, the reference to check and
+    measure the vectorized scan against */
+const uint8_t* findStartCodeScalar(const uint8_t* p, const uint8_t* end);
+
+} /* namespace omxa */
+#endif /* !__OMXA_NAL_SCAN_H__ */
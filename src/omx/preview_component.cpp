@@ -28,139 +28,825 @@
  */
 
 #include "omx/preview_component.h"
+#include "omx/nal_scan.h"
+#include "omx/spsc_ring.h"
+#include "omx/encoder_configure.h"
 #include "GroupsockHelper.hh"
-#include <queue>
-#include <condition_variable>
+#include "qcamvid_log.h"
+#include <atomic>
+#include <chrono>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+#include <list>
 #include <algorithm>
+#include <cstdlib>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 
 namespace omxa {
 
 class PreviewSource;
+class RtpComponent;
 
-class RtpComponent : public std::enable_shared_from_this<RtpComponent>,
-    public PreviewComponent, public OmxSink {
+/* omx buffers handed from the encoder and not yet published to the readers */
+#define RTP_PENDING_SIZE 64
 
-    OMX_BUFFERHEADERTYPE* buffer_in_use_ = NULL;   /* buffer currently being streamed from */
-    std::queue<OMX_BUFFERHEADERTYPE*>  pending_;   /* queue of buffers pending to be streamed */
-    unsigned pending_data_size_ = 0;
-    std::condition_variable cv_;
+/* doorbell wakeups per statistics log */
+#define DOORBELL_LOG_WAKEUPS 300
 
-    PreviewParameters params_;
+/** a NAL unit within an access unit, without the start code */
+struct NalSlice {
+    uint32_t offset_;   /**< octets from the start of the access unit */
+    uint32_t size_;     /**< number of octets in the NAL unit */
+};
+
+/**
+ An encoded access unit, i.e the contents of one omx buffer. All the readers
+ share the same omx buffer, which is returned to the encoder when the last
+ reference is released. The NAL unit boundaries are indexed once, when the
+ buffer is published, and the readers copy the slices straight out of the
+ buffer.
+
+ The access units backed by omx buffers are pooled by RtpComponent, one per
+ omx buffer, and reloaded every time the encoder fills the buffer.
+ **/
+class AccessUnit {
+    RtpComponent* owner_;         /* NULL for a private copy */
+    OMX_BUFFERHEADERTYPE* buf_;
+    std::vector<uint8_t> copy_;   /* private copy, when not backed by omx buffer */
+    std::atomic<uint32_t> refs_;  /* number of AccessUnitPtr references */
+
+    /** index the NAL units, delimited by the 3 or 4 octet start codes */
+    void index() {
+        const uint8_t* end = data_ + size_;
+        const uint8_t* nal = findStartCode(data_, end);
+
+        while (nal != end) {
+            nal += 3;
+
+            /* the nal unit ends at the next prefix, including the leading
+               zero of a 4 octet prefix */
+            const uint8_t* next = findStartCode(nal, end);
+            const uint8_t* last = next;
+            if (next != end && nal < last && 0 == last[-1]) {
+                last--;
+            }
+            if (nal < last) {
+                slices_.push_back(NalSlice{ (uint32_t)(nal - data_),
+                                            (uint32_t)(last - nal) });
+            }
+            nal = next;
+        }
+    }
+public:
+    uint64_t seq_ = 0;          /**< sequence number in the ring */
+    const uint8_t* data_ = NULL;  /**< encoded data */
+    uint32_t size_ = 0;         /**< number of octets at data_ */
+    OMX_U32 flags_ = 0;         /**< omx buffer flags */
+    OMX_TICKS ts_ = 0;          /**< capture time stamp, in microseconds */
+    bool frameStart_ = true;    /**< the first buffer of a frame */
+    bool frameEnd_ = true;      /**< the last buffer of a frame */
+    uint64_t pos_ = 0;          /**< octets published ahead of this one */
+    std::vector<NalSlice> slices_;  /**< NAL units in the access unit */
+
+    AccessUnit(RtpComponent* owner, OMX_BUFFERHEADERTYPE* buf)
+    : owner_(owner), buf_(buf), refs_(0) {}
+
+    /** a private copy of the access unit, it outlives the omx buffer */
+    AccessUnit(const AccessUnit& au)
+    : owner_(NULL), buf_(NULL), copy_(au.data_, au.data_ + au.size_),
+      refs_(0), seq_(au.seq_), data_(copy_.data()), size_(au.size_),
+      flags_(au.flags_), ts_(au.ts_), frameStart_(au.frameStart_),
+      frameEnd_(au.frameEnd_), pos_(au.pos_), slices_(au.slices_) {}
+
+    /** load the omx buffer as filled by the encoder */
+    void load(uint64_t seq) {
+        seq_ = seq;
+        data_ = buf_->pBuffer + buf_->nOffset;
+        size_ = buf_->nFilledLen;
+        flags_ = buf_->nFlags;
+        ts_ = buf_->nTimeStamp;
+        slices_.clear();   /* keeps the capacity of the previous fills */
+        index();
+    }
+
+    bool isBackedBy(const OMX_BUFFERHEADERTYPE* buf) const {
+        return buf_ == buf;
+    }
+
+    void addRef() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** backed by an omx buffer, not a private copy */
+    bool isBuffered() const {
+        return NULL != owner_;
+    }
+
+    /** referenced other than by the ring, i.e held by a reader. The
+        readers take their references with the lock of the ring held */
+    bool isShared() const {
+        return 1 < refs_.load(std::memory_order_acquire);
+    }
 
-    /* output_ member implements the FramedSource facet */
-    std::weak_ptr<PreviewSource> output_;
+    /** drop a reference, the last one returns the omx buffer to the encoder */
+    void release();
 
-    /* close */
-    void close_locked(void) {
-        source_ = NULL;
+    /** a reader may start decoding from this access unit */
+    bool isSyncFrame() const {
+        return frameStart_ && 0 != (flags_ & OMX_BUFFERFLAG_SYNCFRAME);
     }
 
-    /** signal the output_ object to harvest the data */
-    void signal_output(void);
+    bool isCodecConfig() const {
+        return 0 != (flags_ & OMX_BUFFERFLAG_CODECCONFIG);
+    }
+
+    /** no other frame refers to this one, i.e all its slices have
+        nal_ref_idc 0. It may be dropped without breaking the decoding */
+    bool isDisposable() const {
+        bool vcl = false;
+
+        for (const NalSlice& slice : slices_) {
+            uint8_t nal = data_[slice.offset_];
+            uint8_t type = nal & 0x1F;
 
+            if (1 <= type && type <= 5) {
+                if (0 != (nal & 0x60)) {
+                    return false;
+                }
+                vcl = true;
+            }
+        }
+        return vcl;
+    }
+};
+
+/**
+ A reference to an access unit. The count is kept in the access unit itself,
+ so that publishing an omx buffer to the readers doesn't allocate.
+ **/
+class AccessUnitPtr {
+    AccessUnit* p_;
 public:
+    AccessUnitPtr() : p_(NULL) {}
+    explicit AccessUnitPtr(AccessUnit* p) : p_(p) { if (p_) { p_->addRef(); } }
+    AccessUnitPtr(const AccessUnitPtr& o) : p_(o.p_) { if (p_) { p_->addRef(); } }
+    AccessUnitPtr(AccessUnitPtr&& o) : p_(o.p_) { o.p_ = NULL; }
+    ~AccessUnitPtr() { reset(); }
+
+    AccessUnitPtr& operator =(AccessUnitPtr o) {
+        swap(o);
+        return *this;
+    }
 
-    RtpComponent(PreviewParameters& params) : params_(params) {}
+    void swap(AccessUnitPtr& o) { std::swap(p_, o.p_); }
 
-    int init(PreviewParameters& params) { params_ = params; return 0; }
+    void reset() {
+        AccessUnit* p = p_;
+        p_ = NULL;
+        if (p) {
+            p->release();
+        }
+    }
 
-    virtual void close() {
-        std::unique_lock<std::mutex> lk(lock_);
-        close_locked();
+    AccessUnit* operator ->() const { return p_; }
+    AccessUnit& operator *() const { return *p_; }
+    explicit operator bool() const { return NULL != p_; }
+};
+
+/**
+ Wakes the readers of one live555 scheduler. The encoder thread rings it for
+ every buffer, the rings are counted by an eventfd and the scheduler handles
+ them all in one wakeup, publishing the buffers and delivering to every
+ reader awaiting data. From there each reader drains the ring at its own pace.
+ **/
+class Doorbell : public std::enable_shared_from_this<Doorbell> {
+    std::weak_ptr<RtpComponent> owner_;
+    TaskScheduler* task_;
+    int fd_;
+    std::list<PreviewSource*> readers_;   /* accessed by the scheduler thread only */
+    std::list<PreviewSource*>::iterator next_;  /* next reader to deliver to */
+
+    /* wakeups and buffers per wakeup, for diagnostics */
+    std::chrono::steady_clock::time_point since_;
+    uint32_t wakeups_ = 0;
+    uint64_t rings_ = 0;
+
+    static void handle0(void* clientData, int mask) {
+        ((Doorbell*)clientData)->handle();
     }
 
-    virtual ~RtpComponent() { close(); }
+    void handle();
 
-    bool isOpen(void) {
-        return true;
+public:
+    Doorbell(std::weak_ptr<RtpComponent> owner, TaskScheduler* task, int fd)
+    : owner_(owner), task_(task), fd_(fd), next_(readers_.end()),
+      since_(std::chrono::steady_clock::now()) {
+        task_->turnOnBackgroundReadHandling(fd_, handle0, this);
+    }
+
+    ~Doorbell() {
+        task_->turnOffBackgroundReadHandling(fd_);
+        close(fd_);
+    }
+
+    /** @return std::shared_ptr<Doorbell> : empty when out of descriptors */
+    static std::shared_ptr<Doorbell> create(std::weak_ptr<RtpComponent> owner,
+                                            TaskScheduler* task) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (0 > fd) {
+            QCAM_ERR("failed to create a doorbell, err: %d", errno);
+            return nullptr;
+        }
+        return std::make_shared<Doorbell>(owner, task, fd);
+    }
+
+    TaskScheduler* scheduler() const { return task_; }
+
+    void add(PreviewSource* reader) { readers_.push_back(reader); }
+
+    /** @return bool : true while there are readers left */
+    bool remove(PreviewSource* reader) {
+        auto i = std::find(readers_.begin(), readers_.end(), reader);
+        if (i != readers_.end()) {
+            if (i == next_) {   /* removed while delivering to the readers */
+                next_++;
+            }
+            readers_.erase(i);
+        }
+        return !readers_.empty();
+    }
+
+    /** count a buffer for the readers, from any thread */
+    void ring() {
+        uint64_t one = 1;
+        ssize_t rc = write(fd_, &one, sizeof(one));
+        (void)rc;
     }
+};
+
+/** read position of a reader in the ring of access units */
+struct RingCursor {
+    uint64_t next_ = 0;       /**< sequence number of the next access unit */
+    uint64_t joined_ = 0;     /**< head of the ring when attached, the access
+                                   units ahead of it are a catch-up burst */
+    AccessUnitPtr au_;        /**< access unit currently being read from */
+    uint32_t offset_ = 0;     /**< read offset in au_ */
+    uint32_t slice_ = 0;      /**< next NAL unit in au_, for discrete reads */
+    OMX_TICKS ts_ = 0;        /**< capture time stamp of au_ */
+    bool sync_ = false;       /**< reader is past a sync frame */
+    bool config_ = false;     /**< reader has been given the parameter sets */
+    uint32_t overruns_ = 0;   /**< times this reader was lapped by the writer */
+    uint32_t laps_ = 0;       /**< times lapped since it last caught up */
+    bool endOfFrame_ = false; /**< the data last read ends a frame */
+    bool live_ = false;       /**< reader has caught up with the writer once */
+    bool dropping_ = false;   /**< dropping the rest of a disposable frame */
+    bool wantSync_ = false;   /**< request a sync frame, once unlocked */
+    uint32_t dropped_ = 0;    /**< access units dropped over the latency budget */
+    uint32_t resyncs_ = 0;    /**< times skipped ahead to the next sync frame */
+    int64_t after_ = 0;       /**< wall clock in microseconds, a reader switched
+                                   over from another stream starts at a sync
+                                   frame presented after it. 0 for any */
+};
+
+class RtpComponent : public std::enable_shared_from_this<RtpComponent>,
+    public PreviewComponent, public OmxSink {
+
+    std::vector<AccessUnitPtr> ring_;   /* most recent access units */
+    uint64_t head_ = 0;                 /* sequence number of the next access unit */
+    std::vector<std::unique_ptr<AccessUnit>> pool_;  /* one per omx buffer */
+
+    /* buffers filled by the encoder, handed over without taking lock_. The
+       holder of lock_ is the consumer, which publishes them to ring_ */
+    SpscRing<OMX_BUFFERHEADERTYPE*, RTP_PENDING_SIZE> pending_;
+
+    std::vector<std::shared_ptr<Doorbell>> doorbells_;  /* one per scheduler of the readers */
+    std::mutex readersLock_;            /* serialize the access to doorbells_ */
+    std::mutex sinkLock_;               /* serialize returning the buffers */
+    AccessUnitPtr config_;              /* copy of the latest codec config */
+    ParameterSets paramSets_;           /* parameter sets parsed from config_ */
+
+    bool frameEnded_ = true;   /* the last buffer published ended a frame */
+    uint64_t published_ = 0;   /* octets published */
+    OMX_TICKS newestTs_ = 0;   /* capture time of the newest frame */
+
+    /* copies of the access units of the latest group of pictures evicted
+       from the ring, gop_[i] is the access unit gopStart_ + i */
+    std::vector<AccessUnitPtr> gop_;
+    uint64_t gopStart_ = 0;    /* sequence number of the latest sync frame */
+    bool gopValid_ = false;    /* the access units from gopStart_ are at hand */
+    size_t gopBytes_ = 0;      /* octets copied in gop_ */
+    bool idrRequested_ = false;  /* an IDR frame was requested, not yet seen */
+
+    int64_t wallOffset_ = 0;   /* microseconds from the capture clock to wall clock */
+    bool rebased_ = false;     /* capture clock isn't the monotonic clock */
+
+    PreviewParameters params_;
+
+    /** ring the readers to harvest the data, returns the number of doorbells */
+    size_t signal_output(void);
+
+    /**
+     publish the buffers filled by the encoder in the ring, the access units
+     evicted from the ring are returned to the encoder unless a reader still
+     holds them. lock_ must be held.
+     **/
+    void publish_locked() {
+        OMX_BUFFERHEADERTYPE* buf;
+
+        while (pending_.pop(buf)) {
+            AccessUnit* au = NULL;
+
+            for (std::unique_ptr<AccessUnit>& pooled : pool_) {
+                if (pooled->isBackedBy(buf)) {
+                    au = pooled.get();
+                    break;
+                }
+            }
+            if (NULL == au) {   /* first time this buffer is filled */
+                pool_.emplace_back(new AccessUnit(this, buf));
+                au = pool_.back().get();
+            }
+            au->load(head_);
+            au->pos_ = published_;
+            published_ += au->size_;
+
+            /* in slice mode a frame spans several buffers, the last one is
+               flagged with OMX_BUFFERFLAG_ENDOFFRAME */
+            au->frameStart_ = frameEnded_;
+            au->frameEnd_ = !params_.sliceMode
+                || 0 != (au->flags_ & OMX_BUFFERFLAG_ENDOFFRAME);
+            if (!au->isCodecConfig()) {
+                frameEnded_ = au->frameEnd_;
+                newestTs_ = au->ts_;
+            }
 
-    virtual bool isReadable() { return 0 < pending_data_size_;  }
+            /* a capture clock other than monotonic is re-based on the
+               first frame, trading the latency measure for pacing */
+            if (!rebased_ && 0 != au->ts_ && !au->isCodecConfig()
+                && 1000000 < std::abs(monotonicClock() - (int64_t)au->ts_)) {
+                QCAM_INFO("capture clock isn't monotonic, re-based");
+                wallOffset_ = wallClock() - (int64_t)au->ts_;
+                rebased_ = true;
+            }
+            if (au->isCodecConfig()) {
+                captureConfig_locked(*au);
+            }
+            if (au->isSyncFrame()) {   /* a new group of pictures */
+                gop_.clear();
+                gopBytes_ = 0;
+                gopStart_ = head_;
+                gopValid_ = 0 < params_.gopCacheSize;
+                idrRequested_ = false;
+            }
 
-    /** @note from buffer should be atleast 4 bytes long */
-    inline uint32_t get4Bytes(uint8_t* from) {
-        return (from[0]<<24)|(from[1]<<16)|(from[2]<<8)|from[3];
+            AccessUnitPtr& slot = ring_[head_ % ring_.size()];
+            if (slot) {
+                evict_locked(*slot);
+                if (slot->isBuffered() && slot->isShared()) {
+                    unshare_locked();
+                }
+            }
+            slot = AccessUnitPtr(au);
+            head_++;
+        }
     }
 
-    inline bool is_nal_prefix(uint32_t a_word, uint32_t& prefix_siz) {
-        if (0x01 == a_word) {
-            prefix_siz = 4;
-            return true;
+    /**
+     keep a copy of an access unit of the latest group of pictures, before it
+     is evicted from the ring. lock_ must be held.
+     **/
+    void evict_locked(const AccessUnit& au) {
+        if (!gopValid_ || au.seq_ < gopStart_) {
+            return;
+        }
+        if (params_.gopCacheSize < gopBytes_ + au.size_) {
+            QCAM_INFO("group of pictures over %u octets, not cached",
+                      params_.gopCacheSize);
+            gop_.clear();
+            gopBytes_ = 0;
+            gopValid_ = false;
+            return;
         }
-        else if (0x01 == (a_word >> 8)) {
-            prefix_siz = 3;
-            return true;
+        gop_.push_back(AccessUnitPtr(new AccessUnit(au)));
+        gopBytes_ += au.size_;
+    }
+
+    /**
+     a reader holds on to the access unit being evicted, reading it in place
+     or stalled, and its omx buffer stays out of the encoder. Make up for it
+     with a private copy of the oldest access unit of the ring no reader
+     holds, returning that buffer instead. The encoder is left a buffer to
+     fill however long the readers hold on. lock_ must be held.
+     **/
+    void unshare_locked() {
+        for (uint64_t seq = head_ + 1 - ring_.size(); seq < head_; seq++) {
+            AccessUnitPtr& au = ring_[seq % ring_.size()];
+
+            if (au && au->isBuffered() && !au->isShared()) {
+                au = AccessUnitPtr(new AccessUnit(*au));
+                return;
+            }
         }
+        QCAM_ERR("the readers hold all the buffers of the ring");
+    }
 
-        return false;
+    /**
+     @param seq : sequence number of an access unit, less than head_
+     @return AccessUnitPtr* : the access unit in the ring or in the group of
+             pictures cache, NULL when it is gone. lock_ must be held.
+     **/
+    AccessUnitPtr* at_locked(uint64_t seq) {
+        if (seq + ring_.size() >= head_) {
+            return &ring_[seq % ring_.size()];
+        }
+        if (gopValid_ && gopStart_ <= seq && seq - gopStart_ < gop_.size()) {
+            return &gop_[seq - gopStart_];
+        }
+        return NULL;
     }
 
-    inline void append_4(uint8_t*& to, unsigned int& to_size, uint32_t a_word) {
-        if (4 <= to_size) {
-            *to++ = (uint8_t)(a_word >> 24);
-            *to++ = (uint8_t)(a_word >> 16);
-            *to++ = (uint8_t)(a_word >>  8);
-            *to++ = (uint8_t)a_word;
-            to_size -= 4;
+    /**
+     how far a reader is behind the writer, reading the given access unit.
+     lock_ must be held.
+
+     @return unsigned : 0 within the latency budget, 1 over it or 2 over
+             twice the budget.
+     **/
+    unsigned overBudget_locked(const AccessUnit& au) {
+        uint64_t backlog = published_ - au.pos_;
+        unsigned level = 0;
+
+        if (0 != params_.latencyBudgetBytes) {
+            level = std::max(level, (unsigned)std::min<uint64_t>(
+                2, backlog / params_.latencyBudgetBytes));
         }
-        else {
-            for (int i = 3; to_size && i; to_size--) {
-                *to++ = (uint8_t)a_word >> (8 << i--);
+        if (0 != params_.latencyBudgetMs && 0 != au.ts_ && au.ts_ < newestTs_) {
+            level = std::max(level, (unsigned)std::min<uint64_t>(
+                2, (newestTs_ - au.ts_) / 1000 / params_.latencyBudgetMs));
+        }
+        return level;
+    }
+
+    /** capture the parameter sets from a codec config access unit */
+    void captureConfig_locked(const AccessUnit& au) {
+        AccessUnitPtr config(new AccessUnit(au));
+        ParameterSets ps;
+
+        for (const NalSlice& slice : config->slices_) {
+            const uint8_t* nal = config->data_ + slice.offset_;
+
+            switch (nal[0] & 0x1F) {
+            case 7: ps.sps.assign(nal, nal + slice.size_); break;
+            case 8: ps.pps.assign(nal, nal + slice.size_); break;
             }
         }
+
+        config_ = config;
+        if (!ps.empty()) {
+            paramSets_ = ps;
+        }
     }
 
-    /** copies a h264 nal unit looking for the nal prefix sequence. returns
-       the number of bytes in the 'from' buffer scanned */
-    uint32_t copyOneNAL(uint8_t* to, unsigned int to_size,
-                        uint8_t* from, unsigned int from_size,
-                        unsigned int& frame_size) {
-        uint32_t prefix_siz;
-        frame_size = 0;
-        uint32_t src_bytes = from_size;
+    /** @return bool : the access unit may start a reader switched over from
+                another stream. lock_ must be held */
+    bool isAfter_locked(const RingCursor& c, const AccessUnit& au) {
+        return 0 == c.after_ || 0 == au.ts_
+            || (int64_t)au.ts_ + wallOffset_ > c.after_;
+    }
 
-        /* skip until nal prefix */
-        while (4 <= from_size
-               && !is_nal_prefix(get4Bytes(from), prefix_siz)) {
-            from++;
-            from_size--;
+    /**
+     @param seq : sequence number of an access unit in the ring
+     @return uint64_t : sequence number of the newest sync frame published
+             after it, 0 when there is none. lock_ must be held.
+     **/
+    uint64_t newestSync_locked(uint64_t seq) {
+        for (uint64_t s = head_; s-- > seq + 1; ) {
+            AccessUnitPtr* au = at_locked(s);
+
+            if (NULL == au || !*au) {
+                break;
+            }
+            if ((*au)->isSyncFrame()) {
+                return s;
+            }
         }
+        return 0;
+    }
 
-        if (4 <= from_size) {
-            uint32_t next_word;
+    /**
+     position the cursor on the next access unit to read from. lock_ must be
+     held.
 
-            from += prefix_siz;
-            from_size -= prefix_siz;
+     @return int : 0 when c.au_ is ready, EAGAIN when there is nothing to read
+             or EPIPE when the reader is closed.
+     **/
+    int next_locked(RingCursor& c) {
+        if (NULL == source_) {
+            return EPIPE;
+        }
+        publish_locked();
+        if (c.au_) {
+            return 0;
+        }
 
-            while (from_size) {
-                if (4 <= from_size) {   /* scan 4 octets at a time for nal prefix */
-                    next_word = get4Bytes(from);
-                    if (is_nal_prefix(next_word, prefix_siz)) {
-                        break;   /* end of frame */
+        /* lapped by the writer? skip ahead to the oldest access unit */
+        if (c.next_ < head_ && NULL == at_locked(c.next_)) {
+            c.overruns_++;
+            c.laps_++;
+            if (params_.evictOverruns <= c.laps_) {
+                return EPIPE;   /* evict the slow reader */
+            }
+            c.next_ = head_ - ring_.size();
+            c.sync_ = false;
+        }
+
+        /* resume at a sync frame, skipping the frames which can't be decoded */
+        while (c.next_ < head_) {
+            AccessUnitPtr& au = *at_locked(c.next_);
+
+            /* late frames are useless, drop whole frames over the latency
+               budget. The disposable frames go first, then everything up to
+               the next sync frame. A reader catching up from the cached group
+               of pictures isn't late over the access units ahead of it, it
+               is over those published since it joined, caught up or not */
+            if (c.joined_ <= c.next_ && c.sync_ && au->frameStart_
+                && !au->isCodecConfig()) {
+                unsigned level = overBudget_locked(*au);
+
+                if (2 <= level) {
+                    uint64_t sync = newestSync_locked(c.next_);
+
+                    c.sync_ = false;
+                    c.resyncs_++;
+                    if (0 != sync) {   /* skip straight to the newest one */
+                        c.dropped_ += sync - c.next_;
+                        c.next_ = sync;
+                        continue;
                     }
-                    else if (0x00 == (next_word&0xFF)) {
-                        /* lsb is 0, potential prefix sequence following,
-                           copy just one octet */
-                        if (to_size) { *to++ = (uint8_t)(next_word >> 24); to_size--; }
-                        frame_size++; from++; from_size--;
+                    if (!idrRequested_) {   /* don't wait for the end of the GOP */
+                        idrRequested_ = true;
+                        c.wantSync_ = true;
                     }
-                    else {
-                        /* copy all 4 octets from 'next_word' */
-                        append_4(to, to_size, next_word);
-                        frame_size += 4; from += 4; from_size -= 4;
+                    c.dropping_ = au->isSyncFrame();   /* not to resync on it */
+                }
+                else if (1 == level && au->isDisposable()) {
+                    c.dropping_ = true;
+                }
+            }
+            if (c.dropping_ || (!c.sync_ && c.live_ && !au->isCodecConfig()
+                                && (!au->isSyncFrame() || !isAfter_locked(c, *au)))) {
+                c.dropping_ = c.dropping_ && !au->frameEnd_;
+                c.dropped_++;
+                c.next_++;
+                continue;
+            }
+
+            if (au->isCodecConfig()) {
+                c.config_ = true;
+            }
+            else if (!c.sync_ && au->isSyncFrame()) {
+                c.sync_ = true;
+                c.after_ = 0;
+
+                /* a reader joining after the codec config is given the
+                   cached parameter sets in-band, ahead of the sync frame */
+                if (!c.config_ && config_) {
+                    c.config_ = true;
+                    c.au_ = config_;
+                    c.offset_ = 0;
+                    c.slice_ = 0;
+                    c.ts_ = au->ts_;   /* presented along with the sync frame */
+                    return 0;
+                }
+            }
+            c.next_++;
+
+            if (c.sync_ || au->isCodecConfig()) {
+                c.au_ = au;
+                c.offset_ = 0;
+                c.slice_ = 0;
+                if (!au->isCodecConfig() || 0 == c.ts_) {
+                    c.ts_ = au->ts_;   /* codec config carries no capture time */
+                }
+                return 0;
+            }
+        }
+
+        c.live_ = true;
+        c.laps_ = 0;
+        return EAGAIN;
+    }
+
+public:
+
+    RtpComponent(PreviewParameters& params) : params_(params) {}
+
+    int init(PreviewParameters& params) {
+        params_ = params;
+        if (0 == params_.ringSize) {
+            return EINVAL;
+        }
+        ring_.resize(params_.ringSize);
+
+        /* camera stamps the frames with the monotonic clock */
+        wallOffset_ = wallClock() - monotonicClock();
+        return 0;
+    }
+
+    static int64_t monotonicClock() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    }
+
+    static int64_t wallClock() {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+    }
+
+    /**
+     map the capture time stamp to the wall clock, which is the clock of the
+     live555 presentation time and the RTCP sender reports.
+
+     @param ts : capture time stamp of the access unit, in microseconds
+     @param tv : [out] presentation time
+     **/
+    void presentationTime(OMX_TICKS ts, struct timeval& tv) {
+        int64_t us;
+
+        if (0 == ts) {   /* no capture time, present it now */
+            gettimeofday(&tv, NULL);
+            return;
+        }
+        us = (int64_t)ts + wallOffset_;
+        tv.tv_sec = us / 1000000;
+        tv.tv_usec = us % 1000000;
+    }
+
+    /**
+     @param ts : capture time stamp of the access unit
+     @param us : [out] microseconds since the capture
+     @return bool : false when the latency can't be measured
+     **/
+    bool captureLatency(OMX_TICKS ts, int64_t& us) {
+        std::unique_lock<std::mutex> lk(lock_);
+        if (0 == ts || rebased_) {
+            return false;
+        }
+        us = monotonicClock() - (int64_t)ts;
+        return true;
+    }
+
+    virtual void close() {
+        std::unique_lock<std::mutex> lk(lock_);
+        {
+            std::unique_lock<std::mutex> sink(sinkLock_);
+            source_ = NULL;   /* stop returning the buffers to the encoder */
+        }
+        for (AccessUnitPtr& au : ring_) {
+            au.reset();
+        }
+        gop_.clear();
+        gopValid_ = false;
+    }
+
+    virtual ~RtpComponent() { close(); }
+
+    bool isOpen(void) {
+        std::unique_lock<std::mutex> lk(lock_);
+        return NULL != source_;
+    }
+
+    virtual bool isReadable(const RingCursor& c) {
+        std::unique_lock<std::mutex> lk(lock_);
+        if (NULL != source_) {
+            publish_locked();
+        }
+        return c.au_ || c.next_ < head_;
+    }
+
+    /**
+     add a reader to the ring, positioned at the most recent sync frame. The
+     reader bursts through the cached group of pictures from there, or waits
+     for the next sync frame when it isn't cached.
+
+     A reader switched over from another stream (c.after_) waits for the next
+     sync frame past the switch instead, which is requested right away.
+     **/
+    void attach(PreviewSource* reader, TaskScheduler* task, RingCursor& c) {
+        bool request = false;
+        {
+            std::unique_lock<std::mutex> lk(lock_);
+
+            if (NULL != source_) {
+                publish_locked();
+            }
+            c.next_ = head_;
+            c.joined_ = head_;
+            if (0 != c.after_) {
+                c.live_ = true;   /* skip to the sync frame, no catching up */
+            }
+            else if (gopValid_ && gopStart_ < head_) {
+                c.next_ = gopStart_;
+            }
+            else {
+                for (uint64_t seq = head_; seq && seq + ring_.size() > head_; seq--) {
+                    AccessUnitPtr& au = ring_[(seq - 1) % ring_.size()];
+                    if (au && au->isSyncFrame()) {
+                        c.next_ = seq - 1;
+                        break;
                     }
                 }
-                else {  /* as there can't be a nal prefix at the end of from buffer */
-                    if (to_size) { *to++ = *from; to_size--; }
-                    frame_size++; from++; from_size--;
+            }
+
+            /* nothing to start from, don't wait for the end of the GOP */
+            if (c.next_ == head_ && (params_.idrOnJoin || 0 != c.after_)
+                && !idrRequested_) {
+                idrRequested_ = true;
+                request = true;
+            }
+
+            std::unique_lock<std::mutex> rlk(readersLock_);
+            std::shared_ptr<Doorbell> bell;
+
+            for (std::shared_ptr<Doorbell>& b : doorbells_) {
+                if (b->scheduler() == task) {
+                    bell = b;
+                    break;
+                }
+            }
+            if (!bell && (bell = Doorbell::create(shared_from_this(), task))) {
+                doorbells_.push_back(bell);
+            }
+            if (bell) {
+                bell->add(reader);
+            }
+        }
+
+        if (request) {
+            requestSyncFrame();
+        }
+    }
+
+    /** publish the buffers filled by the encoder, on a wakeup of the readers */
+    void publish() {
+        std::unique_lock<std::mutex> lk(lock_);
+        if (NULL != source_) {
+            publish_locked();
+        }
+    }
+
+    /** remove a reader from the ring, it is no longer signaled on return */
+    void detach(PreviewSource* reader, TaskScheduler* task) {
+        std::unique_lock<std::mutex> lk(readersLock_);
+
+        for (auto i = doorbells_.begin(); i != doorbells_.end(); i++) {
+            if ((*i)->scheduler() == task) {
+                if (!(*i)->remove(reader)) {
+                    doorbells_.erase(i);   /* the last reader of the scheduler */
                 }
+                break;
             }
+        }
+    }
+
+    virtual int getParameterSets(ParameterSets& out) {
+        std::unique_lock<std::mutex> lk(lock_);
+        if (NULL != source_) {
+            publish_locked();
+        }
+        if (paramSets_.empty()) {
+            return ENODATA;
+        }
+        out = paramSets_;
+        return 0;
+    }
+
+    /** ask the encoder for a sync frame, on behalf of a reader */
+    void requestSyncFrame() {
+        std::unique_lock<std::mutex> lk(sinkLock_);
+        if (NULL == source_) {
+            return;
+        }
+        OMX_ERRORTYPE omxErr = omx::video::encoder::RequestIntraRefresh(source_);
+        if (OMX_ErrorNone != omxErr) {
+            QCAM_ERR("failed to request an IDR frame, err: %x", omxErr);
+        }
+    }
 
-            return src_bytes - from_size;  /* number of bytes scanned */
+    /** return the buffer to the encoder */
+    void releaseBuffer(OMX_BUFFERHEADERTYPE* buf) {
+        std::unique_lock<std::mutex> lk(sinkLock_);
+        if (NULL != source_) {
+            (void) OMX_FillThisBuffer(source_, buf);
         }
-        return src_bytes;  /* skip over all of this data */
     }
 
     /**
@@ -169,39 +855,37 @@ public:
      * start code. This is more suitable for the live555 object
      * H264VideoStreamFramer.
      *
+     * @param c : cursor of the reader.
      * @param to : destination buffer to copy into.
      * @param to_size : size of destination buffer.
      * @param copied : number of octets copied.
+     * @param pts : [out] presentation time of the data.
      *
-     * @return int : 0 on success or EINTR when the object is interrupted.
-     * @note This is a blocking call if invoked when there are no more octets in
-     *           the source. @sa isReadable()
+     * @return int : 0 on success, EAGAIN when there is no data for the reader
+     *           or EPIPE when the reader is closed.
      **/
-    virtual int getData(uint8_t* to, uint32_t to_size, uint32_t& copied, uint32_t& truncated) {
+    virtual int getData(RingCursor& c, uint8_t* to, uint32_t to_size,
+                        uint32_t& copied, uint32_t& truncated,
+                        struct timeval& pts) {
         std::unique_lock<std::mutex> lk(lock_);
 
-        if (NULL == buffer_in_use_) {
-            cv_.wait(lk, [this](){return !pending_.empty();});
-            buffer_in_use_ = pending_.front();
-            pending_.pop();
+        int rc = next_locked(c);
+        if (0 != rc) {
+            return rc;
         }
+        presentationTime(c.ts_, pts);
 
-        /** @Note nFilledLen is end offset
-         *  @Note nOffset is begin offset */
-        copied = std::min<uint32_t>(
-            to_size,
-            (uint32_t)(buffer_in_use_->nFilledLen - buffer_in_use_->nOffset));
+        copied = std::min<uint32_t>(to_size, c.au_->size_ - c.offset_);
         truncated = 0;
-        memmove(to, buffer_in_use_->pBuffer + buffer_in_use_->nOffset, copied);
-        pending_data_size_ -= copied;
-        buffer_in_use_->nOffset += copied;
-        if (buffer_in_use_->nOffset == buffer_in_use_->nFilledLen) {  /* done with this buffer */
-            /* return this buffer */
-            (void) OMX_FillThisBuffer(source_, buffer_in_use_);
-            buffer_in_use_ = NULL;
+        memmove(to, c.au_->data_ + c.offset_, copied);
+        c.offset_ += copied;
+        c.endOfFrame_ = false;
+        if (c.offset_ == c.au_->size_) {  /* done with this access unit */
+            c.endOfFrame_ = c.au_->frameEnd_ && !c.au_->isCodecConfig();
+            c.au_.reset();
         }
 
-        return 0; /* TODO: support EINTR */
+        return 0;
     }
 
     /**
@@ -211,82 +895,135 @@ public:
      * recommendation by the author here :
      * http://lists.live555.com/pipermail/live-devel/2011-June/013412.html
      *
+     * @param c : cursor of the reader.
      * @param to : destination buffer to copy into.
      * @param to_size : size of the destination buffer.
      * @param copied : number of octets copied.
      * @param truncated : number of octets truncated in this NAL unit.
      *             i.e destination buffer is insufficient.
+     * @param pts : [out] presentation time of the access unit, the same for
+     *             all the NAL units in it.
      *
-     * @return int : 0 on success or EINTR when the object is interrupted.
-     * @note This is a blocking call if invoked when there are no more octets in
-     *           the source. @sa isReadable()
+     * @return int : 0 on success, EAGAIN when there is no data for the reader
+     *           or EPIPE when the reader is closed.
      **/
-    virtual int getOneNalUnit(unsigned char* to, unsigned int to_size,
-                              unsigned int& copied, unsigned int& truncated) {
-        std::unique_lock<std::mutex> lk(lock_);
+    virtual int getOneNalUnit(RingCursor& c, unsigned char* to,
+                              unsigned int to_size, unsigned int& copied,
+                              unsigned int& truncated, struct timeval& pts) {
+        AccessUnitPtr au;
+        NalSlice slice;
+        {
+            std::unique_lock<std::mutex> lk(lock_);
+            int rc;
+
+            /* skip the access units without any NAL unit */
+            while (0 == (rc = next_locked(c))
+                   && c.slice_ == c.au_->slices_.size()) {
+                c.au_.reset();
+            }
+            if (0 != rc) {
+                return rc;
+            }
+            presentationTime(c.ts_, pts);
 
-        if (NULL == buffer_in_use_) {
-            cv_.wait(lk, [this](){return !pending_.empty();});
-            buffer_in_use_ = pending_.front();
-            pending_.pop();
+            au = c.au_;
+            slice = au->slices_[c.slice_++];
+
+            /* Are we done with this access unit? */
+            c.endOfFrame_ = false;
+            if (c.slice_ == au->slices_.size()) {
+                c.endOfFrame_ = au->frameEnd_ && !au->isCodecConfig();
+                c.au_.reset();
+            }
         }
 
-        /** @Note nFilledLen is end offset
-         *  @Note nOffset is begin offset */
-        uint32_t scanned = copyOneNAL(
-            to, to_size, buffer_in_use_->pBuffer + buffer_in_use_->nOffset,
-            (buffer_in_use_->nFilledLen - buffer_in_use_->nOffset), copied);
-        pending_data_size_ -= scanned;
-        buffer_in_use_->nOffset += scanned;
+        /* the slice is held by the reference on au, copy it without the
+           lock. A destination buffer too small for the NAL unit truncates */
+        copied = std::min<unsigned int>(to_size, slice.size_);
+        truncated = slice.size_ - copied;
+        memcpy(to, au->data_ + slice.offset_, copied);
+        return 0;
+    }
 
-        /* copied is actually the frame_size, which may be larger than the
-           'to' buffer provided, revise this for actual copied and account
-           for truncated */
-        if (to_size < copied) {
-            truncated = copied - to_size;
-            copied = to_size;
-        }
-        else {
-            truncated = 0;
-        }
+    /**
+     * get the NAL units of the next access unit in place, without copying
+     * them. The access units are held until the next call, so that the omx
+     * buffers aren't returned to the encoder under the reader. A codec config
+     * access unit is returned along with the frame following it.
+     *
+     * @param c : cursor of the reader.
+     * @param held : [in/out] access units of the NAL units, released first.
+     * @param nals : [out] the NAL units, without the start codes.
+     * @param size : [out] number of octets in the NAL units.
+     * @param pts : [out] presentation time of the access unit.
+     *
+     * @return int : 0 on success, EAGAIN when there is no data for the reader
+     *           or EPIPE when the reader is closed.
+     **/
+    int getNalUnits(RingCursor& c, std::vector<AccessUnitPtr>& held,
+                    std::vector<struct iovec>& nals, unsigned int& size,
+                    struct timeval& pts) {
+        held.clear();   /* the omx buffers may go back without the lock */
+        nals.clear();
+        size = 0;
+
+        std::unique_lock<std::mutex> lk(lock_);
+        int rc;
+
+        while (0 == (rc = next_locked(c))) {
+            AccessUnitPtr au;
+
+            au.swap(c.au_);
+            for (size_t i = c.slice_; i < au->slices_.size(); i++) {
+                const NalSlice& slice = au->slices_[i];
 
-        /* Are we done with this buffer? */
-        if (buffer_in_use_->nOffset == buffer_in_use_->nFilledLen) {
-            /* return the buffer to source component */
-            (void) OMX_FillThisBuffer(source_, buffer_in_use_);
-            buffer_in_use_ = NULL;
+                nals.push_back(iovec{ (void*)(au->data_ + slice.offset_),
+                                      slice.size_ });
+                size += slice.size_;
+            }
+            c.endOfFrame_ = au->frameEnd_ && !au->isCodecConfig();
+            held.push_back(std::move(au));
+
+            if (!held.back()->isCodecConfig()) {
+                break;
+            }
         }
-        return 0; /* TODO: support EINTR */
+        if (held.empty()) {
+            return rc;
+        }
+        presentationTime(c.ts_, pts);
+        return 0;
     }
 
     /**
      Request to empty the contents of given omx buffer. The source of this data 
-     is from an omx component initialized with openOmxSink() request. Once the 
-     data is drained the buffer is returned back to the omx component via 
-     OMX_FillThisBuffer(). 
+     is from an omx component initialized with openOmxSink() request. This
+     runs on the omx callback thread, the buffer is handed to the readers
+     without a lock and published on the wakeup of their doorbell. It is
+     returned back to the omx component via OMX_FillThisBuffer() once it is
+     evicted from the ring and all the readers are done with it.
      
      @param buf : OMX buffer
      
      @return OMX_ERRORTYPE 
      **/
     virtual OMX_ERRORTYPE emptyBuffer(OMX_BUFFERHEADERTYPE* buf) {
-        std::unique_lock<std::mutex> lk(lock_);
         OMX_ERRORTYPE omxErr = OMX_ErrorNone;
 
-        if (0 < buf->nFilledLen) {
-            pending_.push(buf);
-            pending_data_size_ += buf->nFilledLen;
-            buf->nFilledLen += buf->nOffset;   /** @note We took control of this buffer,
-                                                  from here on we treat its members
-                                                  differently as below:
-                                                      nFilledLen is end offset
-                                                      nOffset as beginning offset */
-            lk.unlock();
-            cv_.notify_one();
-            signal_output();
+        /* the buffers not published go straight back, unless closed */
+        if (0 == buf->nFilledLen) {   /* todo: check for end-of-stream */
+            releaseBuffer(buf);
         }
-        else {   /* return this buffer; todo: check for end-of-stream */
-            omxErr = OMX_FillThisBuffer(source_, buf);
+        else if (!pending_.push(buf)) {
+            QCAM_ERR("more than %d buffers pending, frame dropped",
+                     RTP_PENDING_SIZE);
+            releaseBuffer(buf);
+        }
+        else if (0 == signal_output()) {
+            /* no reader to publish it, keep the ring fresh for the next
+               one. The lock isn't contended without readers */
+            std::unique_lock<std::mutex> lk(lock_);
+            publish_locked();
         }
 
         return omxErr;
@@ -303,38 +1040,152 @@ public:
 
     virtual int openH264Source(UsageEnvironment& env,
         std::shared_ptr<FramedSource>& source_out);
+
+    virtual int openSwitchSource(UsageEnvironment& env,
+        const struct timeval& after,
+        std::shared_ptr<FramedSource>& source_out);
 };
 
+void AccessUnit::release()
+{
+    if (1 == refs_.fetch_sub(1, std::memory_order_acq_rel)) {
+        if (NULL == owner_) {
+            delete this;   /* private copy */
+        }
+        else {   /* stays in the pool until the buffer is filled again */
+            owner_->releaseBuffer(buf_);
+        }
+    }
+}
+
 /**
  Implements a FramedSource contract. In this the data source will pass all the 
  H264 data. Notice the distinction with the \ref PreviewDiscreteSource. 
+
+ Every instance is a reader of the RtpComponent ring with its own cursor. A
+ sink which packetizes the NAL units itself reads them in place, @sa INalUnits
  **/
-class PreviewSource : public FramedSource {
+class PreviewSource : public FramedSource, public IFrameBoundary,
+    public INalUnits, public IReaderStats {
+    friend class Doorbell;
 protected:
     std::shared_ptr<RtpComponent> me_;
+    RingCursor cursor_;
+    std::chrono::steady_clock::time_point opened_;  /* for join latency */
+    bool delivered_ = false;
 
-    EventTriggerId signal_;
     TaskScheduler* task_;
 
-    virtual void deliverFrame() {
+    /* access units delivered in place, @sa INalUnits */
+    bool inPlace_ = false;
+    std::vector<AccessUnitPtr> held_;
+    std::vector<struct iovec> nals_;
+
+    /* capture-to-send latency, for diagnostics */
+    OMX_TICKS lastTs_ = 0;
+    uint32_t latencyCount_ = 0;
+    int64_t latencySum_ = 0;
+    int64_t latencyMax_ = 0;
+
+    /** read the next frame in to fTo */
+    virtual int read() {
+        return me_->getData(cursor_, fTo, fMaxSize, fFrameSize,
+                            fNumTruncatedBytes, fPresentationTime);
+    }
+
+    /** account for the latency once per access unit */
+    void onSend(OMX_TICKS ts) {
+        #define LATENCY_SAMPLING_COUNT 300
+        int64_t us;
+
+        if (ts == lastTs_ || !me_->captureLatency(ts, us)) {
+            return;
+        }
+        lastTs_ = ts;
+
+        latencyCount_++;
+        latencySum_ += us;
+        latencyMax_ = std::max(latencyMax_, us);
+        if (LATENCY_SAMPLING_COUNT == latencyCount_) {
+            QCAM_INFO("reader %p capture-to-send latency avg: %lld us, max: %lld us",
+                      this, (long long)(latencySum_ / latencyCount_),
+                      (long long)latencyMax_);
+            latencyCount_ = 0;
+            latencySum_ = 0;
+            latencyMax_ = 0;
+        }
+    }
+
+    void deliverFrame() {
         if (!isCurrentlyAwaitingData()) {
             // we're not ready for the data yet
             return;
         }
 
-        me_->getData(fTo, fMaxSize, fFrameSize, fNumTruncatedBytes);
-        gettimeofday(&fPresentationTime, NULL);
+        int rc;
+
+        if (inPlace_) {
+            fNumTruncatedBytes = 0;
+            rc = me_->getNalUnits(cursor_, held_, nals_, fFrameSize,
+                                  fPresentationTime);
+        }
+        else {
+            rc = read();
+        }
+
+        if (cursor_.wantSync_) {   /* skipping ahead over the latency budget */
+            cursor_.wantSync_ = false;
+            me_->requestSyncFrame();
+        }
+        if (EAGAIN == rc) {
+            return;   // wait for the next signal
+        }
+        if (0 != rc) {
+            // evicted or the component is closed
+            handleClosure();
+            return;
+        }
+
+        onSend(cursor_.ts_);
+
+        if (!delivered_) {
+            delivered_ = true;
+            QCAM_INFO("first frame to reader %p in %lld ms", this,
+                      (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - opened_).count());
+        }
 
         // inform the reader that the data is written
         FramedSource::afterGetting(this);
     }
 
-    static void deliverFrame0(void* clientData) {
-        ((PreviewSource*)clientData)->deliverFrame();
+public:
+    virtual bool endsFrame() const {
+        return cursor_.endOfFrame_;
     }
 
-public:
-    virtual ~PreviewSource() {}
+    virtual void readInPlace() {
+        inPlace_ = true;
+    }
+
+    virtual const std::vector<struct iovec>& nalUnits() const {
+        return nals_;
+    }
+
+    virtual void getStats(ReaderStats& out) const {
+        out.dropped = cursor_.dropped_;
+        out.resyncs = cursor_.resyncs_;
+        out.overruns = cursor_.overruns_;
+    }
+
+    virtual ~PreviewSource() {
+        me_->detach(this, task_);
+        if (0 != cursor_.dropped_) {
+            QCAM_INFO("reader %p dropped %u access units over the latency budget, "
+                      "%u skips to a sync frame", this, cursor_.dropped_,
+                      cursor_.resyncs_);
+        }
+    }
 
     virtual void doGetNextFrame() {
 
@@ -345,48 +1196,81 @@ public:
 
         // If a new frame of data is immediately available to be delivered,
         // then retrieve now:
-        if (me_->isReadable()) {
+        if (me_->isReadable(cursor_)) {
             deliverFrame();
         }
     }
 
-    PreviewSource(UsageEnvironment& env, std::shared_ptr<RtpComponent> component)
-        : FramedSource(env), me_(component) {
+    /** @param after : @sa RingCursor::after_ */
+    PreviewSource(UsageEnvironment& env, std::shared_ptr<RtpComponent> component,
+                  int64_t after = 0)
+        : FramedSource(env), me_(component),
+          opened_(std::chrono::steady_clock::now()) {
         task_ = &env.taskScheduler();
-        signal_ = task_->createEventTrigger(deliverFrame0);
+        cursor_.after_ = after;
+        me_->attach(this, task_, cursor_);
     }
+};
 
-    static void signal(PreviewSource& me) {
+void Doorbell::handle()
+{
+    std::shared_ptr<Doorbell> self = shared_from_this();  /* a reader may drop the last reference */
+    uint64_t rings = 0;
 
-        if (NULL != me.task_) {
-            me.task_->triggerEvent(me.signal_, &me);
-        }
+    if (sizeof(rings) != read(fd_, &rings, sizeof(rings))) {
+        return;
     }
-};
 
-/** implements deliverFrame() as a single NAL unit fetch */
-class PreviewDiscreteSource : public PreviewSource {
-private:
+    wakeups_++;
+    rings_ += rings;
+    if (DOORBELL_LOG_WAKEUPS == wakeups_) {
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - since_).count();
+
+        QCAM_INFO("doorbell %p: %lld wakeups/s, %.1f buffers per wakeup", this,
+                  (long long)wakeups_ * 1000 / std::max(ms, 1LL),
+                  (double)rings_ / wakeups_);
+        since_ = std::chrono::steady_clock::now();
+        wakeups_ = 0;
+        rings_ = 0;
+    }
 
-    virtual void deliverFrame() {
-        if (!isCurrentlyAwaitingData()) {
-            // we're not ready for the data yet
-            return;
-        }
+    /* whether or not a reader is awaiting data, the buffers are evicted
+       from the ring and go back to the encoder as they are published */
+    std::shared_ptr<RtpComponent> owner = owner_.lock();
+    if (owner) {
+        owner->publish();
+    }
 
-        me_->getOneNalUnit(fTo, fMaxSize, fFrameSize, fNumTruncatedBytes);
-        gettimeofday(&fPresentationTime, NULL);    /*TODO : record the presentation time when encoder
-                                                     gives the buffers. */
+    /* a reader may be closed and removed while delivering */
+    for (auto i = readers_.begin(); i != readers_.end(); i = next_) {
+        next_ = std::next(i);
+        (*i)->deliverFrame();
+    }
+    next_ = readers_.end();
+}
 
-        // inform the reader that the data is written
-        PreviewSource::afterGetting(this);
+/** implements read() as a single NAL unit fetch */
+class PreviewDiscreteSource : public PreviewSource {
+private:
+
+    virtual int read() {
+        return me_->getOneNalUnit(cursor_, fTo, fMaxSize, fFrameSize,
+                                  fNumTruncatedBytes, fPresentationTime);
     }
 
 public:
-    PreviewDiscreteSource(UsageEnvironment& env, std::shared_ptr<RtpComponent> component)
-        : PreviewSource(env, component) {}
+    PreviewDiscreteSource(UsageEnvironment& env, std::shared_ptr<RtpComponent> component,
+                          int64_t after = 0)
+        : PreviewSource(env, component, after) {}
 };
 
+/** live555 media must be closed, rather than deleted */
+static void closeMedium(FramedSource* p)
+{
+    Medium::close(p);
+}
+
 /**
  * This will return a FramedSource instances for use with
  * H264VideoStreamDiscreteFramer as a live source. In this object the
@@ -400,14 +1284,8 @@ public:
  **/
 int RtpComponent::openDiscreteH264Source(UsageEnvironment& env,
     std::shared_ptr<FramedSource>& source_out) {
-    std::shared_ptr<PreviewSource> pout = output_.lock();
-    if (!pout) {
-        pout = std::make_shared<PreviewDiscreteSource>(env, shared_from_this());
-        output_ = pout;
-    }
-
-    source_out = pout;
-
+    source_out.reset(new PreviewDiscreteSource(env, shared_from_this()),
+                     closeMedium);
     return 0;
 }
 
@@ -423,24 +1301,39 @@ int RtpComponent::openDiscreteH264Source(UsageEnvironment& env,
 **/
 int RtpComponent::openH264Source(UsageEnvironment& env,
     std::shared_ptr<FramedSource>& source_out) {
-    std::shared_ptr<PreviewSource> pout = output_.lock();
-    if (!pout) {
-        pout = std::make_shared<PreviewSource>(env, shared_from_this());
-        output_ = pout;
-    }
+    source_out.reset(new PreviewSource(env, shared_from_this()), closeMedium);
+    return 0;
+}
+
+/**
+ This will return a FramedSource instance for a reader switching over from
+ another stream, started at the first sync frame presented after it.
+
+ @param env : live555 Environment
+ @param after : presentation time of the last frame of the other stream
+ @param source_out : FramedSource instance. Follow the shared_ptr ownership
+           policy with this object.
 
-    source_out = pout;
+ @return int : 0 on success
+**/
+int RtpComponent::openSwitchSource(UsageEnvironment& env,
+    const struct timeval& after, std::shared_ptr<FramedSource>& source_out) {
+    int64_t us = (int64_t)after.tv_sec * 1000000 + after.tv_usec;
 
+    source_out.reset(new PreviewDiscreteSource(env, shared_from_this(),
+                                               std::max(us, (int64_t)1)),
+                     closeMedium);
     return 0;
 }
 
-/** notify PreviewSource to doGetNextFrame() */
-void RtpComponent::signal_output(void)
+/** notify every reader to doGetNextFrame(), one wakeup per scheduler */
+size_t RtpComponent::signal_output(void)
 {
-    std::shared_ptr<PreviewSource> pout = output_.lock();
-    if (pout) {
-        PreviewSource::signal(*pout);
+    std::unique_lock<std::mutex> lk(readersLock_);
+    for (std::shared_ptr<Doorbell>& bell : doorbells_) {
+        bell->ring();
     }
+    return doorbells_.size();
 }
 
 int PreviewComponent::create(PreviewParameters& params, PreviewComponentPtr* out)
@@ -30,6 +30,9 @@
 #define __OMXA_PREVIEW_COMPONENT_H__
 
 #include "omx/omx_sink.h"
+#include <vector>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #include "liveMedia.hh"
 #include "BasicUsageEnvironment.hh"
@@ -38,11 +41,91 @@ namespace omxa {
 
 // The following class can be used to define specific encoder parameters
 class PreviewParameters {
+public:
+    unsigned ringSize = 4;        /**< number of recent access units shared by
+                                       the readers. This must be less than the
+                                       encoder output buffer count */
+    unsigned evictOverruns = 8;   /**< a reader lapped by the encoder this many
+                                       times without catching up in between
+                                       is closed */
+    bool sliceMode = false;       /**< the encoder delivers a frame in several
+                                       buffers, the last one is flagged with
+                                       OMX_BUFFERFLAG_ENDOFFRAME */
+    unsigned gopCacheSize = 1 << 20;  /**< octets of the latest group of
+                                       pictures kept for the readers joining
+                                       mid-GOP, 0 disables the cache */
+    bool idrOnJoin = false;       /**< request an IDR frame from the encoder
+                                       when a reader joins and there is no
+                                       sync frame to start it from */
+    unsigned latencyBudgetMs = 0;     /**< a reader this far behind the encoder
+                                       drops the disposable frames, twice as far
+                                       it skips to the next sync frame. 0 for
+                                       no limit */
+    unsigned latencyBudgetBytes = 0;  /**< the same as latencyBudgetMs, in
+                                       octets behind the encoder */
+};
+
+/** H264 parameter sets produced by the encoder, without the start codes */
+struct ParameterSets {
+    std::vector<uint8_t> sps;
+    std::vector<uint8_t> pps;
+
+    bool empty() const { return sps.empty() || pps.empty(); }
 };
 
 class PreviewComponent;
 typedef std::shared_ptr<PreviewComponent> PreviewComponentPtr;
 
+/**
+ Implemented by the FramedSource readers. A frame may span several NAL units
+ (slices), the RTP marker bit belongs to the last one only.
+ **/
+class IFrameBoundary
+{
+public:
+    virtual ~IFrameBoundary() {}
+
+    /** @return bool : true if the NAL unit last delivered ends a frame */
+    virtual bool endsFrame() const = 0;
+};
+
+/**
+ Implemented by the readers which hand out the NAL units in place, straight
+ out of the omx buffers. Once readInPlace() is called, getNextFrame() delivers
+ the next access unit without copying it, and the sink reads its NAL units
+ from nalUnits(). A codec config access unit is delivered along with the
+ frame it precedes.
+ **/
+class INalUnits
+{
+public:
+    virtual ~INalUnits() {}
+
+    /** deliver the access units in place from now on */
+    virtual void readInPlace() = 0;
+
+    /** @return const std::vector<struct iovec>& : the NAL units of the access
+                unit last delivered, without the start codes. They are valid
+                until the next delivery or until the reader is closed */
+    virtual const std::vector<struct iovec>& nalUnits() const = 0;
+};
+
+/** counters of a reader of the ring, for diagnostics */
+struct ReaderStats {
+    uint32_t dropped = 0;    /**< access units dropped over the latency budget */
+    uint32_t resyncs = 0;    /**< skips ahead to the next sync frame */
+    uint32_t overruns = 0;   /**< times the reader was lapped by the encoder */
+};
+
+/** Implemented by the readers of the ring, polled from the reader's thread */
+class IReaderStats
+{
+public:
+    virtual ~IReaderStats() {}
+
+    virtual void getStats(ReaderStats& out) const = 0;
+};
+
 class IPreviewComp
 {
 public:
@@ -50,6 +133,25 @@ public:
     virtual ~IPreviewComp(){};
     virtual int openFramedSource(
         UsageEnvironment& env, std::shared_ptr<FramedSource>& source_out) = 0;
+
+    /**
+     * open a reader switching over to this stream from another one, which it
+     * picks up from at the first sync frame presented after the switch.
+     *
+     * @param after : presentation time of the last frame of the other stream
+     * @param source_out : [out] the reader
+     * @return int : 0 on success
+     **/
+    virtual int openSwitchSource(UsageEnvironment& env,
+        const struct timeval& after, std::shared_ptr<FramedSource>& source_out) = 0;
+
+    /**
+     * get the parameter sets of the stream without waiting for the encoder.
+     *
+     * @param out : [out] the parameter sets
+     * @return int : 0 on success or ENODATA if not yet known.
+     **/
+    virtual int getParameterSets(ParameterSets& out) = 0;
 };
 
 /**
@@ -57,6 +159,23 @@ public:
  * there are two ports. An output port - sink for writing from video encoder. 
  * An input port - FramedSource for retrieving the H264 data. Input port is 
  * designed to be compatible with Live555 source interface.
+ *
+ * The encoded buffers are retained in a ring shared by any number of
+ * FramedSource readers, each reading at its own cursor. A buffer is returned
+ * to the encoder once the last reader is done with it. A reader falling
+ * behind the ring skips ahead to the next sync frame, and is closed when it
+ * keeps falling behind. @sa PreviewParameters
+ *
+ * The access units since the latest sync frame are copied out of the omx
+ * buffers as they are evicted from the ring, a new reader is started at the
+ * sync frame and bursts through the group of pictures to catch up.
+ *
+ * A reader that falls behind the latency budget drops whole frames, the
+ * disposable ones first (nal_ref_idc 0), then everything up to the next sync
+ * frame, which is requested from the encoder.
+ *
+ * The encoder's callback thread hands the buffers over through a lock free
+ * ring, it never contends with the readers for the lock of the shared ring.
  **/
 class PreviewComponent {
 protected:
@@ -71,6 +190,7 @@ public:
      * This will return a FramedSource instances for use with
      * H264VideoStreamDiscreteFramer as a live source. In this object the
      * doGetNextFrame() will fetch one NAL unit at a time without the start code.
+     * Every call returns a new reader of the shared ring.
      *
      * @param env : live555 Environment
      * @param source_out : FramedSource instance. Follow the shared_ptr ownership
@@ -83,7 +203,8 @@ public:
 
     /**
      * This will return a FramedSource instances for use with
-     * H264VideoStreamFramer as a live source.
+     * H264VideoStreamFramer as a live source. Every call returns a new reader
+     * of the shared ring.
      *
      * @param env : live555 Environment
      * @param source_out : FramedSource instance. Follow the shared_ptr ownership
@@ -93,6 +214,35 @@ public:
      **/
     virtual int openH264Source(UsageEnvironment& env,
         std::shared_ptr<FramedSource>& source_out) = 0;
+
+    /**
+     * This will return a FramedSource instance like openDiscreteH264Source(),
+     * for a reader switching over from another stream. It is started at the
+     * first sync frame presented after the other stream left off, which is
+     * requested from the encoder, rather than from the cached group of
+     * pictures. The parameter sets are given in-band ahead of it.
+     *
+     * @param env : live555 Environment
+     * @param after : presentation time of the last frame of the other stream
+     * @param source_out : FramedSource instance. Follow the shared_ptr ownership
+     *           policy with this object.
+     *
+     * @return int : 0 on success
+     **/
+    virtual int openSwitchSource(UsageEnvironment& env,
+        const struct timeval& after,
+        std::shared_ptr<FramedSource>& source_out) = 0;
+
+    /**
+     * get the parameter sets captured from the codec config buffer of the
+     * encoder (OMX_BUFFERFLAG_CODECCONFIG). This never blocks.
+     *
+     * @param out : [out] the parameter sets
+     *
+     * @return int : 0 on success or ENODATA if the encoder is yet to produce
+     *           the codec config.
+     **/
+    virtual int getParameterSets(ParameterSets& out) = 0;
 };
 }
 #endif /* !__OMXA_PREVIEW_COMPONENT_H__ */
@@ -0,0 +1,96 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __OMXA_SPSC_RING_H__
+#define __OMXA_SPSC_RING_H__
+
+#include <atomic>
+#include <stdint.h>
+
+namespace omxa {
+
+#define SPSC_CACHE_LINE 64
+
+/**
+ A fixed capacity ring handing items from a single producer thread to a
+ single consumer thread. It never blocks nor allocates. The producer and the
+ consumer indices are on separate cache lines to avoid false sharing.
+
+ The consumer may be any thread as long as the consumers are serialized,
+ e.g. by a mutex held while calling pop().
+
+ @param T : trivially copyable item, e.g. a buffer descriptor
+ @param N : capacity, a power of two
+ **/
+template <typename T, uint32_t N>
+class SpscRing {
+    static_assert(0 != N && 0 == (N & (N - 1)), "capacity must be a power of two");
+
+    std::atomic<uint32_t> head_;   /* next slot to push, owned by the producer */
+    char padHead_[SPSC_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> tail_;   /* next slot to pop, owned by the consumer */
+    char padTail_[SPSC_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+    T items_[N];
+
+public:
+    SpscRing() : head_(0), tail_(0) {}
+    SpscRing(const SpscRing&) = delete;
+    const SpscRing& operator =(const SpscRing&) = delete;
+
+    /** @return bool : false when the ring is full, called by the producer */
+    bool push(const T& item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+
+        if (N == head - tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);  /* publish the item */
+        return true;
+    }
+
+    /** @return bool : false when the ring is empty, called by the consumer */
+    bool pop(T& item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);  /* free the slot */
+        return true;
+    }
+
+    bool empty() const {
+        return tail_.load(std::memory_order_acquire)
+            == head_.load(std::memory_order_acquire);
+    }
+};
+
+} /* namespace omxa */
+#endif /* !__OMXA_SPSC_RING_H__ */
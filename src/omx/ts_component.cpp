@@ -0,0 +1,492 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "omx/ts_component.h"
+#include "omx/nal_scan.h"
+#include "qcamvid_log.h"
+#include <vector>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace omxa;
+
+#define TS_PACKET_SIZE 188
+#define TS_PAYLOAD_SIZE (TS_PACKET_SIZE - 4)
+#define TS_PACKETS_PER_DATAGRAM 7   /* 1316 octets, fits the ethernet mtu */
+
+#define TS_PID_PAT 0x0000
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x0100   /* also carries the PCR */
+#define TS_STREAM_TYPE_H264 0x1b
+
+#define TS_PSI_INTERVAL_US 100000   /* longest gap between the PAT/PMT */
+#define TS_PCR_SIZE 8               /* adaptation field with just a PCR */
+#define TS_PES_HEADER_SIZE 14       /* with a PTS */
+#define TS_SNDBUF_SIZE (512 * 1024)
+#define TS_LOG_INTERVAL_US 10000000
+
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_AUD 9
+
+/* access unit delimiter, any primary_pic_type */
+static const uint8_t AUD[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xf0 };
+
+/* crc of the PSI sections, msb first without the final xor */
+static uint32_t crc32Mpeg(const uint8_t* p, size_t size)
+{
+    uint32_t crc = 0xffffffff;
+
+    while (size--) {
+        crc ^= (uint32_t)*p++ << 24;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* a TS packet carrying the whole section, the continuity counter is left 0 */
+static void putPsiPacket(uint8_t* pkt, unsigned pid, const uint8_t* section,
+                         size_t size)
+{
+    uint32_t crc = crc32Mpeg(section, size);
+    uint8_t* p = pkt + 5;
+
+    memset(pkt, 0xff, TS_PACKET_SIZE);
+    pkt[0] = 0x47;
+    pkt[1] = 0x40 | (pid >> 8);   /* payload_unit_start_indicator */
+    pkt[2] = pid & 0xff;
+    pkt[3] = 0x10;                /* payload only */
+    pkt[4] = 0;                   /* pointer_field */
+    memcpy(p, section, size);
+    p += size;
+    *p++ = crc >> 24;
+    *p++ = crc >> 16;
+    *p++ = crc >> 8;
+    *p++ = crc;
+}
+
+/* 33 bits of the 90kHz clock */
+static uint64_t clock90k(int64_t us)
+{
+    return ((uint64_t)us * 9 / 100) & 0x1ffffffffULL;
+}
+
+/* @return int : type of the first nal unit in the range, -1 if none */
+static int firstNalType(const uint8_t* p, size_t size)
+{
+    const uint8_t* end = p + size;
+
+    p = findStartCode(p, end);
+    return (p + 3 < end) ? (p[3] & 0x1f) : -1;
+}
+
+class omxa::OmxTsSink : public OmxSink {
+    friend class TsComponent;
+
+    /** a part of the elementary stream of an access unit */
+    struct Span {
+        const uint8_t* p;
+        size_t size;
+    };
+
+    enum { CC_PAT, CC_PMT, CC_VIDEO, CC_COUNT };
+
+    int fd_ = -1;            /**< udp socket connected to the destination */
+    std::string dest_;       /**< address:port, for the logs */
+    int64_t delayUs_ = 0;    /**< @sa TsParameters::delayMs */
+    bool sliceMode_ = false;
+    uint8_t cc_[CC_COUNT];   /**< continuity counters by pid */
+    uint8_t pat_[TS_PACKET_SIZE];
+    uint8_t pmt_[TS_PACKET_SIZE];
+    uint8_t pes_[TS_PES_HEADER_SIZE + sizeof(AUD)];  /**< of the current access unit */
+    std::vector<uint8_t> config_;     /**< SPS and PPS of the encoder, with start codes */
+    bool frameStart_ = true;          /**< the next buffer starts an access unit */
+    bool psiSent_ = false;
+    int64_t psiTs_ = 0;               /**< when the PAT/PMT were last sent */
+
+    /* the packets of a buffer, the headers are written aside and the payload
+       is sent from the omx buffer in place */
+    std::vector<uint8_t> headers_;    /**< TS headers and adaptation fields */
+    std::vector<struct iovec> iov_;
+    std::vector<size_t> packets_;     /**< index of the first iovec of each packet */
+    std::vector<struct mmsghdr> msgs_;
+
+    uint64_t datagrams_ = 0;          /**< sent since the sink was opened */
+    uint64_t dropped_ = 0;            /**< datagrams the kernel didn't take */
+    int64_t logged_ = 0;              /**< when the statistics were last logged */
+
+    uint8_t nextCc(int i) {
+        return cc_[i]++ & 0x0f;
+    }
+
+    void addPsi(uint8_t* pkt, int cc) {
+        pkt[3] = 0x10 | nextCc(cc);
+        packets_.push_back(iov_.size());
+        iov_.push_back({pkt, TS_PACKET_SIZE});
+    }
+
+    /** PES header with the PTS and an access unit delimiter unless the
+        encoder put one. @return size_t : octets at pes_ */
+    size_t putPesHeader(int64_t ts, bool aud) {
+        uint64_t pts = clock90k(ts + delayUs_);
+        uint8_t* p = pes_;
+
+        *p++ = 0x00;
+        *p++ = 0x00;
+        *p++ = 0x01;
+        *p++ = 0xe0;   /* video stream 0 */
+        *p++ = 0x00;   /* unbounded PES_packet_length */
+        *p++ = 0x00;
+        *p++ = 0x80;
+        *p++ = 0x80;   /* PTS only */
+        *p++ = 5;
+        *p++ = 0x21 | ((pts >> 29) & 0x0e);
+        *p++ = pts >> 22;
+        *p++ = ((pts >> 14) & 0xfe) | 1;
+        *p++ = pts >> 7;
+        *p++ = ((pts << 1) & 0xfe) | 1;
+        if (aud) {
+            memcpy(p, AUD, sizeof(AUD));
+            p += sizeof(AUD);
+        }
+        return p - pes_;
+    }
+
+    static void putPcr(uint8_t* p, int64_t ts) {
+        uint64_t pcr = (uint64_t)ts * 27;   /* 27MHz */
+        uint64_t base = (pcr / 300) & 0x1ffffffffULL;
+        unsigned ext = pcr % 300;
+
+        *p++ = base >> 25;
+        *p++ = base >> 17;
+        *p++ = base >> 9;
+        *p++ = base >> 1;
+        *p++ = ((base & 1) << 7) | 0x7e | (ext >> 8);
+        *p++ = ext;
+    }
+
+    /**
+     Cut the spans in to TS packets of the video pid. The first packet of an
+     access unit starts the PES packet and carries the PCR, the last one is
+     stuffed to size with its adaptation field.
+     **/
+    void packetize(const Span* spans, int n, bool start, bool sync, int64_t ts) {
+        size_t total = 0;
+        size_t count;
+        size_t off = 0;
+        int i = 0;
+
+        for (int k = 0; k < n; k++) {
+            total += spans[k].size;
+        }
+        count = (total + TS_PCR_SIZE + TS_PAYLOAD_SIZE - 1) / TS_PAYLOAD_SIZE;
+        if (headers_.size() < count * TS_PACKET_SIZE) {
+            headers_.resize(count * TS_PACKET_SIZE);
+        }
+
+        for (uint8_t* h = headers_.data(); 0 < total; h += TS_PACKET_SIZE) {
+            bool pcr = start && h == headers_.data();
+            size_t take = std::min(total, (size_t)TS_PAYLOAD_SIZE
+                                   - (pcr ? TS_PCR_SIZE : 0));
+            size_t af = TS_PAYLOAD_SIZE - take;   /* adaptation field octets */
+
+            h[0] = 0x47;
+            h[1] = (pcr ? 0x40 : 0) | (TS_PID_VIDEO >> 8);
+            h[2] = TS_PID_VIDEO & 0xff;
+            h[3] = (0 < af ? 0x30 : 0x10) | nextCc(CC_VIDEO);
+            if (0 < af) {
+                h[4] = af - 1;
+            }
+            if (1 < af) {
+                uint8_t* q = h + 6;
+
+                h[5] = 0;
+                if (pcr) {
+                    h[5] = (sync ? 0x40 : 0) | 0x10;   /* random access, PCR */
+                    putPcr(q, ts);
+                    q += 6;
+                }
+                memset(q, 0xff, h + 4 + af - q);   /* stuffing */
+            }
+
+            packets_.push_back(iov_.size());
+            iov_.push_back({h, 4 + af});
+            total -= take;
+
+            /* the payload may straddle the spans */
+            while (0 < take) {
+                size_t m = std::min(take, spans[i].size - off);
+
+                iov_.push_back({(void*)(spans[i].p + off), m});
+                take -= m;
+                off += m;
+                if (off == spans[i].size) {
+                    i++;
+                    off = 0;
+                }
+            }
+        }
+    }
+
+    /** send the packets 7 a datagram, the ones the kernel doesn't take are
+        dropped rather than holding up the encoder */
+    void transmit() {
+        size_t packets = packets_.size();
+        size_t count = (packets + TS_PACKETS_PER_DATAGRAM - 1) / TS_PACKETS_PER_DATAGRAM;
+        size_t sent = 0;
+
+        packets_.push_back(iov_.size());
+        msgs_.resize(count);
+        for (size_t d = 0; d < count; d++) {
+            size_t first = packets_[d * TS_PACKETS_PER_DATAGRAM];
+            size_t last = packets_[std::min(packets, (d + 1) * TS_PACKETS_PER_DATAGRAM)];
+
+            memset(&msgs_[d], 0, sizeof(msgs_[d]));
+            msgs_[d].msg_hdr.msg_iov = &iov_[first];
+            msgs_[d].msg_hdr.msg_iovlen = last - first;
+        }
+
+        while (sent < count) {
+            int rc = sendmmsg(fd_, &msgs_[sent], count - sent, MSG_DONTWAIT);
+
+            if (0 <= rc) {
+                sent += rc;
+            }
+            else if (EINTR != errno) {
+                if (0 == dropped_) {
+                    QCAM_ERR("mpegts to %s failed: %d", dest_.c_str(), errno);
+                }
+                dropped_ += count - sent;
+                break;
+            }
+        }
+        datagrams_ += sent;
+    }
+
+    /** a buffer of the encoder, a whole access unit or a slice of it */
+    void send(const uint8_t* data, size_t size, OMX_U32 flags, int64_t ts) {
+        bool start = frameStart_;
+        bool sync = start && 0 != (flags & OMX_BUFFERFLAG_SYNCFRAME);
+        Span spans[3];
+        int n = 0;
+
+        frameStart_ = !sliceMode_ || 0 != (flags & OMX_BUFFERFLAG_ENDOFFRAME);
+
+        iov_.clear();
+        packets_.clear();
+
+        if (start && (sync || !psiSent_ || TS_PSI_INTERVAL_US <= ts - psiTs_)) {
+            addPsi(pat_, CC_PAT);
+            addPsi(pmt_, CC_PMT);
+            psiSent_ = true;
+            psiTs_ = ts;
+        }
+
+        if (start) {
+            int nal = firstNalType(data, size);
+
+            spans[n].p = pes_;
+            spans[n++].size = putPesHeader(ts, NAL_TYPE_AUD != nal);
+
+            /* a decoder joining at this frame needs the parameter sets */
+            if (sync && NAL_TYPE_SPS != nal && NAL_TYPE_AUD != nal
+                && !config_.empty()) {
+                spans[n].p = config_.data();
+                spans[n++].size = config_.size();
+            }
+        }
+        spans[n].p = data;
+        spans[n++].size = size;
+
+        packetize(spans, n, start, sync, ts);
+        transmit();
+
+        if (TS_LOG_INTERVAL_US <= ts - logged_) {
+            QCAM_INFO("mpegts to %s: %llu datagrams, %llu dropped",
+                      dest_.c_str(), (unsigned long long)datagrams_,
+                      (unsigned long long)dropped_);
+            logged_ = ts;
+        }
+    }
+
+    int open(OMX_HANDLETYPE hComponent, const TsParameters& params) {
+        std::unique_lock<std::mutex> lk(lock_);
+        struct sockaddr_in addr;
+        int sndbuf = TS_SNDBUF_SIZE;
+        int ttl = params.ttl;
+        int rc = 0;
+
+        close_locked();
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(params.port);
+        if (0 == inet_aton(params.address.c_str(), &addr.sin_addr)) {
+            return EINVAL;
+        }
+
+        fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (-1 == fd_) {
+            return errno;
+        }
+        (void)setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr))) {
+            (void)setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        }
+
+        /* connected, the route isn't looked up for every datagram */
+        if (0 != connect(fd_, (struct sockaddr*)&addr, sizeof(addr))) {
+            rc = errno;
+            close_locked();
+            return rc;
+        }
+
+        source_ = hComponent;
+        dest_ = params.address + ":" + std::to_string(params.port);
+        delayUs_ = (int64_t)params.delayMs * 1000;
+        sliceMode_ = params.sliceMode;
+        memset(cc_, 0, sizeof(cc_));
+        datagrams_ = 0;
+        dropped_ = 0;
+        logged_ = 0;
+
+        QCAM_INFO("mpegts to %s", dest_.c_str());
+        return 0;
+    }
+
+    void close_locked(void) {
+        if (-1 != fd_) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        source_ = NULL;
+        frameStart_ = true;
+        psiSent_ = false;
+    }
+
+public:
+    OmxTsSink() {
+        static const uint8_t pat[] = {
+            0x00, 0xb0, 0x0d,   /* table_id, section_length */
+            0x00, 0x01,         /* transport_stream_id */
+            0xc1, 0x00, 0x00,   /* version 0, current */
+            0x00, 0x01,         /* program_number */
+            0xe0 | (TS_PID_PMT >> 8), TS_PID_PMT & 0xff,
+        };
+        static const uint8_t pmt[] = {
+            0x02, 0xb0, 0x12,   /* table_id, section_length */
+            0x00, 0x01,         /* program_number */
+            0xc1, 0x00, 0x00,   /* version 0, current */
+            0xe0 | (TS_PID_VIDEO >> 8), TS_PID_VIDEO & 0xff,   /* PCR_PID */
+            0xf0, 0x00,         /* program_info_length */
+            TS_STREAM_TYPE_H264,
+            0xe0 | (TS_PID_VIDEO >> 8), TS_PID_VIDEO & 0xff,
+            0xf0, 0x00,         /* ES_info_length */
+        };
+
+        putPsiPacket(pat_, TS_PID_PAT, pat, sizeof(pat));
+        putPsiPacket(pmt_, TS_PID_PMT, pmt, sizeof(pmt));
+        memset(cc_, 0, sizeof(cc_));
+    }
+
+    virtual void close() {
+        std::unique_lock<std::mutex> lk(lock_);
+        close_locked();
+    }
+
+    virtual ~OmxTsSink() { close(); }
+
+    virtual bool isOpen() {
+        return -1 != fd_;
+    }
+
+    /**
+     Send the buffer and return it to the encoder, on the encoder's callback
+     thread. The parameter sets are kept for the sync frames.
+     @param buf
+     **/
+    virtual OMX_ERRORTYPE emptyBuffer(OMX_BUFFERHEADERTYPE* pBuffer) {
+        std::unique_lock<std::mutex> lk(lock_);
+        OMX_HANDLETYPE source = source_;
+        const uint8_t* data = pBuffer->pBuffer + pBuffer->nOffset;
+
+        if (NULL == source) {
+            return OMX_ErrorIncorrectStateOperation;
+        }
+
+        if (0 != (pBuffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG)) {
+            config_.assign(data, data + pBuffer->nFilledLen);
+        }
+        else if (0 != pBuffer->nFilledLen) {
+            send(data, pBuffer->nFilledLen, pBuffer->nFlags, pBuffer->nTimeStamp);
+        }
+        lk.unlock();
+
+        return OMX_FillThisBuffer(source, pBuffer);
+    }
+};
+
+TsComponent::~TsComponent(){}
+
+int TsComponent::init(const TsParameters& params)
+{
+    struct in_addr addr;
+
+    if (0 == params.port || 65535 < params.port
+        || 0 == inet_aton(params.address.c_str(), &addr)) {
+        return EINVAL;
+    }
+    params_ = params;
+
+    sink_ = std::make_shared<OmxTsSink>();
+    return 0;
+}
+
+int TsComponent::openOMXSink(OMX_HANDLETYPE hComponent, OmxSinkPtr* ppout)
+{
+    int nret = 0;
+    if (sink_->isOpen()) {
+        return EALREADY;
+    }
+
+    nret = sink_->open(hComponent, params_);
+    if (0 == nret) {
+        *ppout = sink_;
+    }
+
+    return nret;
+}
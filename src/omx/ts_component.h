@@ -0,0 +1,79 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __OMXA_TS_COMPONENT_H__
+#define __OMXA_TS_COMPONENT_H__
+
+#include "omx/omx_sink.h"
+#include <string>
+#include "OMX_Core.h"
+#include "OMX_Component.h"
+
+namespace omxa {
+
+#define TS_DEFAULT_DELAY_MS 60   /* decoder buffering ahead of the PCR */
+
+/** Destination of a MPEG-TS stream over UDP */
+class TsParameters {
+public:
+    std::string address;          /**< unicast or multicast IPv4 destination */
+    unsigned port = 0;            /**< udp port of the destination */
+    unsigned ttl = 1;             /**< of the datagrams to a multicast group */
+    unsigned delayMs = TS_DEFAULT_DELAY_MS;  /**< presentation time stamps
+                                       ahead of the PCR, the time the decoder
+                                       buffers a frame for */
+    bool sliceMode = false;       /**< the encoder delivers a frame in several
+                                       buffers, the last one is flagged with
+                                       OMX_BUFFERFLAG_ENDOFFRAME */
+};
+
+class OmxTsSink;
+/*******************************************************************************
+ * A bridge between the OpenMax video encoder and a MPEG-TS receiver over UDP.
+ *
+ * Each buffer of the encoder is cut in to 188 octets TS packets in place, on
+ * the encoder's callback thread, and sent 7 packets a datagram with a single
+ * sendmmsg() before the buffer is returned. An access unit is a PES packet of
+ * the video pid, its first TS packet carries the PCR, both the PCR and the PTS
+ * are derived from the nTimeStamp of the buffer. The PAT and the PMT are sent
+ * ahead of every sync frame and at least every 100ms, along with the SPS and
+ * the PPS when the encoder sent them only once.
+ ******************************************************************************/
+class TsComponent {
+    TsParameters params_;
+    std::shared_ptr<OmxTsSink> sink_;
+
+public:
+    TsComponent() {}
+    virtual ~TsComponent();
+    int init(const TsParameters& params);
+    int openOMXSink(OMX_HANDLETYPE hComponent, OmxSinkPtr* ppout);
+};
+
+}
+#endif /* !__OMXA_TS_COMPONENT_H__ */
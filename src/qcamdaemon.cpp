@@ -59,12 +59,15 @@
 #include <assert.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <sys/time.h>
 
 #include "camerad.h"
 #include "camerad_util.h"
 #include "qcamvid_log.h"
 #include "qcamvid_session.h"
 #include "fpv_server.h"
+#include "fpv_h264.h"
 
 #include "json/json_parser.h"
 
@@ -86,6 +89,7 @@ class QCamDaemon {
     int current_client_ = -1;
     std::shared_ptr<ISession> recSession_ = NULL;   /* video recording session */
     FpvServer* fpv_ = NULL;         /* fpv task */
+    std::map<std::string, std::shared_ptr<ISession>> tsSessions_;  /* mpegts sessions by name */
 
     DaemonConfig cfg_;
     bool stop_ = false;
@@ -126,23 +130,180 @@ class QCamDaemon {
     }
 
     void camera_rtsp_start(unsigned int uid, const char* params, int param_siz) {
+        int rc = 0;
+        bool created = false;
+
         if (0 == fpv_) {
-            fpv_ = new FpvServer();
-            fpv_->start("wlan0");   /* TODO: get the iface name from config */
+            fpv_ = new FpvServer(cfg_.rtspThreads, cfg_.rtpPacing, cfg_.httpPort,
+                                 cfg_.rtpTxtime);
+            created = true;
+            TRY(rc, fpv_->start("wlan0"));   /* TODO: get the iface name from config */
         }
-        else {
-            /* respond with error */
-            jsResult_Send(current_client_, uid, EALREADY);
-            return;
+
+        /* each start publishes an additional mount point, EEXIST when the
+           mount point is already published */
+        TRY(rc, fpv_->addSession(uid, params, param_siz));
+
+        CATCH(rc) {
+            /* a server just created and serving no mount point is of no use,
+               the next start creates another one */
+            if (created) {
+                fpv_->stop();
+                delete fpv_; fpv_ = 0;
+            }
         }
 
-        /* TODO: error checking */
-        fpv_->addSession(uid, params, param_siz);
+        jsResult_Send(current_client_, uid, rc);
     }
 
     void camera_rtsp_stop(unsigned int uid, const char* params, int param_siz) {
-        fpv_->stop();
-        delete fpv_; fpv_ = 0;
+        int rc = 0;
+        bool named = (FpvServer::mountName(params, param_siz) != FPV_DEFAULT_MOUNT);
+
+        if (0 == fpv_) {
+            THROW(rc, ENOENT);
+        }
+
+        /* withdraw just the named mount point */
+        if (named) {
+            TRY(rc, fpv_->removeSession(uid, params, param_siz));
+        }
+
+        /* shutdown the server along with the last mount point */
+        if (!named || 0 == fpv_->sessionCount()) {
+            fpv_->stop();
+            delete fpv_; fpv_ = 0;
+        }
+
+        CATCH(rc) {}
+
+        jsResult_Send(current_client_, uid, rc);
+    }
+
+    void camera_mpegts_start(unsigned int uid, const char* params, int param_siz) {
+        std::shared_ptr<ISession> session;
+        std::string name;
+        unsigned int id;
+        JSONParser js;
+        int rc = 0;
+
+        /* the destination is in the named session of camerad.json */
+        if (!FpvServer::parseMount(params, param_siz, id, name)) {
+            THROW(rc, EINVAL);
+        }
+        name = FpvServer::mountName(params, param_siz);
+        if (0 != tsSessions_.count(name)) {
+            THROW(rc, EEXIST);
+        }
+
+        session = SessionMgr::get(QCAM_SESSION_MPEGTS, name);
+        if (NULL == session) {
+            THROW(rc, ENOMEM);
+        }
+        JSONParser_Ctor(&js, params, param_siz);
+        TRY(rc, session->setConfig(js));
+        TRY(rc, session->start());
+
+        tsSessions_[name] = session;
+
+        CATCH(rc) {}
+
+        jsResult_Send(current_client_, uid, rc);
+    }
+
+    void camera_mpegts_stop(unsigned int uid, const char* params, int param_siz) {
+        auto i = tsSessions_.find(FpvServer::mountName(params, param_siz));
+        int rc = 0;
+
+        if (i == tsSessions_.end()) {
+            THROW(rc, ENOENT);
+        }
+        rc = i->second->stop();
+        tsSessions_.erase(i);
+
+        CATCH(rc) {}
+
+        jsResult_Send(current_client_, uid, rc);
+    }
+
+    /* times are in milliseconds of the wall clock */
+    static void putClientStats(JSONGen* gen, const ClientStats& cs) {
+        JSONGen_BeginObject(gen);
+        JSONGen_PutKey(gen, "mount", 0);
+        JSONGen_PutString(gen, cs.mount.c_str(), 0);
+        JSONGen_PutKey(gen, "session", 0);
+        JSONGen_PutUInt(gen, cs.session);
+        JSONGen_PutKey(gen, "address", 0);
+        JSONGen_PutString(gen, cs.address.c_str(), 0);
+        JSONGen_PutKey(gen, "port", 0);
+        JSONGen_PutUInt(gen, cs.port);
+        JSONGen_PutKey(gen, "transport", 0);
+        JSONGen_PutString(gen, cs.tcp ? "tcp" : "udp", 0);
+        JSONGen_PutKey(gen, "since", 0);
+        jsGen_PutUInt64(gen, cs.since / 1000);
+        JSONGen_PutKey(gen, "packets", 0);
+        jsGen_PutUInt64(gen, cs.packets);
+        JSONGen_PutKey(gen, "octets", 0);
+        jsGen_PutUInt64(gen, cs.octets);
+        JSONGen_PutKey(gen, "failed", 0);
+        jsGen_PutUInt64(gen, cs.failed);
+        JSONGen_PutKey(gen, "queue", 0);
+        JSONGen_PutInt(gen, cs.queue);
+        JSONGen_PutKey(gen, "loss", 0);
+        JSONGen_PutDouble(gen, cs.fractionLost);
+        JSONGen_PutKey(gen, "jitter", 0);
+        JSONGen_PutUInt(gen, cs.jitterMs);
+        JSONGen_PutKey(gen, "rtt", 0);
+        JSONGen_PutUInt(gen, cs.rttMs);
+        JSONGen_PutKey(gen, "reported", 0);
+        jsGen_PutUInt64(gen, cs.reported / 1000);
+        JSONGen_PutKey(gen, "dropped", 0);
+        JSONGen_PutUInt(gen, cs.dropped);
+        JSONGen_PutKey(gen, "resyncs", 0);
+        JSONGen_PutUInt(gen, cs.resyncs);
+        JSONGen_PutKey(gen, "overruns", 0);
+        JSONGen_PutUInt(gen, cs.overruns);
+        JSONGen_PutKey(gen, "layer", 0);
+        JSONGen_PutUInt(gen, cs.layer);
+        JSONGen_PutKey(gen, "time", 0);
+        jsGen_PutUInt64(gen, cs.time / 1000);
+        JSONGen_EndObject(gen);
+    }
+
+    void camera_rtsp_stats(unsigned int uid, const char* params, int param_siz) {
+        std::vector<ClientStats> clients;
+        struct timeval now;
+        JSONGen gen;
+        char buf[512];
+        const char* psz;
+        int nsize = sizeof(buf);
+
+        if (0 == fpv_) {
+            jsResult_Send(current_client_, uid, ENOENT);
+            return;
+        }
+        fpv_->getStats(clients);
+        gettimeofday(&now, NULL);
+
+        JSONGen_Ctor(&gen, buf, nsize, jsGen_Realloc, 0);
+        JSONGen_BeginObject(&gen);
+        JSONGen_PutKey(&gen, "time", 0);
+        jsGen_PutUInt64(&gen, (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000);
+        JSONGen_PutKey(&gen, "clients", 0);
+        JSONGen_BeginArray(&gen);
+        for (auto& i : clients) {
+            putClientStats(&gen, i);
+        }
+        JSONGen_EndArray(&gen);
+        JSONGen_EndObject(&gen);
+
+        if (JSONGEN_SUCCESS == JSONGen_GetJSON(&gen, &psz, &nsize)) {
+            jsResult_SendJSON(current_client_, uid, psz, nsize);
+        }
+        else {
+            jsResult_Send(current_client_, uid, ENOMEM);
+        }
+        JSONGen_Dtor(&gen);
     }
 
 public:
@@ -159,12 +320,16 @@ public:
             requests_.insert(std::make_pair("camera.recording.stop",  &QCamDaemon::camera_recording_stop));
             requests_.insert(std::make_pair("camera.rtsp.start",      &QCamDaemon::camera_rtsp_start));
             requests_.insert(std::make_pair("camera.rtsp.stop",       &QCamDaemon::camera_rtsp_stop));
+            requests_.insert(std::make_pair("camera.rtsp.stats",      &QCamDaemon::camera_rtsp_stats));
+            requests_.insert(std::make_pair("camera.mpegts.start",    &QCamDaemon::camera_mpegts_start));
+            requests_.insert(std::make_pair("camera.mpegts.stop",     &QCamDaemon::camera_mpegts_stop));
         }
         return rc;
     }
 
     void final(void) {
         recSession_.reset();
+        tsSessions_.clear();
         if (-1 != sock_) {close(sock_); sock_ = -1; }
     }
 
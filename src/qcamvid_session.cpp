@@ -39,7 +39,9 @@
 #include "omx/file_component.h"
 #include "omx/encoder_component.h"
 #include "omx/preview_component.h"
+#include "omx/ts_component.h"
 #include <media/hardware/HardwareAPI.h>
+#include <arpa/inet.h>
 #include <memory>
 #include <atomic>
 
@@ -66,6 +68,7 @@ class VSession : public ISession {
 protected:
     /* General VSession Vars */
     SessionConfig mConfig;
+    SessionConfig mConfigured;   /* as configured, a layer is derived from it */
     omx::video::encoder::EncoderConfigType encoderConfig_ = {
         .eCodec = OMX_VIDEO_CodingAVC,
         .eCodecProfile = omx::video::encoder::AVCProfileHigh,
@@ -95,6 +98,7 @@ protected:
         .bExtradata = OMX_FALSE,
         .nIDRPeriod = 0,
         .nHierPNumLayers = 0,
+        .bSliceDelivery = OMX_FALSE,
         .nHECInterval = 0,
         .nTimeIncRes = 30,
         .bEnableShortHeader = OMX_FALSE,
@@ -133,6 +137,7 @@ protected:
     omxa::BufferPoolPtr output_;
 
     omxa::OmxSinkPtr  outputComponent_;
+    RateController rate_;   /* adapts the bitrate to the reception reports */
 
     /* Camera Vars */
     omxa::OmxDrainPtr inputComponent_;
@@ -216,11 +221,59 @@ public:
     virtual int stop();
     virtual void setConfig(const SessionConfig& config) {
         mConfig = config;
+        mConfigured = config;
     }
     virtual void setConfig(const H264Config& config) {
     }
     virtual int setConfig(JSONParser& js) {
         JSONID res_arr_val;
+        JSONID id_val;
+        JSONID slice_val;
+        JSONID bitrate_val;
+        JSONID range_arr_val;
+        JSONID gop_val;
+        JSONID idr_val;
+        JSONID budget_val;
+        unsigned int id;
+        unsigned int slice;
+        unsigned int bitrate;
+        unsigned int gop;
+        unsigned int budget;
+        int idr;
+
+        /* over the configuration, not over a layer derived from it */
+        mConfig = mConfigured;
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "id", 0, &id_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, id_val, &id)) {
+            mConfig.cameraId = (int)id;
+        }
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "slice", 0, &slice_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, slice_val, &slice)) {
+            mConfig.enc.sliceMbs = slice;
+        }
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "gop", 0, &gop_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, gop_val, &gop)
+            && 0 < gop) {
+            mConfig.enc.intraPeriod = gop;
+        }
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "idr-on-join", 0, &idr_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetBool(&js, idr_val, &idr)) {
+            mConfig.enc.idrOnJoin = (0 != idr);
+        }
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "latency-budget", 0, &budget_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, budget_val, &budget)) {
+            mConfig.enc.latencyBudgetMs = budget;
+        }
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "latency-budget-bytes", 0, &budget_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, budget_val, &budget)) {
+            mConfig.enc.latencyBudgetBytes = budget;
+        }
 
         if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "resolution", 0,
                                                     &res_arr_val)) {
@@ -240,8 +293,104 @@ public:
             mConfig.height = height;
         }
 
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "bitrate", 0, &bitrate_val)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, bitrate_val, &bitrate)) {
+            mConfig.enc.bitRate = bitrate;
+        }
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "bitrate-range", 0,
+                                                    &range_arr_val)) {
+            JSONID min_val;
+            JSONID max_val;
+            unsigned int min;
+            unsigned int max;
+
+            if (JSONPARSER_SUCCESS == JSONParser_ArrayLookup(&js, range_arr_val, 0, &min_val)
+                && JSONPARSER_SUCCESS == JSONParser_ArrayLookup(&js, range_arr_val, 1, &max_val)
+                && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, min_val, &min)
+                && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, max_val, &max)) {
+                mConfig.enc.minBitRate = min;
+                mConfig.enc.maxBitRate = max;
+            }
+        }
+
+        /* "layers" : [[width, height, bitrate], ...] */
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "layers", 0,
+                                                    &range_arr_val)) {
+            JSONID layer_val;
+            JSONID val;
+            unsigned int v[3];
+
+            mConfig.layers.clear();
+            for (int i = 0; i < SESSION_MAX_LAYERS
+                 && JSONPARSER_SUCCESS == JSONParser_ArrayLookup(
+                     &js, range_arr_val, i, &layer_val); i++) {
+                LayerConfig layer;
+                int j;
+
+                for (j = 0; j < 3; j++) {
+                    if (JSONPARSER_SUCCESS != JSONParser_ArrayLookup(&js, layer_val, j, &val)
+                        || JSONPARSER_SUCCESS != JSONParser_GetUInt(&js, val, &v[j])
+                        || 0 == v[j]) {
+                        break;
+                    }
+                }
+                if (3 != j) {
+                    QCAM_ERR("invalid layer %d ignored", i + 1);
+                    break;
+                }
+                layer.width = v[0];
+                layer.height = v[1];
+                layer.bitRate = v[2];
+                mConfig.layers.push_back(layer);
+            }
+        }
+
+        mConfigured = mConfig;
+        return 0;
+    }
+
+    virtual int setLayer(unsigned layer) {
+        if (mConfigured.layers.size() < layer) {
+            return EINVAL;
+        }
+
+        /* derived from the configuration every time, the session is set
+           up again on every start */
+        mConfig = mConfigured;
+
+        /* the clients switch layers instead of the bitrate adapting */
+        mConfig.layer = layer;
+        if (0 < layer) {
+            const LayerConfig& l = mConfig.layers[layer - 1];
+
+            if (mConfig.width < l.width || mConfig.height < l.height) {
+                return EINVAL;   /* scaled down only */
+            }
+            mConfig.sourceWidth = mConfig.width;
+            mConfig.sourceHeight = mConfig.height;
+            mConfig.width = l.width;
+            mConfig.height = l.height;
+            mConfig.enc.bitRate = l.bitRate;
+        }
+        mConfig.enc.minBitRate = mConfig.enc.bitRate;
+        mConfig.enc.maxBitRate = mConfig.enc.bitRate;
         return 0;
     }
+
+    virtual void reportReception(const ReceptionReport& rr) {
+        unsigned long bps;
+        OMX_ERRORTYPE omxError;
+
+        if (NULL == hEncoder_ || !rate_.enabled() || !rate_.update(rr, bps)) {
+            return;
+        }
+
+        omxError = omx::video::encoder::SetBitrate(hEncoder_, (OMX_U32)bps);
+        if (OMX_ErrorNone != omxError) {
+            QCAM_ERR("failed to set the bitrate %lu : 0x%x", bps, omxError);
+        }
+    }
 };
 
 /* Find and select the camera to use */
@@ -270,13 +419,24 @@ int VSession::initializeCamera()
     int rc = EXIT_SUCCESS;
     int camId;
 
-    camId = getCameraByFunction(0);   /* TODO: configure camera identification */
+    camId = mConfig.cameraId;
+    if (camId < 0) {
+        camId = getCameraByFunction(0);   /* default to the camera by function */
+    }
     if (camId == -1 ) {
         QCAM_ERR("Failed to find camera by function: %d", 0);
         THROW(rc, ENOENT);
     }
 
-    camera_ = CameraFactory::get(camId);
+    /* a layer is scaled from the frames of the camera */
+    if (0 < mConfig.layer) {
+        camera_ = CameraFactory::getScaled(camId, mConfig.sourceWidth,
+                                           mConfig.sourceHeight,
+                                           mConfig.width, mConfig.height);
+    }
+    else {
+        camera_ = CameraFactory::get(camId);
+    }
     if (!camera_) {
         THROW(rc, EIO);
     }
@@ -346,6 +506,9 @@ int VSession::configureEncoder()
     }
     QCAM_INFO("Encoder configured.");
 
+    rate_.reset(mConfig.enc.minBitRate, mConfig.enc.maxBitRate,
+                encoderConfig_.nBitrate);
+
     CATCH(rc) {QCAM_ERR("failed to configureEncoder : %d", rc);}
     return rc;
 }
@@ -447,6 +610,11 @@ int VSession::stop()
         QCAM_INFO("Session[%d] stop", (int)stream_);
         encoderComponent_.enter_and_wait_until(OMX_StateIdle);
 
+        /* the sink must let go of the encoder buffers before they are freed */
+        if (outputComponent_) {
+            outputComponent_->close();
+        }
+
         /* Tear down the encoder and camera components */
         encoderComponent_.reset();
         cameraComponent_.reset();
@@ -521,22 +689,16 @@ public:
     }
 };
 
-class PreviewSession : public VSession, public omxa::IPreviewComp {
-
-    omxa::PreviewComponentPtr preview_;
-    std::shared_ptr<FramedSource> inputSource_;
-    omxa::PreviewParameters params_;
-
+/**
+ A session of the preview stream of the camera, encoded for live streaming
+ with a low latency. The sink is up to the subclass.
+ **/
+class LiveSession : public VSession {
 public:
-    PreviewSession() {
+    LiveSession() {
         stream_ = omxa::CameraComponent::STREAM_PREVIEW;
     }
 
-    virtual int openFramedSource(
-        UsageEnvironment& env, std::shared_ptr<FramedSource>& source_out) {
-        return preview_->openDiscreteH264Source(env, source_out);
-    }
-
     virtual int configureCamera() {
         camera::ImageSize frame_size;
         int rc = EXIT_SUCCESS;
@@ -559,9 +721,79 @@ public:
         return rc;
     }
 
+    virtual int configureEncoder() {
+        encoderConfig_.eCodecProfile = omx::video::encoder::AVCProfileBaseline;
+        encoderConfig_.nBitrate      = mConfig.enc.bitRate;
+        encoderConfig_.nIntraPeriod  = mConfig.enc.intraPeriod;
+
+        /* low latency mode, each slice is delivered as soon as it is encoded
+           rather than waiting for the whole frame */
+        if (0 < mConfig.enc.sliceMbs) {
+            encoderConfig_.eResyncMarkerType = omx::video::encoder::RESYNC_MARKER_MB;
+            encoderConfig_.nResyncMarkerSpacing = mConfig.enc.sliceMbs;
+            encoderConfig_.bSliceDelivery = OMX_TRUE;
+        }
+        else {
+            encoderConfig_.eResyncMarkerType = omx::video::encoder::RESYNC_MARKER_NONE;
+            encoderConfig_.nResyncMarkerSpacing = 0;
+            encoderConfig_.bSliceDelivery = OMX_FALSE;
+        }
+
+        return VSession::configureEncoder();
+    }
+
+    virtual int startPlaying() {
+        QCAM_INFO("start previewing");
+        return camera_->startPreview();
+    }
+
+    virtual void stopPlaying() {
+        QCAM_INFO("Stop previewing");
+        camera_->stopPreview();
+    }
+};
+
+class PreviewSession : public LiveSession, public omxa::IPreviewComp {
+
+    omxa::PreviewComponentPtr preview_;
+    std::shared_ptr<FramedSource> inputSource_;
+    omxa::PreviewParameters params_;
+    omxa::ParameterSets paramSets_;   /* cached across restarts of the session */
+
+public:
+    virtual int openFramedSource(
+        UsageEnvironment& env, std::shared_ptr<FramedSource>& source_out) {
+        return preview_->openDiscreteH264Source(env, source_out);
+    }
+
+    virtual int openSwitchSource(UsageEnvironment& env,
+        const struct timeval& after, std::shared_ptr<FramedSource>& source_out) {
+        return preview_->openSwitchSource(env, after, source_out);
+    }
+
+    virtual int getParameterSets(omxa::ParameterSets& out) {
+        omxa::ParameterSets ps;
+
+        /* refresh the cache from the running encoder */
+        if (preview_ && 0 == preview_->getParameterSets(ps)) {
+            paramSets_ = ps;
+        }
+        if (paramSets_.empty()) {
+            return ENODATA;
+        }
+        out = paramSets_;
+        return 0;
+    }
+
     virtual int initSink() {
         int rc;
 
+        /* the ring must leave the encoder a buffer to fill. The buffers
+           readers hold past their eviction are made up for by copies */
+        if ((OMX_S32)params_.ringSize >= outputBuffersCount_) {
+            params_.ringSize = outputBuffersCount_ - 1;
+        }
+
         TRY(rc, omxa::PreviewComponent::create(params_, &preview_));
         TRY(rc, preview_->openOMXSink(hEncoder_, &outputComponent_));
 
@@ -570,21 +802,101 @@ public:
     }
 
     virtual int configureEncoder() {
-        encoderConfig_.eCodecProfile = omx::video::encoder::AVCProfileBaseline;
-        encoderConfig_.nBitrate      = 1024 * 1024; // TODO:  use params_
-        encoderConfig_.nIntraPeriod  = 6; // TODO:  use params_
+        params_.idrOnJoin = mConfig.enc.idrOnJoin;
+        params_.latencyBudgetMs = mConfig.enc.latencyBudgetMs;
+        params_.latencyBudgetBytes = mConfig.enc.latencyBudgetBytes;
+        params_.sliceMode = 0 < mConfig.enc.sliceMbs;
 
-        return VSession::configureEncoder();
+        return LiveSession::configureEncoder();
     }
+};
 
-    virtual int startPlaying() {
-        QCAM_INFO("start previewing");
-        return camera_->startPreview();
+/**
+ A session streamed as MPEG-TS over UDP straight from the encoder's callback,
+ to the destination in the "mpegts" object of the session in camerad.json.
+ **/
+class TsSession : public LiveSession {
+    omxa::TsComponent ts_;
+    omxa::TsParameters params_;
+
+    /* the destination of the session named by the params in camerad.json */
+    static int getDestination(JSONParser& params, omxa::TsParameters& out) {
+        JSONParser js;
+        JSONID jsid;
+        char name[64];
+        char address[INET_ADDRSTRLEN];
+        unsigned int id = 0;
+        unsigned int val;
+        int n;
+        int rc = 0;
+
+        if (JSONPARSER_SUCCESS != JSONParser_Lookup(&params, 0, "name", 0, &jsid)
+            || JSONPARSER_SUCCESS != JSONParser_GetString(&params, jsid, name,
+                                                          sizeof(name), &n)
+            || (int)sizeof(name) < n) {
+            THROW(rc, EINVAL);
+        }
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&params, 0, "id", 0, &jsid)) {
+            (void)JSONParser_GetUInt(&params, jsid, &id);
+        }
+
+        TRY(rc, cfgGetSession(id, name, js));
+
+        if (JSONPARSER_SUCCESS != JSONParser_Lookup(&js, 0, "mpegts.address", 0, &jsid)
+            || JSONPARSER_SUCCESS != JSONParser_GetString(&js, jsid, address,
+                                                          sizeof(address), &n)) {
+            QCAM_ERR("no mpegts destination for session %s", name);
+            THROW(rc, ENOENT);
+        }
+        out.address = address;
+
+        if (JSONPARSER_SUCCESS != JSONParser_Lookup(&js, 0, "mpegts.port", 0, &jsid)
+            || JSONPARSER_SUCCESS != JSONParser_GetUInt(&js, jsid, &val)
+            || 0 == val || 65535 < val) {
+            QCAM_ERR("invalid mpegts port of session %s", name);
+            THROW(rc, EINVAL);
+        }
+        out.port = val;
+
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "mpegts.ttl", 0, &jsid)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)
+            && 0 < val && val < 256) {
+            out.ttl = val;
+        }
+        if (JSONPARSER_SUCCESS == JSONParser_Lookup(&js, 0, "mpegts.delay", 0, &jsid)
+            && JSONPARSER_SUCCESS == JSONParser_GetUInt(&js, jsid, &val)) {
+            out.delayMs = val;
+        }
+
+        CATCH(rc) {}
+        return rc;
     }
 
-    virtual void stopPlaying() {
-        QCAM_INFO("Stop previewing");
-        camera_->stopPreview();
+public:
+    virtual int setConfig(JSONParser& js) {
+        int rc;
+
+        TRY(rc, LiveSession::setConfig(js));
+        TRY(rc, getDestination(js, params_));
+
+        CATCH(rc) {}
+        return rc;
+    }
+
+    virtual int initSink() {
+        int rc;
+
+        TRY(rc, ts_.init(params_));
+        TRY(rc, ts_.openOMXSink(hEncoder_, &outputComponent_));
+
+        CATCH(rc) {}
+        return rc;
+    }
+
+    virtual int configureEncoder() {
+        params_.sliceMode = 0 < mConfig.enc.sliceMbs;
+
+        return LiveSession::configureEncoder();
     }
 };
 
@@ -604,39 +916,51 @@ static ISession* createSession(SessionType sessionType)
         return new PreviewSession();
     }
 
+    if (QCAM_SESSION_MPEGTS == sessionType) {
+        return new TsSession();
+    }
+
     return NULL;
 }
 
-std::map<SessionType, std::weak_ptr<ISession>> SessionMgr::sessions_;
+std::map<SessionMgr::SessionKey, std::weak_ptr<ISession>> SessionMgr::sessions_;
+std::mutex SessionMgr::lock_;
 
-std::shared_ptr<ISession> SessionMgr::get(SessionType st)
+std::shared_ptr<ISession> SessionMgr::get(SessionType st, const std::string& name)
 {
+    std::unique_lock<std::mutex> lk(lock_);
     std::shared_ptr<ISession> s = nullptr;
+    SessionKey key(st, name);
 
-    auto i = sessions_.find(st);
+    auto i = sessions_.find(key);
     if (i != sessions_.end()) {   /* found */
         s = i->second.lock();
     }
-    else {
+    /* expired ones may linger until their deleter takes the lock */
+    if (!s) {
         ISession* nsess = createSession(st);
 
         if (NULL != nsess) {
-            QCAM_INFO("New Session type: %d\n", (int)st);
+            QCAM_INFO("New Session type: %d, name: '%s'\n", (int)st,
+                      name.c_str());
 
             /* install in the shared ptr. override the default delete */
             s.reset(nsess, [](ISession* p) {
-                auto j = sessions_.begin();
-                while (j != sessions_.end()) {
-                    if (j->second.expired()) {
-                        sessions_.erase(j++);
-                    }
-                    else {
-                        j++;
+                {
+                    std::unique_lock<std::mutex> lk(lock_);
+                    auto j = sessions_.begin();
+                    while (j != sessions_.end()) {
+                        if (j->second.expired()) {
+                            sessions_.erase(j++);
+                        }
+                        else {
+                            j++;
+                        }
                     }
                 }
                 delete p;
             });
-            sessions_[st] = s;
+            sessions_[key] = s;
         }
     }
     return s;
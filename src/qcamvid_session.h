@@ -29,9 +29,12 @@
 #ifndef __QCAMVID_SESSION_H__
 #define __QCAMVID_SESSION_H__
 #include <string>
+#include <vector>
 #include "json/json_parser.h"
+#include "fpv_rate.h"
 #include <memory>
 #include <map>
+#include <mutex>
 #include <string>
 
 namespace camerad
@@ -40,18 +43,43 @@ namespace camerad
 /** H264 encoder configuration */
 struct H264Config {
     unsigned long bitRate = 1000000; /**< bitrate of encoded video stream */
+    unsigned long minBitRate = 250000;  /**< lowest bitrate the stream adapts to */
+    unsigned long maxBitRate = 4000000; /**< highest bitrate the stream adapts to; equal to minBitRate for a fixed bitrate */
     std::string h264Profile = "baseline"; /**< h264 codec profile; valid values : baseline, main, or high */
     std::string h264Level = "1"; /**< h264 codec profile; valid values : https://en.wikipedia.org/wiki/H.264/MPEG-4_AVC#Levels */
+    unsigned sliceMbs = 0; /**< macroblocks per slice, each slice is streamed as soon as it is encoded; 0 streams whole frames */
+    unsigned intraPeriod = 6; /**< frames per group of pictures, a client joining mid-GOP is started from the cached GOP */
+    bool idrOnJoin = true; /**< request an IDR frame when a client joins and the GOP isn't cached */
+    unsigned latencyBudgetMs = 250; /**< a client this far behind drops frames; 0 for no limit */
+    unsigned latencyBudgetBytes = 0; /**< a client this many octets behind drops frames; 0 for no limit */
+};
+
+/** most layers below a session, "layers" of its config */
+#define SESSION_MAX_LAYERS 3
+
+/** A lower resolution layer of a simulcast, encoded from the frames of the
+ *  session scaled down */
+struct LayerConfig {
+    int width = 0;
+    int height = 0;
+    unsigned long bitRate = 0;   /**< fixed bitrate of the layer */
 };
 
 /** Video session config, default values are used for initialization. */
 struct SessionConfig
 {
+    int cameraId = -1;  /**< index of the camera; -1 selects the default camera */
     int width = 1280;   /**< width of the video */
     int height = 720;   /**< height of the video */
     int fps = 24;       /**< frames per second of the video */
     std::string focusMode = "off";   /**< focus setting; supported values : TODO */
     H264Config enc;     /**< H264 encoder configuration */
+    std::vector<LayerConfig> layers;  /**< layers below the session, from the
+                                           highest resolution to the lowest */
+    unsigned layer = 0;  /**< layer encoded by the session, 0 for the session
+                              itself. @sa ISession::setLayer() */
+    int sourceWidth = 0;   /**< width of the frames a layer is scaled from */
+    int sourceHeight = 0;  /**< height of the frames a layer is scaled from */
 };
 
 /**
@@ -97,6 +125,23 @@ public:
      @param js json parser instance
      **/
     virtual int setConfig(JSONParser& js) = 0;
+
+    /**
+     Feed back the reception quality reported by the remote clients, the
+     session adapts the bitrate of the encoder to it.
+     @param rr the worst of the reports from the clients
+     **/
+    virtual void reportReception(const ReceptionReport& rr) = 0;
+
+    /**
+     Encode a layer of the simulcast configured, set before starting the
+     session. The layers have a fixed bitrate, the clients rather switch
+     between them. Layer k > 0 is encoded from the camera frames of layer 0
+     scaled down, it is best started ahead of layer 0.
+     @param layer 0 for the full resolution, else the index in the layers + 1
+     @return int 0 on success or EINVAL for an unknown layer
+     **/
+    virtual int setLayer(unsigned layer) = 0;
 };
 
 enum SessionType {
@@ -104,12 +149,30 @@ enum SessionType {
                                  stream from camera */
     QCAM_SESSION_RECORDING, /**< Session for recording to filesystem, uses
                                  a dedicated video stream from camera */
+    QCAM_SESSION_MPEGTS,    /**< A session streaming MPEG-TS over UDP, uses
+                                 preview stream from camera */
 };
 
+/**
+ SessionMgr owns the live sessions. Sessions are identified by their type and
+ a name, which allows several sessions of the same type to co-exist. e.g. one
+ rtp session for each RTSP mount point.
+ **/
 class SessionMgr {
-    static std::map<SessionType, std::weak_ptr<ISession>> sessions_;
+    typedef std::pair<SessionType, std::string> SessionKey;
+    static std::map<SessionKey, std::weak_ptr<ISession>> sessions_;
+    static std::mutex lock_;   /* the sessions are shared by the rtsp threads */
 public:
-    static std::shared_ptr<ISession> get(SessionType st);
+    /**
+     get the session identified by the type and name. Dynamically constructs
+     a new one or re-uses an existing one if present.
+
+     @param st : type of the session
+     @param name : name of the session, default is the unnamed session.
+     @return std::shared_ptr<ISession>
+     **/
+    static std::shared_ptr<ISession> get(SessionType st,
+                                         const std::string& name = "");
 };
 
 }
@@ -0,0 +1,134 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "fpv_fec.h"
+#include <random>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* groups of media packets sent, a random one of each lost */
+#define TEST_GROUPS 5000
+
+/* payload types of the media and of the parity packets */
+#define TEST_MEDIA_PT 96
+#define TEST_FEC_PT 97
+
+#define TEST_SSRC 0x12345678
+
+using namespace camerad;
+
+typedef std::vector<uint8_t> Packet;
+
+/** a media packet, its header in the first iovec as the rtp sink sends it */
+static Packet makePacket(std::mt19937& rnd, uint16_t seq, uint32_t ts, bool marker)
+{
+    Packet p(FEC_RTP_HEADER_SIZE + 1 + rnd() % FEC_PAYLOAD_MAX);
+
+    p[0] = 0x80;
+    p[1] = (marker ? 0x80 : 0) | TEST_MEDIA_PT;
+    p[2] = seq >> 8;
+    p[3] = seq & 0xFF;
+    p[4] = ts >> 24;
+    p[5] = ts >> 16;
+    p[6] = ts >> 8;
+    p[7] = ts;
+    p[8] = TEST_SSRC >> 24;
+    p[9] = (TEST_SSRC >> 16) & 0xFF;
+    p[10] = (TEST_SSRC >> 8) & 0xFF;
+    p[11] = TEST_SSRC & 0xFF;
+    for (size_t i = FEC_RTP_HEADER_SIZE; i < p.size(); i++) {
+        p[i] = rnd();
+    }
+    return p;
+}
+
+/**
+ round-trip the parity packets through FecReceiver: groups of random size,
+ packets and time stamps, the sequence numbers wrapping, a random packet
+ of every group lost. Every lost media packet is to be recovered as sent.
+ **/
+int main(int argc, char* argv[])
+{
+    std::mt19937 rnd(1 < argc ? atoi(argv[1]) : 5109);
+    FecReceiver receiver(TEST_MEDIA_PT, TEST_FEC_PT);
+    FecParity parity;
+    uint8_t fec[FEC_RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_PAYLOAD_MAX];
+    uint16_t seq = 65000;
+    uint32_t ts = rnd();
+    unsigned lost = 0;
+    unsigned failed = 0;
+
+    for (int g = 0; g < TEST_GROUPS; g++) {
+        size_t count = 1 + rnd() % (FEC_MASK_PACKETS - 1);
+        size_t loss = rnd() % (count + 1);   /* count: the parity packet */
+        std::vector<Packet> group;
+        std::vector<Packet> out;
+
+        parity.reset(seq);
+        for (size_t i = 0; i < count; i++) {
+            Packet p = makePacket(rnd, seq++, ts, i + 1 == count);
+
+            /* the payload split over the iovecs, as the nal units are */
+            size_t split = FEC_RTP_HEADER_SIZE + rnd() % (p.size() - FEC_RTP_HEADER_SIZE + 1);
+            struct iovec iov[3] = {
+                { &p[0], FEC_RTP_HEADER_SIZE },
+                { &p[FEC_RTP_HEADER_SIZE], split - FEC_RTP_HEADER_SIZE },
+                { &p[split], p.size() - split },
+            };
+            parity.add(iov, 3);
+            group.push_back(p);
+        }
+        ts += 3000;
+
+        size_t size = parity.write(fec, TEST_FEC_PT, seq++, ts, TEST_SSRC);
+        for (size_t i = 0; i < count; i++) {
+            if (i != loss && 0 != receiver.receive(group[i].data(), group[i].size(), out)) {
+                fprintf(stderr, "group %d: packet %zu not taken\n", g, i);
+                failed++;
+            }
+        }
+        if (count == loss) {   /* nothing to recover */
+            continue;
+        }
+        lost++;
+        if (1 != receiver.receive(fec, size, out)) {
+            fprintf(stderr, "group %d: packet %zu of %zu not recovered\n", g, loss, count);
+            failed++;
+        }
+        else if (out.back() != group[loss]) {
+            fprintf(stderr, "group %d: packet %zu of %zu recovered wrong\n", g, loss, count);
+            failed++;
+        }
+    }
+
+    printf("%d groups, %u packets lost, %llu recovered, %llu unrecoverable, "
+           "%u failed\n", TEST_GROUPS, lost, (unsigned long long)receiver.recovered(),
+           (unsigned long long)receiver.unrecoverable(), failed);
+    return 0 == failed && lost == receiver.recovered() ? 0 : 1;
+}
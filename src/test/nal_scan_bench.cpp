@@ -0,0 +1,152 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include "omx/nal_scan.h"
+#include <chrono>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* octets of the stream scanned, a few access units of a 4K stream */
+#define BENCH_SIZE (4 << 20)
+
+/* passes over the stream timed, per scan */
+#define BENCH_PASSES 50
+
+using namespace omxa;
+
+typedef const uint8_t* (*Scan)(const uint8_t* p, const uint8_t* end);
+
+/**
+ an H.264 like stream: random octets with the emulation prevention of the
+ encoder, NAL units of random size behind 3 or 4 octet start codes.
+ **/
+static std::vector<uint8_t> makeStream(std::mt19937& rnd, size_t nalMax)
+{
+    std::vector<uint8_t> s;
+
+    s.reserve(BENCH_SIZE + nalMax + 4);
+    while (s.size() < BENCH_SIZE) {
+        size_t len = 1 + rnd() % nalMax;
+
+        if (0 == rnd() % 2) {
+            s.push_back(0);
+        }
+        s.push_back(0);
+        s.push_back(0);
+        s.push_back(1);
+        for (size_t i = 0; i < len; i++) {
+            uint8_t v = 0 == rnd() % 4 ? 0 : rnd();   /* zero runs, as in slices */
+            size_t n = s.size();
+
+            if (2 <= n && 0 == s[n - 1] && 0 == s[n - 2] && v <= 3) {
+                s.push_back(3);   /* emulation prevention */
+            }
+            s.push_back(v);
+        }
+    }
+    return s;
+}
+
+/** @return size_t : the start codes found from every offset, scanning on */
+static size_t scan(Scan f, const std::vector<uint8_t>& s)
+{
+    const uint8_t* end = s.data() + s.size();
+    const uint8_t* p = f(s.data(), end);
+    size_t found = 0;
+
+    while (p != end) {
+        found++;
+        p = f(p + 3, end);
+    }
+    return found;
+}
+
+/** @return double : GB/s of the scan over the stream */
+static double measure(Scan f, const std::vector<uint8_t>& s, size_t& found)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < BENCH_PASSES; i++) {
+        found = scan(f, s);
+    }
+
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    return (double)s.size() * BENCH_PASSES / t.count() / 1e9;
+}
+
+/** check the scans agree from every offset of the range given */
+static bool check(const std::vector<uint8_t>& s, size_t from, size_t to)
+{
+    const uint8_t* end = s.data() + s.size();
+
+    for (size_t i = from; i < to && i < s.size(); i++) {
+        const uint8_t* a = findStartCode(s.data() + i, end);
+        const uint8_t* b = findStartCodeScalar(s.data() + i, end);
+
+        if (a != b) {
+            fprintf(stderr, "from offset %zu: start code at %zd, %zd expected\n",
+                    i, a - s.data(), b - s.data());
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ check the vectorized findStartCode() against the scalar scan, then measure
+ both over streams of short and of long NAL units
+ **/
+int main(int argc, char* argv[])
+{
+    std::mt19937 rnd(1 < argc ? atoi(argv[1]) : 264);
+    const size_t nalMax[] = { 64, 1400, 64 << 10 };
+    int rc = 0;
+
+    for (size_t n : nalMax) {
+        std::vector<uint8_t> s = makeStream(rnd, n);
+        size_t simd, scalar;
+
+        if (!check(s, 0, 64 << 10) || !check(s, s.size() - 256, s.size())) {
+            rc = 1;
+        }
+
+        double simdRate = measure(findStartCode, s, simd);
+        double scalarRate = measure(findStartCodeScalar, s, scalar);
+
+        if (simd != scalar) {
+            fprintf(stderr, "%zu start codes found, %zu expected\n", simd, scalar);
+            rc = 1;
+        }
+        printf("nal units up to %6zu octets, %7zu start codes: "
+               "vectorized %6.2f GB/s, scalar %6.2f GB/s, x%.1f\n",
+               n, scalar, simdRate, scalarRate, simdRate / scalarRate);
+    }
+    return rc;
+}
@@ -0,0 +1,223 @@
+/* Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* octets of a datagram at most */
+#define SPACING_PACKET_MAX 65536
+
+/* frames recorded by default */
+#define SPACING_FRAMES 300
+
+/** the arrival spacing of the packets of a frame, i.e of a rtp timestamp */
+struct Frame {
+    uint32_t ts_ = 0;
+    unsigned packets_ = 0;
+    size_t octets_ = 0;
+    int64_t first_ = 0;     /**< arrival of the first packet, in ns */
+    int64_t last_ = 0;      /**< arrival of the last packet, in ns */
+    int64_t maxGap_ = 0;    /**< longest gap between two packets, in ns */
+};
+
+static int64_t toNs(const struct timespec& t)
+{
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/** @return int64_t : the kernel time of arrival of the datagram, in ns */
+static int64_t arrival(struct msghdr& msg)
+{
+    struct timespec now;
+
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); NULL != c; c = CMSG_NXTHDR(&msg, c)) {
+        if (SOL_SOCKET == c->cmsg_level && SCM_TIMESTAMPNS == c->cmsg_type) {
+            struct timespec t;
+            memcpy(&t, CMSG_DATA(c), sizeof(t));
+            return toNs(t);
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    return toNs(now);
+}
+
+static void report(const Frame& f)
+{
+    printf("ts %10u: %4u packets, %7zu octets over %7.3f ms, gap max %7.3f ms\n",
+           f.ts_, f.packets_, f.octets_, (f.last_ - f.first_) / 1e6,
+           f.maxGap_ / 1e6);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-g group] [-n frames] port\n"
+            "  record the arrival spacing of the rtp packets of every frame\n"
+            "  on the udp port, e.g of the multicast stream or of a client\n"
+            "  of the rtsp server over the loopback, to check the pacing\n"
+            "  -g group : multicast group to join\n"
+            "  -n frames : frames recorded, %d by default\n",
+            name, SPACING_FRAMES);
+}
+
+/**
+ records the arrival of the rtp packets on a udp port and reports, per frame,
+ the time from the first to the last packet and the longest gap in between.
+ A frame sent at line rate arrives in a fraction of a millisecond, a paced
+ one spread over the share of the frame interval set with -s of camerad.
+ **/
+int main(int argc, char* argv[])
+{
+    const char* group = NULL;
+    unsigned frames = SPACING_FRAMES;
+    int on = 1;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "g:n:h"))) {
+        switch (opt) {
+        case 'g':
+            group = optarg;
+            break;
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(argv[optind]));
+    (void)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    (void)setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (0 > sock || 0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        fprintf(stderr, "udp port %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (NULL != group) {
+        struct ip_mreq mreq;
+
+        mreq.imr_multiaddr.s_addr = inet_addr(group);
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (0 != setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
+            fprintf(stderr, "group %s: %s\n", group, strerror(errno));
+            return 1;
+        }
+    }
+
+    static uint8_t packet[SPACING_PACKET_MAX];
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    Frame f;
+    unsigned done = 0;
+    uint16_t seq = 0;
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    double spreadSum = 0;
+    int64_t spreadMax = 0;
+    int64_t gapMax = 0;
+
+    while (done < frames) {
+        struct iovec iov = { packet, sizeof(packet) };
+        struct msghdr msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock, &msg, 0);
+        if (0 > n) {
+            if (EINTR == errno) {
+                continue;
+            }
+            fprintf(stderr, "recvmsg: %s\n", strerror(errno));
+            return 1;
+        }
+        if (12 > n || 2 != packet[0] >> 6) {
+            continue;   /* not rtp */
+        }
+
+        int64_t at = arrival(msg);
+        uint16_t s = packet[2] << 8 | packet[3];
+        uint32_t ts = (uint32_t)packet[4] << 24 | packet[5] << 16 | packet[6] << 8 | packet[7];
+
+        if (0 != received && 0 < (int16_t)(s - seq - 1)) {
+            lost += (int16_t)(s - seq - 1);
+        }
+        if (0 == received || 0 < (int16_t)(s - seq)) {
+            seq = s;
+        }
+        received++;
+
+        /* a new time stamp starts a new frame */
+        if (0 != f.packets_ && ts != f.ts_) {
+            report(f);
+            spreadSum += f.last_ - f.first_;
+            spreadMax = std::max(spreadMax, f.last_ - f.first_);
+            gapMax = std::max(gapMax, f.maxGap_);
+            done++;
+            f = Frame();
+        }
+        if (0 == f.packets_) {
+            f.ts_ = ts;
+            f.first_ = at;
+        }
+        else {
+            f.maxGap_ = std::max(f.maxGap_, at - f.last_);
+        }
+        f.last_ = at;
+        f.packets_++;
+        f.octets_ += n;
+    }
+
+    printf("%u frames, %llu packets, %llu lost: spread mean %.3f ms, "
+           "max %.3f ms, gap max %.3f ms\n", done, (unsigned long long)received,
+           (unsigned long long)lost, spreadSum / done / 1e6, spreadMax / 1e6,
+           gapMax / 1e6);
+    close(sock);
+    return 0;
+}
@@ -969,6 +969,192 @@ public:
     }
 };
 
+/**
+ implements a camera device streaming the preview frames of another device
+ scaled down on the GPU, for a simulcast layer. The source device is streamed
+ by its own user, the scaled device only listens to it and has no control of
+ it.
+ **/
+class CameraScaled
+: public camera::ICameraDevice, public camera::ICameraListener,
+  public ICameraVirtualListener {
+
+    camera::ICameraDevice* source_;   /**< device the frames are scaled from */
+    CameraVirtualParams params_;      /**< caller facing params */
+
+    /**< user facing listeners are added here */
+    std::vector<camera::ICameraListener*> listeners_;
+
+    bool isPreviewStarted_ = false;
+
+    uint32_t inWidth_, inHeight_, outWidth_, outHeight_;
+
+    CameraVirtualPreview* preview_ = 0;
+
+    /** Camera listener methods */
+    virtual void onError() {
+        /** TODO: */
+    }
+
+    virtual void onVideoFrame(camera::ICameraFrame* frame) {
+    }
+
+    virtual void onPreviewFrame(camera::ICameraFrame* frame) {
+        /** enqueue for processing in a separate thread */
+        preview_->enqueue(frame);
+    }
+
+    virtual void onPictureFrame(camera::ICameraFrame *frame) {
+    }
+
+    virtual void onVirtualFrame(camera::ICameraFrame* fLow,
+                                camera::ICameraFrame* fHigh){
+
+        /** TODO: iterator needs guard */
+        for (auto& l : listeners_) {
+            l->onPreviewFrame(fLow);
+        }
+    }
+
+public:
+
+    CameraScaled(camera::ICameraDevice* source, uint32_t inWidth,
+                 uint32_t inHeight, uint32_t outWidth, uint32_t outHeight)
+    : source_(source), params_(source), inWidth_(inWidth), inHeight_(inHeight),
+      outWidth_(outWidth), outHeight_(outHeight) {
+        params_.setValue("preview-size", std::to_string(outWidth) + "x"
+                         + std::to_string(outHeight));
+    }
+
+    virtual ~CameraScaled() {
+        stopPreview();
+        delete preview_;
+        preview_ = 0;
+    }
+
+    int init() {
+        return CameraVirtualPreview::create(*this, &preview_);
+    }
+
+    virtual void addListener(camera::ICameraListener *listener) {
+        /** TODO: needs guard */
+        for (auto& l : listeners_) {
+            if (l == listener) {
+                return;
+            }
+        }
+
+        listeners_.push_back(listener);
+    }
+
+    virtual void removeListener(camera::ICameraListener *listener) {
+        /** TODO: needs guard */
+
+        listeners_.erase(std::remove(listeners_.begin(), listeners_.end(),
+                                     listener),
+                         listeners_.end());
+    }
+
+    virtual void subscribe(uint32_t eventMask) {
+    }
+
+    virtual void unsubscribe(uint32_t eventMask) {
+    }
+
+    /** the scale is fixed when the device is made, the params are kept for
+        the caller only */
+    virtual int setParameters(const camera::ICameraParameters& params) {
+        std::stringbuf buffer;
+        std::ostream os(&buffer);  // associate stream buffer to stream
+        int rc;
+
+        TRY(rc, params.writeObject(os));
+
+        params_.update(buffer.str());
+
+        CATCH(rc) {}
+        return rc;
+    }
+
+    virtual int getParameters(uint8_t* buf, uint32_t bufSize,
+                              int* bufSizeRequired) {
+        std::stringbuf buffer;
+        std::ostream os(&buffer);  // associate stream buffer to stream
+
+        int rc = params_.writeObject(os);
+
+        if (0 == rc) {
+            uint32_t len = buffer.str().length();
+            memmove(buf, buffer.str().c_str(), std::min(bufSize, len));
+            if (0 != bufSizeRequired) {
+                *bufSizeRequired = len;
+            }
+        }
+        return rc;
+    }
+
+    /** start listening to the source, best before its user starts it */
+    virtual int startPreview() {
+        int rc = 0;
+
+        if (isPreviewStarted_) {
+            THROW(rc, EALREADY);
+        }
+
+        TRY(rc, preview_->start(inWidth_, inHeight_, outWidth_, outHeight_));
+        source_->addListener(this);
+        isPreviewStarted_ = true;
+
+        CATCH(rc) {}
+        return rc;
+    }
+
+    virtual void stopPreview() {
+        if (isPreviewStarted_) {
+            isPreviewStarted_ = false;
+            source_->removeListener(this);
+            preview_->stop();
+        }
+    }
+
+    virtual int startRecording() {
+        return ENOTSUP;
+    }
+
+    virtual void stopRecording() {
+    }
+
+    virtual int takePicture() {
+        return ENOTSUP;
+    }
+
+    /* added for ICameraDevice new changes */
+    virtual int startAutoFocus() { return 0; }
+    virtual void stopAutoFocus() { ; }
+
+    static int create(camera::ICameraDevice* source, uint32_t inWidth,
+                      uint32_t inHeight, uint32_t outWidth, uint32_t outHeight,
+                      ICameraDevice** device) {
+        int rc = 0;
+        CameraScaled* me = new CameraScaled(source, inWidth, inHeight,
+                                            outWidth, outHeight);
+
+        if (0 == me) {
+            THROW(rc, ENOMEM);
+        }
+
+        TRY(rc, me->init());
+
+        CATCH(rc) {
+            delete me; me = 0;
+        }
+
+        *device = me;
+
+        return rc;
+    }
+};
+
 extern "C" {
 int CameraVirtual_CreateInstance(int idx, camera::ICameraDevice** po)
 {
@@ -976,4 +1162,15 @@ int CameraVirtual_CreateInstance(int idx, camera::ICameraDevice** po)
 
     return CameraVirtual::create(idx, po);
 }
+
+int CameraVirtual_CreateScaled(camera::ICameraDevice* source,
+                               uint32_t inWidth, uint32_t inHeight,
+                               uint32_t outWidth, uint32_t outHeight,
+                               camera::ICameraDevice** po)
+{
+    QCAM_INFO("%ux%u to %ux%u\n", inWidth, inHeight, outWidth, outHeight);
+
+    return CameraScaled::create(source, inWidth, inHeight, outWidth, outHeight,
+                                po);
+}
 }
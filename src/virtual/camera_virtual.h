@@ -30,6 +30,7 @@
 #ifndef __CAMERA_VIRTUAL_H__
 #define __CAMERA_VIRTUAL_H__
 #include <camera.h>
+#include <stdint.h>
 
 /**
  implements a virtual camera device over a physical device. In this the virtual
@@ -45,4 +46,22 @@
  **/
 extern "C" int CameraVirtual_CreateInstance(int idx, camera::ICameraDevice** po);
 
+/**
+ implements a virtual camera device streaming the preview frames of another
+ device scaled down on the GPU, e.g. for the lower layers of a simulcast. The
+ source device isn't controlled by the scaled one, its frames are scaled while
+ both are started.
+
+ @param [in] source : device to scale the preview frames of
+ @param [in] inWidth, inHeight : preview size of the source
+ @param [in] outWidth, outHeight : preview size of the scaled device
+ @param [out] po : instance to the ICameraDevice
+
+ @return int : 0 on success
+ **/
+extern "C" int CameraVirtual_CreateScaled(camera::ICameraDevice* source,
+                                          uint32_t inWidth, uint32_t inHeight,
+                                          uint32_t outWidth, uint32_t outHeight,
+                                          camera::ICameraDevice** po);
+
 #endif /* __CAMERA_VIRTUAL_H__ */